@@ -5,29 +5,151 @@
  *          - Testing individual numbers for primality
  *          - Finding and counting primes in a range
  *          - Finding numbers with specific counts of prime factors
+ *          - Summing the primes in a range
  * 
  * Input Format:
- *   Main Menu: Enter number 0-3 to select operation
- *   Task 1: Single positive integer (0 to exit)
+ *   Main Menu: Enter number 0-4 to select operation
+ *   Task 1: Single positive integer below 2^128 (0 to exit)
  *   Task 2: Two integers separated by comma (e.g., "10,20"), then y/n for display
+ *           (only primes p = A mod Q with --residue=A,Q; constellations with --tuple)
+ *           (or b and a file name to save the primes in binary form, t for text)
  *   Task 3: Two integers for range, one for factor count, then y/n for display
+ *   Task 4: Two integers separated by comma
  * 
  * Sample Usage:
  *   Task 1: Enter "17" to test if 17 is prime
  *   Task 2: Enter "1,100" to find primes between 1 and 100
  *   Task 3: Enter "1,50" then "3" to find numbers with exactly 3 prime factors
+ *   Task 4: Enter "1,1000000000000" to sum the primes up to 10^12
+ *
+ * Long Runs:
+ *   Task 2 and Task 3 ranges run on background worker threads. While results
+ *   are hidden a progress line with an ETA is shown; press Ctrl-C to cancel
+ *   the run and keep the partial count.
+ *
+ * Command Line:
+ *   --resume                      Continue a range job from its checkpoint
+ *   --checkpoint=FILE             Checkpoint file (default Lab05.checkpoint)
+ *   --checkpoint-interval=SECS    Seconds between checkpoints (default 60, 0 = off)
+ *   --worker[=PORT]               Serve count/Omega chunks over TCP (default port 5905)
+ *   --coordinator=HOST:PORT,...   Split a job across workers; needs one of:
+ *     --count=N1,N2                 count primes in [N1, N2]
+ *     --omega=N1,N2                 histogram of prime factor counts over [N1, N2]
+ *   --read-primes=FILE            Print a binary prime list saved by Task 2
+ *   --read-range=LO,HI            ...only the primes in [LO, HI]
+ *   --cpu-report                  Show the CPU features and kernel variants in use
+ *   --cpu=LEVEL                   Cap kernels at baseline, sse4.2, avx2 or avx512
+ *   --perf-counters               Report cycles, IPC and cache/branch misses per task (Linux)
+ *   --trace=FILE                  Save a Chrome trace (Perfetto) of engine phases at exit
+ *   --mem-limit=SIZE              Fit each query in SIZE bytes (K/M/G suffixes); report peak use
+ *   --engine=NAME                 Task 2 sieve: eratosthenes (default) or atkin
+ *   --benchmark                   Time both sieve engines over a set of ranges
+ *   --factor-file=FILE            Factor every number listed in FILE, one line each
+ *   --factor-output=FILE          ...writing the lines to FILE instead of the screen
+ *   --classify=FILE               Mark every number in FILE prime (1) or not (0), one line each
+ *   --classify-output=FILE        ...writing the lines to FILE instead of the screen
+ *   --arith=N1,N2                 Evaluate multiplicative functions for every n in [N1, N2]
+ *   --functions=LIST              ...only these, of phi, mu, sigma, d (default all)
+ *   --arith-output=FILE           ...writing them to FILE as binary columns instead of a text table
+ *   --csr=N1,N2                   Save the factorization of every n in [N1, N2] as a CSR table...
+ *   --csr-output=FILE             ...to FILE (required)
+ *   --read-csr=FILE               Print a table saved by --csr (--read-range=LO,HI picks rows)
+ *   --residue=A,Q                 Task 2 only counts and lists the primes p = A (mod Q)
+ *   --tuple=0,O1,...,Ok           Task 2 finds the n with n, n + O1, ..., n + Ok all prime
+ *   --explain                     Print the engine the query planner picks for Tasks 1-3, and why
+ *   --approximate=SECONDS         Task 2 counts give an estimate with proven bounds, refined for SECONDS
+ *   --self-test                   Check the engines against known results and each other, then exit
  *
  * Created by: Anthony Reimche
  *******************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <psapi.h>
+typedef SOCKET socket_t;
+#define SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define SEND_FLAGS MSG_NOSIGNAL  // Report a dropped peer as an error instead of SIGPIPE
+
+#endif
+
+// SSE2 is part of x86-64, so the classify parser needs no runtime dispatch
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+/*******************************************************************************
+ * Function: scanf_s
+ * 
+ * Input:
+ *   - format: scanf format string
+ *   - ...: the conversion targets, each %c/%s target followed by its size
+ * 
+ * Output:
+ *   - Returns the number of conversions stored, as scanf does
+ * 
+ * Purpose:
+ *   Stands in for the Microsoft runtime's scanf_s. The size arguments only
+ *   ever follow the last conversion here, so vscanf leaves them unread;
+ *   bounded %Ns widths keep the buffers safe
+ *******************************************************************************/
+int scanf_s(const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int stored = vscanf(format, arguments);
+    va_end(arguments);
+    return stored;
+}
+#endif
 
 /*******************************************************************************
  * Function: isPrimeTest
  * 
  * Input:
- *   - Prompts user for positive integers, one at a time
+ *   - Prompts user for positive integers below 2^128, one at a time
  *   - Enter 0 to exit
  * 
  * Output:
@@ -44,12 +166,17 @@ void isPrimeTest(void);
  * 
  * Input:
  *   - Two integers (n1,n2) defining the range, comma-separated
- *   - Display option (y/n)
+ *   - Display option (y/n, or b / t to save the primes to a binary / text file)
  *   - Enter 0 for either number to exit
  * 
  * Output:
  *   - If display=y: Lists all prime numbers found
+ *   - If display=b: Writes them to a binary prime list (see exportPrimesBinary)
+ *   - If display=t: Writes them to a text file, one per line (see exportPrimesText)
  *   - Total count of prime numbers in range
+ *   With --residue=A,Q only the primes = A (mod Q) are counted and listed;
+ *   with --tuple the constellations starting in the range (countPrimeTuples);
+ *   with --approximate a count may end as an estimate with proven bounds
  * 
  * Purpose:
  *   Interactive function that finds and optionally displays all prime numbers
@@ -76,302 +203,9302 @@ void countPrimesTest(void);
  *******************************************************************************/
 void primeFactorizationTest(void);
 
-enum mainMenu {EXIT, TASK1, TASK2, TASK3};
-
 /*******************************************************************************
- * Function: main
+ * Function: sumPrimesTest
  * 
  * Input:
- *   - Menu selection (0-3) from user
+ *   - Two integers (n1,n2) defining the range, comma-separated
+ *   - Enter 0 for either number to exit
  * 
  * Output:
- *   - Displays menu options
- *   - Returns 0 on successful execution
+ *   - Sum of the prime numbers in the range, cross-checked against the
+ *     segmented sieve when n2 is small enough to enumerate
  * 
  * Purpose:
- *   Main control loop that presents menu and directs program flow based on
- *   user selection
+ *   Interactive function that sums the primes in a user-specified range
  *******************************************************************************/
-int main() {
-    int choice;
-    
-    do {
-        printf("\nPrime Number Operations Menu:\n");
-        printf("%d. Test if a number is prime\n", TASK1);
-        printf("%d. Count prime numbers in a range\n", TASK2);
-        printf("%d. Prime factorization\n", TASK3);
-        printf("%d. Exit\n", EXIT);
-        printf("Enter your choice (%d-%d): ", EXIT, TASK3);
-        
-        if (scanf_s("%d", &choice) != 1) {
-            // Clear input buffer if invalid input
-            while (getchar() != '\n');
-            choice = -1;  // Invalid choice
-        }
-        
-        switch (choice) {
-            case TASK1:
-                isPrimeTest();
-                break;
-            case TASK2:
-                countPrimesTest();
-                break;
-            case TASK3:
-                primeFactorizationTest();
-                break;
-            case EXIT:
-                printf("Goodbye!\n");
-                break;
-            default:
-                printf("Invalid choice. Please try again.\n");
-        }
-    } while (choice != EXIT);
-    
-    return 0;
-}
+void sumPrimesTest(void);
 
 /*******************************************************************************
- * Function: isPrime
+ * Function: pinPrimeTable
  * 
  * Input:
- *   - n: unsigned integer to test for primality
+ *   - limit: largest number whose odd prime divisors the caller will need
+ *     (at most 2^32)
  * 
  * Output:
- *   - Returns 1 if n is prime
- *   - Returns 0 if n is not prime
+ *   - Returns the list of a snapshot holding at least every odd prime
+ *     <= limit (it may hold more), valid until the matching unpinPrimeTable
+ *******************************************************************************/
+const std::vector<unsigned int> &pinPrimeTable(const unsigned long long limit);
+
+/*******************************************************************************
+ * Function: unpinPrimeTable
  * 
  * Purpose:
- *   Core function that determines if a number is prime by checking for
- *   divisibility up to its square root
+ *   Releases the calling thread's most recent pinPrimeTable
  *******************************************************************************/
-int isPrime(unsigned int n) {
-    // 0 and 1 are not prime numbers
-    if (n <= 1) {
-        return 0;
-    }
+void unpinPrimeTable(void);
 
-    // Check divisibility up to square root of n
-    // We only need to check up to sqrt(n) because if n is divisible by a number greater than its
-    // square root, it would also be divisible by a number less than its square root
-    // (i.e., if n = a*b, and a > sqrt(n), then b < sqrt(n))
-    for (unsigned int d = 2; d <= sqrt(n); d++) {
-        if (n % d == 0) {
-            return 0;  // n is divisible by d, so it's not prime
-        }
-    }
+enum mainMenu {EXIT, TASK1, TASK2, TASK3, TASK4};
 
-    return 1;  // n is prime if no divisors were found
-}
+const unsigned int MAX_TUPLE_SIZE = 12;     // Members of a --tuple pattern
+const unsigned int MAX_TUPLE_SPAN = 10000;  // Largest --tuple offset
+
+const char *const DEFAULT_CHECKPOINT_PATH = "Lab05.checkpoint";
+const unsigned int MAX_CHECKPOINT_INTERVAL = 86400;  // --checkpoint-interval: at least one save a day
+
+// Settings taken from the command line
+struct ProgramOptions {
+    bool resume;                      // --resume: continue a range job from its checkpoint
+    const char *checkpointPath;       // --checkpoint=FILE
+    unsigned int checkpointInterval;  // --checkpoint-interval=SECONDS
+    unsigned int workerPort;          // --worker[=PORT]: serve distributed chunks (0 = off)
+    const char *coordinatorWorkers;   // --coordinator=HOST:PORT,...: distribute a job (NULL = off)
+    unsigned int distributedTask;     // --count (TASK2) or --omega (TASK3) job for the coordinator
+    unsigned long long jobStart;
+    unsigned long long jobEnd;
+    const char *primeListPath;        // --read-primes=FILE: print a binary prime list (NULL = off)
+    bool readRange;                   // --read-range=LO,HI: only print primes in [LO, HI]
+    unsigned long long readFrom;
+    unsigned long long readTo;
+    bool cpuReport;                   // --cpu-report: print the kernel variants in use and exit
+    const char *cpuLevel;             // --cpu=LEVEL: cap kernel dispatch (NULL = best available)
+    const char *factorInputPath;      // --factor-file=FILE: factor every number in FILE (NULL = off)
+    const char *factorOutputPath;     // --factor-output=FILE: where to write them (NULL = stdout)
+    bool perfCounters;                // --perf-counters: report hardware counters after each task
+    const char *tracePath;            // --trace=FILE: save a Chrome trace of engine phases (NULL = off)
+    unsigned long long memLimit;      // --mem-limit=SIZE: memory budget for a query in bytes (0 = none)
+    const char *engineName;           // --engine=NAME: Task 2 sieve engine (NULL = eratosthenes)
+    bool benchmark;                   // --benchmark: compare the sieve engines and exit
+    const char *classifyInputPath;    // --classify=FILE: mark every number in FILE prime or not (NULL = off)
+    const char *classifyOutputPath;   // --classify-output=FILE: where to write them (NULL = stdout)
+    unsigned long long residueClass;  // --residue=A,Q: Task 2 only takes primes = A (mod Q)
+    unsigned long long residueModulus;  // Q (0 = every prime)
+    unsigned int tupleSize;           // --tuple=0,O1,...: Task 2 finds prime constellations (0 = off)
+    unsigned int tupleOffsets[MAX_TUPLE_SIZE];
+    bool explain;                     // --explain: print the plan chosen for each query
+    double approximateSeconds;        // --approximate=SECONDS: Task 2 counts may stop at a bounded estimate (< 0 = off)
+    bool arith;                       // --arith=N1,N2: evaluate multiplicative functions over [N1, N2]
+    unsigned long long arithFrom;
+    unsigned long long arithTo;
+    const char *arithFunctions;       // --functions=LIST: which ones (NULL = all)
+    const char *arithOutputPath;      // --arith-output=FILE: binary columns (NULL = text on stdout)
+    bool csr;                         // --csr=N1,N2: save the factorization of every n in [N1, N2]
+    unsigned long long csrFrom;
+    unsigned long long csrTo;
+    const char *csrOutputPath;        // --csr-output=FILE: where (required with --csr)
+    const char *csrInputPath;         // --read-csr=FILE: print a saved factorization table (NULL = off)
+    bool selfTest;                    // --self-test: run the built-in checks and exit
+};
+
+static ProgramOptions options = {false, DEFAULT_CHECKPOINT_PATH, 60, 0, NULL, EXIT, 0, 0, NULL, false, 0, 0, false, NULL,
+                                 NULL, NULL, false, NULL, 0, NULL, false, NULL, NULL, 0, 0, 0, {0}, false, -1,
+                                 false, 0, 0, NULL, NULL, false, 0, 0, NULL, NULL, false};
+
+const unsigned int DEFAULT_WORKER_PORT = 5905;
 
 /*******************************************************************************
- * Function: isPrimeTest
+ * Function: parseArguments
  * 
  * Input:
- *   - Prompts user for positive integers, one at a time
- *   - Enter 0 to exit
+ *   - argc, argv: command line passed to main
  * 
  * Output:
- *   - Displays whether each entered number is prime or not
+ *   - Fills the global options
+ *   - Returns 1 if all arguments were understood, 0 otherwise
  * 
  * Purpose:
- *   Interactive function that lets users test multiple numbers for primality
- *   until they choose to exit
+ *   Reads the optional command line switches before the menu starts
  *******************************************************************************/
-void isPrimeTest() {
-    unsigned int n;
-
-    while (1) {
-        printf("Please enter a positive integer: ");
-        scanf("%u", &n);
-
-        // Exit condition
-        if (n == 0) {
-            printf("Press ENTER to exit...");
-            getchar();  // Consume the newline from previous scanf
-            getchar();  // Wait for ENTER
-            break;
-        }
-
-        if (isPrime(n)) {
-            printf("%u is a prime number!\n", n);
-        } else {
-            printf("%u is not a prime number.\n", n);
-        }
-    }
-}
+int parseArguments(int argc, char *argv[]);
 
 /*******************************************************************************
- * Function: countPrimes
+ * Function: runWorker
  * 
  * Input:
- *   - n1, n2: unsigned integers defining the range to search
- *   - display: character 'y'/'Y' to show results, any other to hide
+ *   - port: TCP port to listen on
  * 
  * Output:
- *   - Returns total count of primes found
- *   - If display='y', prints each prime number found
+ *   - Serves range requests from coordinators until the process is stopped
+ *   - Returns nonzero if the port cannot be opened
  * 
  * Purpose:
- *   Core function that finds all prime numbers within a given range and
- *   optionally displays them
+ *   Entry point for "Lab05 --worker" processes
  *******************************************************************************/
-unsigned int countPrimes(const unsigned int n1, const unsigned int n2, const unsigned char display) {
-    unsigned int start = (n1 < n2) ? n1 : n2;
-    unsigned int end = (n1 < n2) ? n2 : n1;
-    unsigned int total = 0;
-
-    for (unsigned int i = start; i <= end; i++) {
-        if (isPrime(i)) {
-            total++;
-            if (display == 'y' || display == 'Y') {
-                printf("%u\n", i);
-            }
-        }
-    }
+int runWorker(unsigned int port);
 
-    return total;
-}
+/*******************************************************************************
+ * Function: runCoordinator
+ * 
+ * Output:
+ *   - Prints the reduced result of the distributed job
+ *   - Returns 0 on success, nonzero if workers were lost before it finished
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --coordinator=..." runs: splits the --count or
+ *   --omega range into chunks and hands them to the listed workers
+ *******************************************************************************/
+int runCoordinator(void);
 
 /*******************************************************************************
- * Function: countPrimesTest
+ * Function: configureKernels
  * 
- * Input:
- *   - Two integers (n1,n2) defining the range, comma-separated
- *   - Display option (y/n)
- *   - Enter 0 for either number to exit
+ * Output:
+ *   - Selects the kernel variants for this CPU, capped by --cpu
+ *   - Returns 0 if --cpu names an unknown level
+ * 
+ * Purpose:
+ *   Runtime CPU dispatch setup, done once before the menu starts
+ *******************************************************************************/
+int configureKernels(void);
+
+/*******************************************************************************
+ * Function: printCpuReport
  * 
  * Output:
- *   - If display=y: Lists all prime numbers found
- *   - Total count of prime numbers in range
+ *   - Prints the detected CPU features and the kernel variant in use
  * 
  * Purpose:
- *   Interactive function that finds and optionally displays all prime numbers
- *   within a user-specified range
+ *   Backs the --cpu-report switch
  *******************************************************************************/
-void countPrimesTest(void) {
-    unsigned int n1, n2;
-    char display;
+void printCpuReport(void);
 
-    while (1) {
-        printf("Please enter n1, n2: ");
-        scanf("%u,%u", &n1, &n2);
+/*******************************************************************************
+ * Function: configureSieveEngine
+ * 
+ * Output:
+ *   - Selects the engine named by --engine (Eratosthenes by default)
+ *   - Returns 0 if --engine names an unknown engine
+ *******************************************************************************/
+int configureSieveEngine(void);
 
-        // Exit condition
-        if (n1 == 0 || n2 == 0) {
-            printf("Press ENTER to exit...");
-            getchar();  // Consume the newline from previous scanf
-            getchar();  // Wait for ENTER
-            break;
-        }
+/*******************************************************************************
+ * Function: runPrimeListReader
+ * 
+ * Output:
+ *   - Prints the header of the --read-primes file and the primes in the
+ *     --read-range interval (the whole list if no interval was given)
+ *   - Returns 0 on success, 1 if the file is not a valid prime list
+ * 
+ * Purpose:
+ *   Command line reader for files written by Task 2's binary output
+ *******************************************************************************/
+int runPrimeListReader(void);
 
-        printf("Display the results? (y/n) ");
-        getchar();  // Consume the newline from previous scanf
-        scanf_s("%c", &display,1);
+/*******************************************************************************
+ * Function: runBatchFactorization
+ * 
+ * Output:
+ *   - Writes the factorization of every value in --factor-file to
+ *     --factor-output (standard output by default), in input order
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 on unreadable input or an out-of-range value
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --factor-file=FILE" runs
+ *******************************************************************************/
+int runBatchFactorization(void);
 
-        unsigned int total = countPrimes(n1, n2, display);
-        printf("%u total primes found between %u and %u.\n", total, n1, n2);
-    }
-}
+/*******************************************************************************
+ * Function: runClassification
+ * 
+ * Output:
+ *   - Writes "n 1" (prime) or "n 0" (not prime) for every value in
+ *     --classify to --classify-output (standard output by default), in
+ *     input order
+ *   - Prints a summary with the throughput to stderr
+ *   - Returns 0 on success, 1 on unreadable input or an out-of-range value
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --classify=FILE" runs
+ *******************************************************************************/
+int runClassification(void);
 
 /*******************************************************************************
- * Function: primeFactorization
+ * Function: runMultiplicativeFunctions
  * 
- * Input:
- *   - n1, n2: unsigned integers defining the range to search
- *   - nFactors: number of prime factors to look for
- *   - display: character 'y'/'Y' to show results, any other to hide
+ * Output:
+ *   - Writes the --functions columns for every n in the --arith range to
+ *     --arith-output, or prints them as a text table
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 on a bad function list or an unwritable file
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --arith=N1,N2" runs. A cancelled binary run
+ *   removes its file, which would have holes.
+ *******************************************************************************/
+int runMultiplicativeFunctions(void);
+
+/*******************************************************************************
+ * Function: runFactorTableExport
  * 
  * Output:
- *   - Returns count of numbers with exactly nFactors prime factors
- *   - If display='y', prints each number and its prime factorization
+ *   - Writes the factorization table of the --csr range to --csr-output
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 if the file cannot be written or the run was
+ *     cancelled (the unfinished file is removed)
  * 
  * Purpose:
- *   Core function that finds all numbers in a range with a specific count
- *   of prime factors
+ *   Entry point for "Lab05 --csr=N1,N2 --csr-output=FILE" runs
  *******************************************************************************/
-unsigned int primeFactorization(const unsigned int n1, const unsigned int n2, const unsigned int nFactors, const unsigned char display) {
-    unsigned int start = (n1 < n2) ? n1 : n2;
-    unsigned int end = (n1 > n2) ? n1 : n2;
-    unsigned int total = 0;
+int runFactorTableExport(void);
 
-    // Skip 1 since it has no prime factors
-    if (start < 2) start = 2;
+/*******************************************************************************
+ * Function: runFactorTableReader
+ * 
+ * Output:
+ *   - Prints the header of the --read-csr file and, in --factor-file's
+ *     format, the factorizations in the --read-range interval (the whole
+ *     table if no interval was given)
+ *   - Returns 0 on success, 1 if the file is not a valid table
+ * 
+ * Purpose:
+ *   Reads the arrays in place from the mapping, as a consumer would
+ *******************************************************************************/
+int runFactorTableReader(void);
 
-    for (unsigned int i = start; i <= end; i++) {
-        unsigned int num = i;
-        unsigned int factorCount = 0;
+/*******************************************************************************
+ * Function: runSelfTest
+ * 
+ * Output:
+ *   - Prints every failed check and a summary
+ *   - Returns 0 if every check passed, 1 otherwise
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --self-test" runs (the CTest "self-test" test)
+ *******************************************************************************/
+int runSelfTest(void);
 
-        // Count prime factors
-        for (unsigned int j = 2; j <= num; j++) {
-            if (!isPrime(j)) continue;
+/*******************************************************************************
+ * Function: runEngineBenchmark
+ * 
+ * Output:
+ *   - Counts the primes in each benchmark range with every sieve engine and
+ *     prints the times side by side, with hardware counters when
+ *     --perf-counters is on
+ *   - Returns 0 if the engines agree on every range, 1 otherwise
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --benchmark" runs (the "benchmark" build target)
+ *******************************************************************************/
+int runEngineBenchmark(void);
 
-            while (num % j == 0) {
-                factorCount++;
-                num /= j;
-            }
-        }
+/*******************************************************************************
+ * Function: writeTraceFile
+ * 
+ * Output:
+ *   - Writes every recorded event to --trace as Chrome trace JSON, one
+ *     thread lane per ring, and reports how many there were
+ * 
+ * Purpose:
+ *   Registered with atexit, when all worker threads have finished. Each run
+ *   also saves the file as it ends (see saveTraceFile)
+ *******************************************************************************/
+void writeTraceFile(void);
 
-        if (factorCount == nFactors) {
-            total++;
-            if (display == 'y' || display == 'Y') {
-                num = i;
-                printf("%u |", i);
-                // Print prime factors
-                for (unsigned int j = 2; j <= num; j++) {
-                    if (!isPrime(j)) continue;
-                    while (num % j == 0) {
-                        printf(" %u |", j);
-                        num /= j;
-                    }
-                }
-                printf("\n");
-            }
-        }
-    }
-    return total;
-}
+/*******************************************************************************
+ * Function: reportPeakMemory
+ * 
+ * Output:
+ *   - Prints the peak resident set size next to the --mem-limit budget
+ * 
+ * Purpose:
+ *   Registered with atexit when --mem-limit is given
+ *******************************************************************************/
+void reportPeakMemory(void);
 
 /*******************************************************************************
- * Function: primeFactorizationTest
+ * Function: isPrimePlanned
  * 
  * Input:
- *   - Two integers (n1,n2) defining the range, comma-separated
- *   - Number of prime factors to find
- *   - Display option (y/n)
- *   - Enter 0 for either range number to exit
+ *   - n: any number below 2^128
  * 
  * Output:
- *   - If display=y: Shows each number and its prime factorization
- *   - Total count of numbers with specified factor count
+ *   - Returns 1 if n is prime, 0 otherwise
  * 
  * Purpose:
- *   Interactive function that finds numbers with a specific count of prime
- *   factors within a range
+ *   Task 1 through the planner: a cached table answers with a binary
+ *   search; otherwise trial division wins for small n and Miller-Rabin or
+ *   Baillie-PSW for large n
  *******************************************************************************/
-void primeFactorizationTest() {
-    unsigned int n1, n2, nFactors;
-    unsigned char display;
+int isPrimePlanned(const unsigned __int128 n);
 
-    while (1) {
-        printf("Please enter n1, n2: ");
-        scanf_s("%u,%u", &n1, &n2);
+/*******************************************************************************
+ * Function: countPrimesPlanned
+ * 
+ * Input:
+ *   - n1, n2: range to search, in either order
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns the number of primes in the range (in the --residue class, if
+ *     one is given), printing them if display='y'
+ * 
+ * Purpose:
+ *   Task 2 through the planner: the cached table for ranges it covers, Lucy
+ *   tables for wide count-only ranges and the sieve for everything else
+ *******************************************************************************/
+unsigned long long countPrimesPlanned(const unsigned long long n1, const unsigned long long n2,
+                                      const unsigned char display);
 
-        if (n1 == 0 || n2 == 0) {
-            printf("Press ENTER to exit...");
-            getchar();  // Consume newline
-            getchar();  // Wait for ENTER
+/*******************************************************************************
+ * Function: primeFactorizationPlanned
+ * 
+ * Input:
+ *   - n1, n2: range to search, in either order
+ *   - nFactors: number of prime factors to look for
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns the count of numbers with exactly nFactors prime factors,
+ *     printing each with its factorization if display='y'
+ * 
+ * Purpose:
+ *   Task 3 through the planner: the combinatorial count for wide count-only
+ *   ranges, a smallest-prime-factor table for dense ranges of small
+ *   numbers, and trial division otherwise
+ *******************************************************************************/
+unsigned long long primeFactorizationPlanned(const unsigned long long n1, const unsigned long long n2,
+                                             const unsigned int nFactors, const unsigned char display);
+
+/*******************************************************************************
+ * Function: countPrimesApproximate
+ * 
+ * Input:
+ *   - n1, n2: range to count, in either order
+ *   - seconds: time allowed for refining the answer (0 = estimate only)
+ *   - lower, upper: receive proven bounds on the count
+ * 
+ * Output:
+ *   - Returns the best estimate, exact if *lower == *upper
+ * 
+ * Purpose:
+ *   Task 2's count under --approximate: Riemann's R function with proven
+ *   bounds, tightened by sieving the range until the deadline
+ *******************************************************************************/
+unsigned long long countPrimesApproximate(const unsigned long long n1, const unsigned long long n2,
+                                          const double seconds, unsigned long long *lower, unsigned long long *upper);
+
+/*******************************************************************************
+ * Function: isPrime64
+ * 
+ * Input:
+ *   - n: any 64-bit number
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, 0 otherwise
+ * 
+ * Purpose:
+ *   Deterministic Miller-Rabin: the first twelve prime bases are enough for
+ *   every n < 2^64, and bases 2, 7 and 61 below 4,759,123,141
+ *******************************************************************************/
+int isPrime64(const unsigned long long n);
+
+
+/*******************************************************************************
+ * Function: main
+ * 
+ * Input:
+ *   - argc, argv: optional switches (see parseArguments)
+ *   - Menu selection (0-4) from user
+ * 
+ * Output:
+ *   - Displays menu options
+ *   - Returns 0 on successful execution
+ * 
+ * Purpose:
+ *   Main control loop that presents menu and directs program flow based on
+ *   user selection
+ *******************************************************************************/
+int main(int argc, char *argv[]) {
+    int choice;
+    
+    if (!parseArguments(argc, argv)) {
+        printf("Usage: %s [--resume] [--checkpoint=FILE] [--checkpoint-interval=SECONDS] [--perf-counters]\n", argv[0]);
+        printf("       %*s [--trace=FILE] [--mem-limit=SIZE] [--engine=eratosthenes|atkin]\n", (int) strlen(argv[0]), "");
+        printf("       %*s [--residue=A,Q | --tuple=0,O1,...,Ok] [--explain]\n", (int) strlen(argv[0]), "");
+        printf("       %*s [--approximate=SECONDS]\n", (int) strlen(argv[0]), "");
+        printf("       %s --benchmark [--perf-counters]\n", argv[0]);
+        printf("       %s --worker[=PORT]\n", argv[0]);
+        printf("       %s --coordinator=HOST:PORT,... --count=N1,N2 | --omega=N1,N2\n", argv[0]);
+        printf("       %s --read-primes=FILE [--read-range=LO,HI]\n", argv[0]);
+        printf("       %s --cpu-report [--cpu=baseline|sse4.2|avx2|avx512]\n", argv[0]);
+        printf("       %s --factor-file=FILE [--factor-output=FILE]\n", argv[0]);
+        printf("       %s --classify=FILE [--classify-output=FILE]\n", argv[0]);
+        printf("       %s --arith=N1,N2 [--functions=phi,mu,sigma,d] [--arith-output=FILE]\n", argv[0]);
+        printf("       %s --csr=N1,N2 --csr-output=FILE\n", argv[0]);
+        printf("       %s --read-csr=FILE [--read-range=LO,HI]\n", argv[0]);
+        printf("       %s --self-test\n", argv[0]);
+        return 1;
+    }
+
+    if (options.tracePath != NULL) {
+        atexit(writeTraceFile);
+    }
+    if (options.memLimit != 0) {
+        atexit(reportPeakMemory);
+    }
+
+    // Pick kernel variants before any worker thread starts
+    if (!configureKernels() || !configureSieveEngine()) {
+        return 1;
+    }
+    if (options.cpuReport) {
+        printCpuReport();
+        return 0;
+    }
+
+    // Distributed modes run a single job instead of the menu
+    if (options.workerPort != 0) {
+        return runWorker(options.workerPort);
+    }
+    if (options.coordinatorWorkers != NULL) {
+        return runCoordinator();
+    }
+    if (options.primeListPath != NULL) {
+        return runPrimeListReader();
+    }
+    if (options.factorInputPath != NULL) {
+        return runBatchFactorization();
+    }
+    if (options.classifyInputPath != NULL) {
+        return runClassification();
+    }
+    if (options.arith) {
+        return runMultiplicativeFunctions();
+    }
+    if (options.csr) {
+        return runFactorTableExport();
+    }
+    if (options.csrInputPath != NULL) {
+        return runFactorTableReader();
+    }
+    if (options.benchmark) {
+        return runEngineBenchmark();
+    }
+    if (options.selfTest) {
+        return runSelfTest();
+    }
+
+    do {
+        printf("\nPrime Number Operations Menu:\n");
+        printf("%d. Test if a number is prime\n", TASK1);
+        printf("%d. Count prime numbers in a range\n", TASK2);
+        printf("%d. Prime factorization\n", TASK3);
+        printf("%d. Sum prime numbers in a range\n", TASK4);
+        printf("%d. Exit\n", EXIT);
+        printf("Enter your choice (%d-%d): ", EXIT, TASK4);
+        
+        if (scanf_s("%d", &choice) != 1) {
+            // Clear input buffer if invalid input
+            while (getchar() != '\n');
+            choice = -1;  // Invalid choice
+        }
+        
+        switch (choice) {
+            case TASK1:
+                isPrimeTest();
+                break;
+            case TASK2:
+                countPrimesTest();
+                break;
+            case TASK3:
+                primeFactorizationTest();
+                break;
+            case TASK4:
+                sumPrimesTest();
+                break;
+            case EXIT:
+                printf("Goodbye!\n");
+                break;
+            default:
+                printf("Invalid choice. Please try again.\n");
+        }
+    } while (choice != EXIT);
+    
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: parseArguments
+ * 
+ * Input:
+ *   - argc, argv: command line passed to main
+ * 
+ * Output:
+ *   - Fills the global options
+ *   - Returns 1 if all arguments were understood, 0 otherwise
+ * 
+ * Purpose:
+ *   Reads the optional command line switches before the menu starts
+ *******************************************************************************/
+int parseArguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "--resume") == 0) {
+            options.resume = true;
+        } else if (strncmp(arg, "--checkpoint=", 13) == 0 && arg[13] != '\0') {
+            options.checkpointPath = arg + 13;
+        } else if (strncmp(arg, "--checkpoint-interval=", 22) == 0 && arg[22] != '\0') {
+            char *end;
+            errno = 0;
+            unsigned long long seconds = strtoull(arg + 22, &end, 10);
+            if (arg[22] < '0' || arg[22] > '9' || *end != '\0' || errno == ERANGE
+                || seconds > MAX_CHECKPOINT_INTERVAL) {
+                printf("Expected a number of seconds from 0 to %u: %s\n", MAX_CHECKPOINT_INTERVAL, arg);
+                return 0;
+            }
+            options.checkpointInterval = (unsigned int) seconds;
+        } else if (strcmp(arg, "--worker") == 0) {
+            options.workerPort = DEFAULT_WORKER_PORT;
+        } else if (strncmp(arg, "--worker=", 9) == 0) {
+            options.workerPort = (unsigned int) strtoul(arg + 9, NULL, 10);
+            if (options.workerPort == 0 || options.workerPort > 65535) return 0;
+        } else if (strncmp(arg, "--coordinator=", 14) == 0 && arg[14] != '\0') {
+            options.coordinatorWorkers = arg + 14;
+        } else if (strncmp(arg, "--count=", 8) == 0 || strncmp(arg, "--omega=", 8) == 0) {
+            options.distributedTask = (arg[2] == 'c') ? TASK2 : TASK3;
+            if (sscanf(arg + 8, "%llu,%llu", &options.jobStart, &options.jobEnd) != 2
+                || options.jobStart == 0 || options.jobEnd == 0) {
+                printf("Expected two positive numbers: %s\n", arg);
+                return 0;
+            }
+        } else if (strncmp(arg, "--read-primes=", 14) == 0 && arg[14] != '\0') {
+            options.primeListPath = arg + 14;
+        } else if (strncmp(arg, "--trace=", 8) == 0 && arg[8] != '\0') {
+            options.tracePath = arg + 8;
+        } else if (strcmp(arg, "--trace") == 0 && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (strncmp(arg, "--mem-limit=", 12) == 0) {
+            char *suffix;
+            unsigned int shift = 0;
+            errno = 0;
+            options.memLimit = strtoull(arg + 12, &suffix, 10);
+            switch (*suffix) {
+                case 'k': case 'K': shift = 10; suffix++; break;
+                case 'm': case 'M': shift = 20; suffix++; break;
+                case 'g': case 'G': shift = 30; suffix++; break;
+            }
+            if (arg[12] < '0' || arg[12] > '9' || errno == ERANGE || options.memLimit > (ULLONG_MAX >> shift)) {
+                printf("Memory limit out of range: %s\n", arg);
+                return 0;
+            }
+            options.memLimit <<= shift;
+            if (options.memLimit == 0 || *suffix != '\0') {
+                printf("Expected a size such as 512M or 2G: %s\n", arg);
+                return 0;
+            }
+        } else if (strncmp(arg, "--engine=", 9) == 0) {
+            options.engineName = arg + 9;
+        } else if (strcmp(arg, "--explain") == 0) {
+            options.explain = true;
+        } else if (strncmp(arg, "--approximate=", 14) == 0) {
+            char *end;
+            options.approximateSeconds = strtod(arg + 14, &end);
+            if (end == arg + 14 || *end != '\0' || !(options.approximateSeconds >= 0)) {
+                printf("Expected a number of seconds: %s\n", arg);
+                return 0;
+            }
+        } else if (strcmp(arg, "--benchmark") == 0) {
+            options.benchmark = true;
+        } else if (strcmp(arg, "--perf-counters") == 0) {
+            options.perfCounters = true;
+        } else if (strcmp(arg, "--cpu-report") == 0) {
+            options.cpuReport = true;
+        } else if (strncmp(arg, "--cpu=", 6) == 0) {
+            options.cpuLevel = arg + 6;
+        } else if (strncmp(arg, "--factor-file=", 14) == 0 && arg[14] != '\0') {
+            options.factorInputPath = arg + 14;
+        } else if (strncmp(arg, "--factor-output=", 16) == 0 && arg[16] != '\0') {
+            options.factorOutputPath = arg + 16;
+        } else if (strncmp(arg, "--classify=", 11) == 0 && arg[11] != '\0') {
+            options.classifyInputPath = arg + 11;
+        } else if (strncmp(arg, "--classify-output=", 18) == 0 && arg[18] != '\0') {
+            options.classifyOutputPath = arg + 18;
+        } else if (strncmp(arg, "--arith=", 8) == 0) {
+            options.arith = true;
+            if (sscanf(arg + 8, "%llu,%llu", &options.arithFrom, &options.arithTo) != 2) return 0;
+        } else if (strncmp(arg, "--functions=", 12) == 0 && arg[12] != '\0') {
+            options.arithFunctions = arg + 12;
+        } else if (strncmp(arg, "--arith-output=", 15) == 0 && arg[15] != '\0') {
+            options.arithOutputPath = arg + 15;
+        } else if (strncmp(arg, "--csr=", 6) == 0) {
+            options.csr = true;
+            if (sscanf(arg + 6, "%llu,%llu", &options.csrFrom, &options.csrTo) != 2) return 0;
+        } else if (strncmp(arg, "--csr-output=", 13) == 0 && arg[13] != '\0') {
+            options.csrOutputPath = arg + 13;
+        } else if (strncmp(arg, "--read-csr=", 11) == 0 && arg[11] != '\0') {
+            options.csrInputPath = arg + 11;
+        } else if (strncmp(arg, "--residue=", 10) == 0) {
+            if (sscanf(arg + 10, "%llu,%llu", &options.residueClass, &options.residueModulus) != 2
+                || options.residueModulus == 0 || options.residueModulus > UINT_MAX) {
+                printf("Expected a residue class A,Q with 1 <= Q < 2^32: %s\n", arg);
+                return 0;
+            }
+            options.residueClass %= options.residueModulus;
+        } else if (strncmp(arg, "--tuple=", 8) == 0) {
+            const char *text = arg + 8;
+            options.tupleSize = 0;
+            while (1) {
+                char *next;
+                unsigned long long offset = strtoull(text, &next, 10);
+                if (next == text || options.tupleSize == MAX_TUPLE_SIZE || offset > MAX_TUPLE_SPAN
+                    || (options.tupleSize == 0) != (offset == 0)
+                    || (options.tupleSize > 0 && offset <= options.tupleOffsets[options.tupleSize - 1])) {
+                    printf("Expected increasing offsets 0,O1,... up to %u (at most %u): %s\n", MAX_TUPLE_SPAN,
+                           MAX_TUPLE_SIZE, arg);
+                    return 0;
+                }
+                options.tupleOffsets[options.tupleSize++] = (unsigned int) offset;
+                if (*next == '\0') break;
+                if (*next != ',') return 0;
+                text = next + 1;
+            }
+            if (options.tupleSize < 2) {
+                printf("A constellation needs at least two members: %s\n", arg);
+                return 0;
+            }
+        } else if (strcmp(arg, "--self-test") == 0) {
+            options.selfTest = true;
+        } else if (strncmp(arg, "--read-range=", 13) == 0) {
+            options.readRange = true;
+            if (sscanf(arg + 13, "%llu,%llu", &options.readFrom, &options.readTo) != 2) return 0;
+        } else {
+            printf("Unknown option: %s\n", arg);
+            return 0;
+        }
+    }
+
+    if (options.tupleSize != 0 && options.residueModulus != 0) {
+        printf("--tuple and --residue cannot be combined.\n");
+        return 0;
+    }
+    if (options.csr && options.csrOutputPath == NULL) {
+        printf("--csr needs --csr-output=FILE.\n");
+        return 0;
+    }
+    if (options.approximateSeconds >= 0 && (options.tupleSize != 0 || options.residueModulus != 0)) {
+        printf("--approximate only bounds counts of every prime; drop --tuple and --residue.\n");
+        return 0;
+    }
+
+    // Workers only ever run single chunks; the coordinator reassigns lost ones
+    if (options.workerPort != 0) {
+        options.checkpointInterval = 0;
+        options.resume = false;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * 128-bit Integers
+ * 
+ * Task 1, batch factorization and the prime sums go past 64 bits with the
+ * GCC/Clang unsigned __int128 type. printf and scanf have no conversion for
+ * it, so values are formatted and parsed by hand.
+ *******************************************************************************/
+typedef unsigned __int128 uint128;
+
+const uint128 UINT128_MAX_VALUE = ~(uint128) 0;
+
+/*******************************************************************************
+ * Function: formatUint128
+ * 
+ * Input:
+ *   - value: number to print
+ *   - buffer: at least 40 characters
+ * 
+ * Output:
+ *   - Returns buffer holding value in decimal
+ * 
+ * Purpose:
+ *   printf has no conversion for 128-bit integers
+ *******************************************************************************/
+const char *formatUint128(uint128 value, char *buffer) {
+    char digits[40];
+    int length = 0;
+    do {
+        digits[length++] = (char) ('0' + (int) (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < length; i++) buffer[i] = digits[length - 1 - i];
+    buffer[length] = '\0';
+    return buffer;
+}
+
+/*******************************************************************************
+ * Function: parseUint128
+ * 
+ * Input:
+ *   - text: decimal digits
+ * 
+ * Output:
+ *   - Stores the number in *value and returns 1
+ *   - Returns 0 if text is empty, has a non-digit or is 2^128 or more
+ *******************************************************************************/
+int parseUint128(const char *text, uint128 *value) {
+    uint128 n = 0;
+    if (*text == '\0') return 0;
+
+    for (; *text != '\0'; text++) {
+        if (*text < '0' || *text > '9') return 0;
+        unsigned int digit = *text - '0';
+        if (n > (UINT128_MAX_VALUE - digit) / 10) return 0;
+        n = n * 10 + digit;
+    }
+    *value = n;
+    return 1;
+}
+
+/*******************************************************************************
+ * CPU Feature Dispatch
+ * 
+ * The hot kernels are written once as always-inline bodies and compiled
+ * several times with different target attributes, so one binary carries
+ * baseline x86-64, SSE4.2, AVX2 and AVX-512 versions whatever -march the
+ * build used. selectKernels() checks the CPU at startup and points the
+ * kernel table at the best supported set; --cpu-report prints the choice.
+ * Other compilers and architectures only get the baseline set.
+ *******************************************************************************/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_DISPATCH 1
+#define KERNEL_BODY static inline __attribute__((always_inline))
+#define TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2,popcnt")))
+#else
+#define KERNEL_DISPATCH 0
+#define KERNEL_BODY static inline
+#endif
+
+enum cpuLevel {CPU_BASELINE, CPU_SSE42, CPU_AVX2, CPU_AVX512, CPU_LEVELS};
+const char *CPU_LEVEL_NAMES[CPU_LEVELS] = {"baseline", "sse4.2", "avx2", "avx512"};
+
+struct KernelTable {
+    int level;
+    int (*isPrime)(unsigned int n, const unsigned int *primes, size_t primeCount);
+    void (*crossOff)(unsigned long long *bits, unsigned long long bitCount, unsigned long long firstOdd,
+                     unsigned long long hi, const unsigned int *primes, size_t primeCount);
+    unsigned long long (*popcount)(const unsigned long long *words, size_t count);
+    int (*isPrimeWide)(uint128 n);
+};
+
+/*******************************************************************************
+ * Function: trialDivisionBody
+ * 
+ * Input:
+ *   - n: unsigned integer to test for primality
+ *   - primes, primeCount: odd primes in increasing order, up to sqrt(n)
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, 0 if not
+ * 
+ * Purpose:
+ *   Primality kernel behind isPrime
+ *******************************************************************************/
+KERNEL_BODY int trialDivisionBody(unsigned int n, const unsigned int *primes, size_t primeCount) {
+    // 0 and 1 are not prime numbers
+    if (n <= 1) {
+        return 0;
+    }
+    if (n % 2 == 0) {
+        return n == 2;
+    }
+
+    // Check divisibility up to square root of n
+    // We only need to check up to sqrt(n) because if n is divisible by a number greater than its
+    // square root, it would also be divisible by a number less than its square root
+    // (i.e., if n = a*b, and a > sqrt(n), then b < sqrt(n)); and only primes need checking
+    for (size_t i = 0; i < primeCount; i++) {
+        unsigned long long p = primes[i];
+        if (p * p > n) break;
+        if (n % p == 0) {
+            return 0;  // n is divisible by p, so it's not prime
+        }
+    }
+
+    return 1;  // n is prime if no divisors were found
+}
+
+/*******************************************************************************
+ * Function: crossOffBody
+ * 
+ * Input:
+ *   - bits: odd-only segment bitmap, bit i standing for firstOdd + 2i
+ *   - bitCount: number of bits in use
+ *   - firstOdd, hi: first odd number and last number of the segment
+ *   - primes, primeCount: odd base primes in increasing order
+ * 
+ * Purpose:
+ *   Sieve kernel: clears the odd multiples of each base prime, starting at
+ *   the larger of p*p and the first odd multiple inside the segment
+ *******************************************************************************/
+KERNEL_BODY void crossOffBody(unsigned long long *bits, unsigned long long bitCount, unsigned long long firstOdd,
+                              unsigned long long hi, const unsigned int *primes, size_t primeCount) {
+    for (size_t i = 0; i < primeCount; i++) {
+        unsigned long long p = primes[i];
+        unsigned long long square = p * p;
+        if (square > hi) break;
+
+        unsigned long long multiple = (square >= firstOdd) ? square : firstOdd + (p - firstOdd % p) % p;
+        if ((multiple & 1) == 0) multiple += p;
+
+        for (unsigned long long bit = (multiple - firstOdd) / 2; bit < bitCount; bit += p) {
+            bits[bit >> 6] &= ~(1ULL << (bit & 63));
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: popcountBody
+ * 
+ * Input:
+ *   - words, count: array of 64-bit words
+ * 
+ * Output:
+ *   - Returns the total number of set bits
+ * 
+ * Purpose:
+ *   Popcount kernel used to count sieved primes
+ *******************************************************************************/
+KERNEL_BODY unsigned long long popcountBody(const unsigned long long *words, size_t count) {
+    unsigned long long total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += (unsigned long long) __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+/*******************************************************************************
+ * Baillie-PSW over Montgomery Arithmetic
+ * 
+ * Wide primality kernel for numbers up to 2^128. Small prime factors are
+ * stripped with two 128-bit remainders against primorial-like products.
+ * A strong probable-prime test to base 2 follows, then a strong Lucas test
+ * with Selfridge's parameters. No composite is known to pass both, and none
+ * exists below 2^64. All modular products use Montgomery multiplication
+ * (R = 2^128), built from four 64x64 -> 128-bit multiplies with no
+ * division in the loop.
+ *******************************************************************************/
+struct Montgomery128 {
+    uint128 n;      // Odd modulus
+    uint128 nInv;   // -n^-1 mod 2^128
+    uint128 one;    // R mod n (1 in Montgomery form)
+    uint128 r2;     // R^2 mod n (converts into Montgomery form)
+};
+
+/*******************************************************************************
+ * Function: mulFull128
+ * 
+ * Input:
+ *   - a, b: factors
+ * 
+ * Output:
+ *   - Returns the high 128 bits of a * b and stores the low 128 in *low
+ *******************************************************************************/
+KERNEL_BODY uint128 mulFull128(const uint128 a, const uint128 b, uint128 *low) {
+    unsigned long long a0 = (unsigned long long) a, a1 = (unsigned long long) (a >> 64);
+    unsigned long long b0 = (unsigned long long) b, b1 = (unsigned long long) (b >> 64);
+    uint128 p00 = (uint128) a0 * b0, p01 = (uint128) a0 * b1;
+    uint128 p10 = (uint128) a1 * b0, p11 = (uint128) a1 * b1;
+
+    uint128 middle = (p00 >> 64) + (unsigned long long) p01 + (unsigned long long) p10;
+    *low = (middle << 64) | (unsigned long long) p00;
+    return p11 + (p01 >> 64) + (p10 >> 64) + (middle >> 64);
+}
+
+/*******************************************************************************
+ * Function: highestBit128
+ * 
+ * Input:
+ *   - x: nonzero value
+ * 
+ * Output:
+ *   - Returns the index of the highest set bit of x
+ *******************************************************************************/
+KERNEL_BODY int highestBit128(const uint128 x) {
+    unsigned long long high = (unsigned long long) (x >> 64);
+    return (high != 0) ? 127 - __builtin_clzll(high) : 63 - __builtin_clzll((unsigned long long) x);
+}
+
+/*******************************************************************************
+ * Function: addMod128 / subMod128 / halfMod128
+ * 
+ * Input:
+ *   - a, b: residues below n
+ *   - n: odd modulus
+ * 
+ * Output:
+ *   - Returns a + b, a - b or a / 2 mod n, without overflowing even when
+ *     n is above 2^127
+ *******************************************************************************/
+KERNEL_BODY uint128 addMod128(const uint128 a, const uint128 b, const uint128 n) {
+    uint128 sum = a + b;
+    return (sum < a || sum >= n) ? sum - n : sum;
+}
+
+KERNEL_BODY uint128 subMod128(const uint128 a, const uint128 b, const uint128 n) {
+    return (a >= b) ? a - b : a + (n - b);
+}
+
+KERNEL_BODY uint128 halfMod128(const uint128 a, const uint128 n) {
+    return (a & 1) ? (a >> 1) + (n >> 1) + 1 : a >> 1;
+}
+
+/*******************************************************************************
+ * Function: montMul128
+ * 
+ * Input:
+ *   - a, b: values in Montgomery form, below n
+ *   - m: modulus constants
+ * 
+ * Output:
+ *   - Returns a * b / R mod n, still in Montgomery form
+ *******************************************************************************/
+KERNEL_BODY uint128 montMul128(const uint128 a, const uint128 b, const Montgomery128 &m) {
+    uint128 low, reduceLow;
+    uint128 high = mulFull128(a, b, &low);
+    uint128 q = low * m.nInv;
+    uint128 reduceHigh = mulFull128(q, m.n, &reduceLow);
+
+    // low + reduceLow is 0 mod 2^128, carrying exactly when low != 0
+    uint128 result = high + reduceHigh;
+    bool overflow = result < high;
+    uint128 carried = result + (low != 0);
+    overflow |= carried < result;
+    return (overflow || carried >= m.n) ? carried - m.n : carried;
+}
+
+/*******************************************************************************
+ * Function: setupMontgomery128
+ * 
+ * Input:
+ *   - n: odd modulus
+ *   - m: receives the constants
+ *******************************************************************************/
+KERNEL_BODY void setupMontgomery128(const uint128 n, Montgomery128 &m) {
+    // Newton's iteration doubles the correct low bits of n^-1 each step
+    uint128 inverse = n;  // Correct to 3 bits for any odd n
+    for (int i = 0; i < 6; i++) inverse *= 2 - n * inverse;
+
+    m.n = n;
+    m.nInv = (uint128) 0 - inverse;
+    m.one = ((uint128) 0 - n) % n;
+    m.r2 = m.one;
+    for (int i = 0; i < 128; i++) m.r2 = addMod128(m.r2, m.r2, n);
+}
+
+KERNEL_BODY uint128 toMontgomery128(const uint128 x, const Montgomery128 &m) {
+    return montMul128(x % m.n, m.r2, m);
+}
+
+/*******************************************************************************
+ * Function: strongProbablePrime2
+ * 
+ * Input:
+ *   - m: Montgomery constants for odd n > 2
+ * 
+ * Output:
+ *   - Returns 1 if n is a strong probable prime to base 2
+ *******************************************************************************/
+KERNEL_BODY int strongProbablePrime2(const Montgomery128 &m) {
+    uint128 minusOne = m.n - m.one;
+    uint128 d = m.n - 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s++;
+    }
+
+    uint128 base = addMod128(m.one, m.one, m.n);
+    uint128 x = base;
+    for (int bit = highestBit128(d) - 1; bit >= 0; bit--) {
+        x = montMul128(x, x, m);
+        if ((d >> bit) & 1) x = montMul128(x, base, m);
+    }
+    if (x == m.one || x == minusOne) return 1;
+
+    for (int r = 1; r < s; r++) {
+        x = montMul128(x, x, m);
+        if (x == minusOne) return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: jacobi64
+ * 
+ * Input:
+ *   - a: any value below n
+ *   - n: odd modulus
+ * 
+ * Output:
+ *   - Returns the Jacobi symbol (a/n): 1, -1 or 0
+ *******************************************************************************/
+KERNEL_BODY int jacobi64(unsigned long long a, unsigned long long n) {
+    int result = 1;
+    while (a != 0) {
+        while ((a & 1) == 0) {
+            a >>= 1;
+            if ((n & 7) == 3 || (n & 7) == 5) result = -result;
+        }
+        unsigned long long t = a;
+        a = n;
+        n = t;
+        if ((a & 3) == 3 && (n & 3) == 3) result = -result;
+        a %= n;
+    }
+    return (n == 1) ? result : 0;
+}
+
+/*******************************************************************************
+ * Function: strongLucasProbablePrime
+ * 
+ * Input:
+ *   - m: Montgomery constants for odd n > 2, not a perfect square
+ * 
+ * Output:
+ *   - Returns 1 if n is a strong Lucas probable prime for Selfridge's
+ *     parameters: the first D in 5, -7, 9, -11, ... with (D/n) = -1,
+ *     P = 1 and Q = (1 - D) / 4
+ *******************************************************************************/
+KERNEL_BODY int strongLucasProbablePrime(const Montgomery128 &m) {
+    const uint128 n = m.n;
+
+    // (D/n) for |D| small and odd: quadratic reciprocity leaves a 64-bit symbol
+    long long D = 5;
+    while (1) {
+        unsigned long long a = (D < 0) ? (unsigned long long) -D : (unsigned long long) D;
+        int symbol = jacobi64((unsigned long long) (n % a), a);
+        if ((a & 3) == 3 && (n & 3) == 3) symbol = -symbol;
+        if (D < 0 && (n & 3) == 3) symbol = -symbol;
+
+        if (symbol == -1) break;
+        if (symbol == 0 && n != a) return 0;  // a shares a factor with n
+        D = (D < 0) ? -D + 2 : -(D + 2);
+    }
+
+    long long Q = (1 - D) / 4;
+    uint128 dMont = (D < 0) ? m.n - toMontgomery128((uint128) -D, m) : toMontgomery128((uint128) D, m);
+    uint128 qMont = (Q < 0) ? m.n - toMontgomery128((uint128) -Q, m) : toMontgomery128((uint128) Q, m);
+
+    // n + 1 = d * 2^s; n + 1 cannot overflow as 2^128 - 1 is divisible by 3
+    uint128 d = n + 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s++;
+    }
+
+    // Walk the bits of d below the leading one, doubling k and adding 1 on set bits
+    uint128 u = m.one, v = m.one, qk = qMont;  // U_1 = 1, V_1 = P = 1, Q^1
+    for (int bit = highestBit128(d) - 1; bit >= 0; bit--) {
+        u = montMul128(u, v, m);                                     // U_2k = U_k V_k
+        v = subMod128(montMul128(v, v, m), addMod128(qk, qk, n), n);  // V_2k = V_k^2 - 2 Q^k
+        qk = montMul128(qk, qk, m);
+
+        if ((d >> bit) & 1) {
+            uint128 nextU = halfMod128(addMod128(u, v, n), n);                         // (P U + V) / 2
+            v = halfMod128(addMod128(montMul128(dMont, u, m), v, n), n);                // (D U + P V) / 2
+            u = nextU;
+            qk = montMul128(qk, qMont, m);
+        }
+    }
+
+    if (u == 0 || v == 0) return 1;
+    for (int r = 1; r < s; r++) {
+        v = subMod128(montMul128(v, v, m), addMod128(qk, qk, n), n);
+        if (v == 0) return 1;
+        qk = montMul128(qk, qk, m);
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: bpswBody
+ * 
+ * Input:
+ *   - n: any number below 2^128
+ * 
+ * Output:
+ *   - Returns 1 if n is (a Baillie-PSW probable) prime, 0 if not
+ * 
+ * Purpose:
+ *   Primality kernel behind isPrimeWide
+ *******************************************************************************/
+KERNEL_BODY int bpswBody(const uint128 n) {
+    // Products of the odd primes 3..47 and 53..97 both fit in 64 bits
+    static const unsigned int SMALL_PRIMES[] = {3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47,
+                                                53, 59, 61, 67, 71, 73, 79, 83, 89, 97};
+    const unsigned long long PRODUCT_LOW = 307444891294245705ULL;  // 3 * 5 * ... * 47
+    const unsigned long long PRODUCT_HIGH = 53ULL * 59 * 61 * 67 * 71 * 73 * 79 * 83 * 89 * 97;
+
+    if (n < 2) return 0;
+    if ((n & 1) == 0) return n == 2;
+    if (n < 100 * 100) {
+        for (unsigned int p : SMALL_PRIMES) {
+            if ((unsigned long long) p * p > n) return 1;
+            if (n % p == 0) return 0;
+        }
+        return 1;
+    }
+
+    unsigned long long low = (unsigned long long) (n % PRODUCT_LOW);
+    unsigned long long high = (unsigned long long) (n % PRODUCT_HIGH);
+    for (unsigned int i = 0; i < 14; i++) {
+        if (low % SMALL_PRIMES[i] == 0) return 0;
+    }
+    for (unsigned int i = 14; i < 24; i++) {
+        if (high % SMALL_PRIMES[i] == 0) return 0;
+    }
+
+    Montgomery128 m;
+    setupMontgomery128(n, m);
+    if (!strongProbablePrime2(m)) return 0;
+
+    // A perfect square has no D with (D/n) = -1; it is also never prime
+    long double estimate = sqrtl((long double) n);
+    unsigned long long root = (estimate >= 18446744073709551615.0L) ? ULLONG_MAX : (unsigned long long) estimate;
+    while (root > 0 && (uint128) root * root > n) root--;
+    while (root < ULLONG_MAX && (uint128) (root + 1) * (root + 1) <= n) root++;
+    if ((uint128) root * root == n) return 0;
+
+    return strongLucasProbablePrime(m);
+}
+
+// Stamps out one compiled copy of every kernel for a target
+#define DEFINE_KERNEL_SET(suffix, target)                                                                      \
+    target int isPrime##suffix(unsigned int n, const unsigned int *primes, size_t primeCount) {                \
+        return trialDivisionBody(n, primes, primeCount);                                                       \
+    }                                                                                                          \
+    target void crossOff##suffix(unsigned long long *bits, unsigned long long bitCount, unsigned long long firstOdd, \
+                                 unsigned long long hi, const unsigned int *primes, size_t primeCount) {       \
+        crossOffBody(bits, bitCount, firstOdd, hi, primes, primeCount);                                         \
+    }                                                                                                          \
+    target unsigned long long popcount##suffix(const unsigned long long *words, size_t count) {                \
+        return popcountBody(words, count);                                                                     \
+    }                                                                                                          \
+    target int isPrimeWide##suffix(uint128 n) { return bpswBody(n); }
+
+DEFINE_KERNEL_SET(Baseline, )
+#if KERNEL_DISPATCH
+DEFINE_KERNEL_SET(Sse42, TARGET_SSE42)
+DEFINE_KERNEL_SET(Avx2, TARGET_AVX2)
+DEFINE_KERNEL_SET(Avx512, TARGET_AVX512)
+#endif
+
+static KernelTable kernels = {CPU_BASELINE, isPrimeBaseline, crossOffBaseline, popcountBaseline, isPrimeWideBaseline};
+
+/*******************************************************************************
+ * Function: detectCpuLevel
+ * 
+ * Output:
+ *   - Returns the highest kernel level this CPU (and OS) supports
+ * 
+ * Purpose:
+ *   Feature check behind selectKernels
+ *******************************************************************************/
+int detectCpuLevel(void) {
+#if KERNEL_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt")) {
+        return CPU_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+        && __builtin_cpu_supports("popcnt")) {
+        return CPU_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return CPU_SSE42;
+    }
+#endif
+    return CPU_BASELINE;
+}
+
+/*******************************************************************************
+ * Function: selectKernels
+ * 
+ * Input:
+ *   - requested: highest level to use (CPU_LEVELS for "best available")
+ * 
+ * Output:
+ *   - Points the global kernel table at the chosen set
+ * 
+ * Purpose:
+ *   Called once at startup, before any worker thread exists
+ *******************************************************************************/
+void selectKernels(int requested) {
+    int level = detectCpuLevel();
+    if (requested < level) level = requested;
+
+    switch (level) {
+#if KERNEL_DISPATCH
+        case CPU_AVX512:
+            kernels = {CPU_AVX512, isPrimeAvx512, crossOffAvx512, popcountAvx512, isPrimeWideAvx512};
+            break;
+        case CPU_AVX2:
+            kernels = {CPU_AVX2, isPrimeAvx2, crossOffAvx2, popcountAvx2, isPrimeWideAvx2};
+            break;
+        case CPU_SSE42:
+            kernels = {CPU_SSE42, isPrimeSse42, crossOffSse42, popcountSse42, isPrimeWideSse42};
+            break;
+#endif
+        default:
+            kernels = {CPU_BASELINE, isPrimeBaseline, crossOffBaseline, popcountBaseline, isPrimeWideBaseline};
+    }
+}
+
+/*******************************************************************************
+ * Function: configureKernels
+ * 
+ * Output:
+ *   - Selects the kernel variants for this CPU, capped by --cpu
+ *   - Returns 0 if --cpu names an unknown level
+ * 
+ * Purpose:
+ *   Runtime CPU dispatch setup, done once before the menu starts
+ *******************************************************************************/
+int configureKernels(void) {
+    int requested = CPU_LEVELS;
+    if (options.cpuLevel != NULL) {
+        for (requested = 0; requested < CPU_LEVELS; requested++) {
+            if (strcmp(options.cpuLevel, CPU_LEVEL_NAMES[requested]) == 0) break;
+        }
+        if (requested == CPU_LEVELS) {
+            printf("Unknown CPU level: %s\n", options.cpuLevel);
+            return 0;
+        }
+    }
+    selectKernels(requested);
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: printCpuReport
+ * 
+ * Output:
+ *   - Prints the detected CPU features and the kernel variant in use
+ * 
+ * Purpose:
+ *   Backs the --cpu-report switch
+ *******************************************************************************/
+void printCpuReport(void) {
+#if KERNEL_DISPATCH
+    // __builtin_cpu_supports only accepts string literals
+    printf("CPU features:");
+    if (__builtin_cpu_supports("sse4.2")) printf(" sse4.2");
+    if (__builtin_cpu_supports("popcnt")) printf(" popcnt");
+    if (__builtin_cpu_supports("avx2")) printf(" avx2");
+    if (__builtin_cpu_supports("bmi2")) printf(" bmi2");
+    if (__builtin_cpu_supports("avx512f")) printf(" avx512f");
+    if (__builtin_cpu_supports("avx512bw")) printf(" avx512bw");
+    if (__builtin_cpu_supports("avx512vl")) printf(" avx512vl");
+    printf("\n");
+#else
+    printf("CPU features: runtime dispatch not available for this compiler/architecture\n");
+#endif
+    printf("Best supported level: %s\n", CPU_LEVEL_NAMES[detectCpuLevel()]);
+    printf("Kernels in use:\n");
+    printf("  primality  %s\n", CPU_LEVEL_NAMES[kernels.level]);
+    printf("  sieve      %s\n", CPU_LEVEL_NAMES[kernels.level]);
+    printf("  popcount   %s\n", CPU_LEVEL_NAMES[kernels.level]);
+    printf("  bpsw       %s\n", CPU_LEVEL_NAMES[kernels.level]);
+}
+
+/*******************************************************************************
+ * Hardware Performance Counters
+ * 
+ * With --perf-counters every Task call is bracketed by Linux perf_event_open
+ * counters for cycles, instructions, L1 data and last-level cache misses and
+ * branch misses. The counters are user mode only and are inherited by the
+ * worker threads the call starts, so the totals cover the whole job. Counts
+ * are scaled by enabled/running time when the kernel had to multiplex them.
+ * 
+ * A PerfPhaseScope splits the totals by engine phase (planning, the base
+ * prime table, range jobs, Lucy tables, ...). Phases that sieve or test a
+ * range report misses per number processed, which shows whether a kernel
+ * is waiting on memory or on arithmetic; the others, whose work does not
+ * grow with the range, report plain totals. Only phases on the thread that
+ * started the counters are split out: a worker's counts reach the parent
+ * counter when the worker exits, so the phase must outlive its workers.
+ *******************************************************************************/
+const unsigned int MAX_PERF_PHASES = 8;
+enum perfEvent {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS};
+const char *PERF_EVENT_NAMES[PERF_EVENTS] = {"cycles", "instructions", "L1d misses", "LLC misses", "branch misses"};
+
+struct PerfPhase {
+    const char *name;                       // Static string naming the phase
+    unsigned long long value[PERF_EVENTS];
+    double seconds;
+    unsigned long long numbers;             // Numbers sieved or tested (0 = not a per-number phase)
+};
+
+struct PerfCounters {
+    int fd[PERF_EVENTS];                    // -1 where the event could not be opened
+    bool valid[PERF_EVENTS];                // Counted and read back successfully
+    unsigned long long value[PERF_EVENTS];
+    std::chrono::steady_clock::time_point startTime;
+    double seconds;
+    PerfPhase phases[MAX_PERF_PHASES];      // Totals per phase, in order of first use
+    unsigned int phaseCount;
+};
+
+static std::atomic<PerfCounters *> activePerfCounters(NULL);  // Between startPerfCounters and stopPerfCounters
+static std::thread::id perfCounterThread;                     // The thread that started them
+static unsigned int perfPhaseDepth = 0;                       // Open phases on that thread
+
+/*******************************************************************************
+ * Function: openPerfEvent
+ * 
+ * Input:
+ *   - event: which perfEvent to count
+ * 
+ * Output:
+ *   - Returns a disabled counter for this process and the threads it
+ *     starts, or -1 if the event is unsupported or not permitted
+ *******************************************************************************/
+int openPerfEvent(const int event) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (event) {
+        case PERF_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PERF_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PERF_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PERF_LLC_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        default: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    }
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void) event;
+    return -1;
+#endif
+}
+
+/*******************************************************************************
+ * Function: startPerfCounters
+ * 
+ * Input:
+ *   - counters: set to start
+ * 
+ * Output:
+ *   - Opens and enables the counters when --perf-counters is on; reports
+ *     once if the system does not allow them and turns the option off
+ *******************************************************************************/
+void startPerfCounters(PerfCounters &counters) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        counters.fd[e] = -1;
+        counters.valid[e] = false;
+        counters.value[e] = 0;
+    }
+    counters.seconds = 0;
+    counters.phaseCount = 0;
+    if (!options.perfCounters) return;
+
+    for (int e = 0; e < PERF_EVENTS; e++) counters.fd[e] = openPerfEvent(e);
+    if (counters.fd[PERF_CYCLES] < 0) {
+#ifdef __linux__
+        // EACCES/EPERM: perf_event_paranoid forbids it; ENOENT: no PMU (e.g. many VMs)
+        printf("Hardware counters unavailable (perf_event_open: %s).\n", strerror(errno));
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            if (counters.fd[e] >= 0) close(counters.fd[e]);
+            counters.fd[e] = -1;
+        }
+#else
+        printf("Hardware counters are only available on Linux.\n");
+#endif
+        options.perfCounters = false;
+        return;
+    }
+
+    counters.startTime = std::chrono::steady_clock::now();
+#ifdef __linux__
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (counters.fd[e] >= 0) ioctl(counters.fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    perfCounterThread = std::this_thread::get_id();
+    perfPhaseDepth = 0;
+    activePerfCounters.store(&counters);
+}
+
+/*******************************************************************************
+ * Function: readPerfCounters
+ * 
+ * Input:
+ *   - counters: set started by startPerfCounters
+ *   - value: receives each counter's (multiplex-scaled) value so far
+ *   - valid: receives whether it could be read; may be NULL
+ *******************************************************************************/
+void readPerfCounters(const PerfCounters &counters, unsigned long long value[PERF_EVENTS], bool *valid) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        value[e] = 0;
+        if (valid != NULL) valid[e] = false;
+#ifdef __linux__
+        if (counters.fd[e] < 0) continue;
+
+        // Value, time enabled, time running; a counter that never ran stays invalid
+        unsigned long long data[3];
+        if (read(counters.fd[e], data, sizeof(data)) == (ssize_t) sizeof(data) && data[2] > 0) {
+            value[e] = (unsigned long long) ((double) data[0] * data[1] / data[2]);
+            if (valid != NULL) valid[e] = true;
+        }
+#endif
+    }
+}
+
+/*******************************************************************************
+ * Function: stopPerfCounters
+ * 
+ * Input:
+ *   - counters: set started by startPerfCounters
+ * 
+ * Output:
+ *   - Stops and closes the counters and stores their (multiplex-scaled)
+ *     values
+ *******************************************************************************/
+void stopPerfCounters(PerfCounters &counters) {
+    PerfCounters *active = &counters;
+    activePerfCounters.compare_exchange_strong(active, NULL);
+#ifdef __linux__
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (counters.fd[e] >= 0) ioctl(counters.fd[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - counters.startTime;
+    counters.seconds = elapsed.count();
+
+    readPerfCounters(counters, counters.value, counters.valid);
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (counters.fd[e] >= 0) close(counters.fd[e]);
+        counters.fd[e] = -1;
+    }
+#else
+    (void) counters;
+#endif
+}
+
+/*******************************************************************************
+ * Function: PerfPhaseScope
+ * 
+ * Input:
+ *   - name: static string naming the phase
+ *   - numbers: numbers the phase sieves or tests (0 if its work does not
+ *     grow with the range)
+ * 
+ * Purpose:
+ *   Adds the counts from construction to destruction to the phase of that
+ *   name in the active counter set. Phases nested in another, or run on
+ *   another thread, stay part of the enclosing one.
+ *******************************************************************************/
+struct PerfPhaseScope {
+    PerfCounters *counters;                 // NULL unless this is the outermost phase on the owning thread
+    bool nested;
+    const char *name;
+    unsigned long long numbers;
+    unsigned long long start[PERF_EVENTS];
+    std::chrono::steady_clock::time_point startTime;
+
+    PerfPhaseScope(const char *name, const unsigned long long numbers)
+        : counters(NULL), nested(false), name(name), numbers(numbers) {
+        PerfCounters *active = activePerfCounters.load();
+        if (active == NULL || std::this_thread::get_id() != perfCounterThread) return;
+        if (perfPhaseDepth++ != 0) {
+            nested = true;
+            return;
+        }
+        counters = active;
+        startTime = std::chrono::steady_clock::now();
+        readPerfCounters(*counters, start, NULL);
+    }
+
+    ~PerfPhaseScope() {
+        if (nested) perfPhaseDepth--;
+        if (counters == NULL) return;
+        perfPhaseDepth--;
+
+        unsigned long long now[PERF_EVENTS];
+        readPerfCounters(*counters, now, NULL);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+        unsigned int p = 0;
+        while (p < counters->phaseCount && counters->phases[p].name != name) p++;
+        if (p == MAX_PERF_PHASES) return;
+        PerfPhase &phase = counters->phases[p];
+        if (p == counters->phaseCount) {
+            counters->phaseCount++;
+            phase.name = name;
+            phase.seconds = 0;
+            phase.numbers = 0;
+            for (int e = 0; e < PERF_EVENTS; e++) phase.value[e] = 0;
+        }
+        phase.seconds += elapsed.count();
+        phase.numbers += numbers;
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            if (now[e] > start[e]) phase.value[e] += now[e] - start[e];  // Scaled counts can step back
+        }
+    }
+};
+
+/*******************************************************************************
+ * Function: printPerfMisses
+ * 
+ * Input:
+ *   - value, valid: counter values and which of them are meaningful
+ *   - numbers: divide by this many numbers (0 = print totals)
+ * 
+ * Output:
+ *   - Prints the cache and branch misses, "n/a" for counters the CPU does
+ *     not provide
+ *******************************************************************************/
+void printPerfMisses(const unsigned long long value[PERF_EVENTS], const bool valid[PERF_EVENTS],
+                     const unsigned long long numbers) {
+    printf(numbers > 0 ? " per number:" : " totals:");
+    for (int e = PERF_L1D_MISSES; e < PERF_EVENTS; e++) {
+        const char *separator = (e + 1 < PERF_EVENTS) ? "," : "";
+        if (!valid[e]) {
+            printf(" %s n/a%s", PERF_EVENT_NAMES[e], separator);
+        } else if (numbers > 0) {
+            printf(" %.4f %s%s", (double) value[e] / (double) numbers, PERF_EVENT_NAMES[e], separator);
+        } else {
+            printf(" %llu %s%s", value[e], PERF_EVENT_NAMES[e], separator);
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: reportPerfCounters
+ * 
+ * Input:
+ *   - counters: values from stopPerfCounters
+ *   - label: what was measured
+ *   - numbers: how many numbers the call tested itself, outside any phase
+ *     (0 when only its phases work per number)
+ * 
+ * Output:
+ *   - Prints the totals and IPC, then each phase with its IPC and misses,
+ *     per number for the phases that sieve or test a range
+ *******************************************************************************/
+void reportPerfCounters(const PerfCounters &counters, const char *label, const unsigned long long numbers) {
+    if (!counters.valid[PERF_CYCLES]) return;
+
+    printf("[%s] %.3f s, %llu cycles, %llu instructions", label, counters.seconds,
+           counters.value[PERF_CYCLES], counters.value[PERF_INSTRUCTIONS]);
+    if (counters.valid[PERF_INSTRUCTIONS] && counters.value[PERF_CYCLES] > 0) {
+        printf(", IPC %.2f", (double) counters.value[PERF_INSTRUCTIONS] / (double) counters.value[PERF_CYCLES]);
+    }
+    if (numbers > 0) {
+        printf("\n[%s]", label);
+        printPerfMisses(counters.value, counters.valid, numbers);
+    }
+    printf("\n");
+
+    // The phases, then whatever ran outside them
+    unsigned long long outside[PERF_EVENTS];
+    for (int e = 0; e < PERF_EVENTS; e++) outside[e] = counters.value[e];
+    double outsideSeconds = counters.seconds;
+    for (unsigned int p = 0; p <= counters.phaseCount && counters.phaseCount > 0; p++) {
+        const unsigned long long *value = outside;
+        const char *name = "other";
+        double seconds = outsideSeconds;
+        unsigned long long phaseNumbers = 0;
+        if (p < counters.phaseCount) {
+            const PerfPhase &phase = counters.phases[p];
+            value = phase.value;
+            name = phase.name;
+            seconds = phase.seconds;
+            phaseNumbers = phase.numbers;
+            for (int e = 0; e < PERF_EVENTS; e++) {
+                outside[e] -= (phase.value[e] < outside[e]) ? phase.value[e] : outside[e];
+            }
+            outsideSeconds -= (phase.seconds < outsideSeconds) ? phase.seconds : outsideSeconds;
+        } else if (outside[PERF_CYCLES] == 0) {
+            break;
+        }
+
+        printf("[%s]   %-14s %.3f s, %llu cycles", label, name, seconds, value[PERF_CYCLES]);
+        if (counters.valid[PERF_INSTRUCTIONS] && value[PERF_CYCLES] > 0) {
+            printf(", IPC %.2f", (double) value[PERF_INSTRUCTIONS] / (double) value[PERF_CYCLES]);
+        }
+        printf(";");
+        printPerfMisses(value, counters.valid, phaseNumbers);
+        printf("\n");
+    }
+}
+
+/*******************************************************************************
+ * Function: isPrime
+ * 
+ * Input:
+ *   - n: unsigned integer to test for primality
+ * 
+ * Output:
+ *   - Returns 1 if n is prime
+ *   - Returns 0 if n is not prime
+ * 
+ * Purpose:
+ *   Core function that determines if a number is prime by checking for
+ *   divisibility by the primes up to its square root, taken from the
+ *   shared prime table (trialDivisionBody, in the variant chosen by
+ *   selectKernels)
+ *******************************************************************************/
+int isPrime(unsigned int n) {
+    const std::vector<unsigned int> &primes = pinPrimeTable(1ULL << 16);
+    int result = kernels.isPrime(n, primes.data(), primes.size());
+    unpinPrimeTable();
+    return result;
+}
+
+/*******************************************************************************
+ * Function: isPrimeWide
+ * 
+ * Input:
+ *   - n: any number below 2^128
+ * 
+ * Output:
+ *   - Returns 1 if n is prime
+ *   - Returns 0 if n is not prime
+ * 
+ * Purpose:
+ *   Task 1 and batch entry point: 32-bit values keep the trial-division
+ *   kernel, larger ones go to the Baillie-PSW kernel (bpswBody)
+ *******************************************************************************/
+int isPrimeWide(const uint128 n) {
+    return (n <= UINT_MAX) ? isPrime((unsigned int) n) : kernels.isPrimeWide(n);
+}
+
+/*******************************************************************************
+ * Function: isPrimeTest
+ * 
+ * Input:
+ *   - Prompts user for positive integers below 2^128, one at a time
+ *   - Enter 0 to exit
+ * 
+ * Output:
+ *   - Displays whether each entered number is prime or not
+ * 
+ * Purpose:
+ *   Interactive function that lets users test multiple numbers for primality
+ *   until they choose to exit
+ *******************************************************************************/
+void isPrimeTest() {
+    char text[64];
+    char digits[40];
+    uint128 n;
+
+    while (1) {
+        printf("Please enter a positive integer: ");
+        if (scanf("%63s", text) != 1) break;
+        if (!parseUint128(text, &n)) {
+            printf("Please enter a whole number below 2^128.\n");
+            continue;
+        }
+
+        // Exit condition
+        if (n == 0) {
+            printf("Press ENTER to exit...");
+            getchar();  // Consume the newline from previous scanf
+            getchar();  // Wait for ENTER
+            break;
+        }
+
+        PerfCounters counters;
+        startPerfCounters(counters);
+        int prime = isPrimePlanned(n);
+        stopPerfCounters(counters);
+
+        if (prime) {
+            printf("%s is a prime number!\n", formatUint128(n, digits));
+        } else {
+            printf("%s is not a prime number.\n", formatUint128(n, digits));
+        }
+        reportPerfCounters(counters, "Task 1", 1);
+    }
+}
+
+/*******************************************************************************
+ * Range Job Checkpoints
+ * 
+ * While a range job runs, the waiting thread periodically saves the segments
+ * finished so far and their summed result. Segments below the watermark are
+ * all done; the few finished out of order above it are listed explicitly. The
+ * file is replaced atomically, removed when the job completes, and read back
+ * when the program is started with --resume.
+ *******************************************************************************/
+const char CHECKPOINT_MAGIC[] = "Lab05-checkpoint";
+const unsigned int CHECKPOINT_VERSION = 2;
+
+// Identifies the job a checkpoint belongs to
+struct CheckpointKey {
+    unsigned int task;             // Menu task that owns the job
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long parameter;  // Task specific, e.g. the factor count for Task 3
+    unsigned char display;         // 'y' if the job prints its results, 'n' if it only counts
+};
+
+struct Checkpoint {
+    CheckpointKey key;
+    unsigned long long segmentSize;
+    unsigned long long watermark;                  // Every segment below this is done
+    std::vector<unsigned long long> completed;     // Finished segments at or above the watermark
+    unsigned long long completedTotal;             // Sum of the results of all finished segments
+};
+
+/*******************************************************************************
+ * Function: replaceFile
+ * 
+ * Input:
+ *   - tempPath: finished file to move into place
+ *   - path: file to replace
+ * 
+ * Output:
+ *   - Returns 1 once path holds the contents of tempPath, 0 on failure
+ * 
+ * Purpose:
+ *   Last step of the write-to-a-temporary-file pattern shared by the
+ *   checkpoint and the trace
+ *******************************************************************************/
+int replaceFile(const char *tempPath, const char *path) {
+    // rename() will not replace an existing file on Windows
+    if (rename(tempPath, path) != 0) {
+        remove(path);
+        if (rename(tempPath, path) != 0) return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: saveCheckpoint
+ * 
+ * Input:
+ *   - checkpoint: progress to save
+ * 
+ * Output:
+ *   - Replaces the checkpoint file; returns 1 on success, 0 on failure
+ * 
+ * Purpose:
+ *   Writes to a temporary file first so a crash mid-write never leaves a
+ *   truncated checkpoint behind
+ *******************************************************************************/
+int saveCheckpoint(const Checkpoint &checkpoint) {
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", options.checkpointPath);
+
+    FILE *file = fopen(tempPath, "w");
+    if (file == NULL) return 0;
+
+    fprintf(file, "%s %u\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+    fprintf(file, "task %u\n", checkpoint.key.task);
+    fprintf(file, "range %llu %llu\n", checkpoint.key.start, checkpoint.key.end);
+    fprintf(file, "parameter %llu\n", checkpoint.key.parameter);
+    fprintf(file, "display %c\n", checkpoint.key.display);
+    fprintf(file, "segmentSize %llu\n", checkpoint.segmentSize);
+    fprintf(file, "watermark %llu\n", checkpoint.watermark);
+    fprintf(file, "completedTotal %llu\n", checkpoint.completedTotal);
+    fprintf(file, "completed %llu", (unsigned long long) checkpoint.completed.size());
+    for (unsigned long long segment : checkpoint.completed) {
+        fprintf(file, " %llu", segment);
+    }
+    fprintf(file, "\n");
+
+    if (fclose(file) != 0) {
+        remove(tempPath);
+        return 0;
+    }
+
+    return replaceFile(tempPath, options.checkpointPath);
+}
+
+/*******************************************************************************
+ * Function: loadCheckpoint
+ * 
+ * Input:
+ *   - key: the job about to run
+ *   - checkpoint: receives the saved progress
+ * 
+ * Output:
+ *   - Returns 1 if the checkpoint file exists and belongs to this job, -1 if
+ *     it belongs to the same range run with the other display choice, and 0
+ *     otherwise
+ * 
+ * Purpose:
+ *   Reads back a checkpoint written by saveCheckpoint for --resume
+ *******************************************************************************/
+int loadCheckpoint(const CheckpointKey &key, Checkpoint &checkpoint) {
+    FILE *file = fopen(options.checkpointPath, "r");
+    if (file == NULL) return 0;
+
+    char magic[32];
+    unsigned int version = 0;
+    unsigned long long completedCount = 0;
+    int ok = fscanf(file, "%31s %u", magic, &version) == 2
+             && strcmp(magic, CHECKPOINT_MAGIC) == 0 && version == CHECKPOINT_VERSION
+             && fscanf(file, " task %u", &checkpoint.key.task) == 1
+             && fscanf(file, " range %llu %llu", &checkpoint.key.start, &checkpoint.key.end) == 2
+             && fscanf(file, " parameter %llu", &checkpoint.key.parameter) == 1
+             && fscanf(file, " display %c", &checkpoint.key.display) == 1
+             && fscanf(file, " segmentSize %llu", &checkpoint.segmentSize) == 1
+             && fscanf(file, " watermark %llu", &checkpoint.watermark) == 1
+             && fscanf(file, " completedTotal %llu", &checkpoint.completedTotal) == 1
+             && fscanf(file, " completed %llu", &completedCount) == 1;
+
+    checkpoint.completed.clear();
+    for (unsigned long long i = 0; ok && i < completedCount; i++) {
+        unsigned long long segment;
+        ok = fscanf(file, " %llu", &segment) == 1;
+        if (ok) checkpoint.completed.push_back(segment);
+    }
+    fclose(file);
+
+    if (!ok || checkpoint.key.task != key.task || checkpoint.key.start != key.start || checkpoint.key.end != key.end
+        || checkpoint.key.parameter != key.parameter) {
+        return 0;
+    }
+    return (checkpoint.key.display == key.display) ? 1 : -1;
+}
+
+/*******************************************************************************
+ * Trace Events
+ * 
+ * With --trace=FILE, TraceScope objects record how long each engine phase
+ * takes (pre-sieve, segment sieving, counting, factorization, output
+ * flushes). saveTraceFile() writes them as Chrome trace JSON, ready for
+ * Perfetto or chrome://tracing, whenever a run ends and again at exit, so
+ * a worker that is killed or a menu left with Ctrl-C keeps every finished
+ * query. Every thread writes to its own
+ * ring buffer, so recording never locks: the owning thread is the only
+ * writer and publishes each event by advancing head. A ring goes back in
+ * the pool when its thread exits, so each executor run reuses the same
+ * lanes. A full ring overwrites its oldest events. When tracing is off a
+ * TraceScope costs one branch.
+ *******************************************************************************/
+const size_t TRACE_RING_EVENTS = 1 << 16;  // Events kept per thread
+const unsigned int MAX_TRACE_THREADS = 256;
+
+struct TraceEvent {
+    const char *name;              // Static string naming the phase
+    unsigned long long start;      // Nanoseconds since traceStart
+    unsigned long long duration;
+    unsigned long long argument;   // Phase-specific value, e.g. the segment start
+};
+
+struct TraceRing {
+    std::atomic<bool> inUse;
+    std::atomic<unsigned long long> head;  // Events ever written
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static std::atomic<TraceRing *> traceRings[MAX_TRACE_THREADS];
+static std::chrono::steady_clock::time_point traceStart = std::chrono::steady_clock::now();
+
+/*******************************************************************************
+ * Function: claimTraceRing
+ * 
+ * Output:
+ *   - Returns a ring no other live thread is using, allocating one if all
+ *     are taken, or NULL once MAX_TRACE_THREADS rings are busy
+ *******************************************************************************/
+TraceRing *claimTraceRing(void) {
+    for (unsigned int i = 0; i < MAX_TRACE_THREADS; i++) {
+        TraceRing *ring = traceRings[i].load();
+        if (ring == NULL) {
+            TraceRing *created = new TraceRing;
+            created->inUse = true;
+            created->head = 0;
+            if (traceRings[i].compare_exchange_strong(ring, created)) return created;
+            delete created;  // Another thread filled the slot first; ring now holds its ring
+        }
+        bool expected = false;
+        if (ring->inUse.compare_exchange_strong(expected, true)) return ring;
+    }
+    return NULL;
+}
+
+// Holds the calling thread's ring and hands it back when the thread exits
+struct TraceThread {
+    TraceRing *ring;
+    bool claimed;
+
+    ~TraceThread() {
+        if (ring != NULL) ring->inUse.store(false);
+    }
+};
+
+static thread_local TraceThread traceThread = {NULL, false};
+
+/*******************************************************************************
+ * Function: traceNow
+ * 
+ * Output:
+ *   - Returns nanoseconds since the program started
+ *******************************************************************************/
+inline unsigned long long traceNow(void) {
+    return (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceStart).count();
+}
+
+/*******************************************************************************
+ * Function: TraceScope
+ * 
+ * Input:
+ *   - name: static string naming the phase
+ *   - argument: value shown with the event (default 0)
+ * 
+ * Purpose:
+ *   Records the time from construction to destruction as one trace event
+ *   in the calling thread's ring
+ *******************************************************************************/
+struct TraceScope {
+    const char *name;
+    unsigned long long argument;
+    unsigned long long start;
+
+    TraceScope(const char *name, const unsigned long long argument = 0) : name(NULL), argument(argument), start(0) {
+        if (options.tracePath == NULL) return;
+        this->name = name;
+        start = traceNow();
+    }
+
+    ~TraceScope() {
+        if (name == NULL) return;
+        if (!traceThread.claimed) {
+            traceThread.ring = claimTraceRing();
+            traceThread.claimed = true;
+        }
+        TraceRing *ring = traceThread.ring;
+        if (ring == NULL) return;
+
+        unsigned long long head = ring->head.load(std::memory_order_relaxed);
+        TraceEvent &event = ring->events[head % TRACE_RING_EVENTS];
+        event.name = name;
+        event.start = start;
+        event.duration = traceNow() - start;
+        event.argument = argument;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+};
+
+/*******************************************************************************
+ * Function: saveTraceFile
+ * 
+ * Input:
+ *   - eventCount: receives the number of events written
+ * 
+ * Output:
+ *   - Replaces --trace with every recorded event so far; returns 1 on
+ *     success, 0 on failure
+ * 
+ * Purpose:
+ *   Writes to a temporary file first, like saveCheckpoint, so a process
+ *   killed mid-write keeps the previous trace
+ *******************************************************************************/
+int saveTraceFile(unsigned long long &eventCount) {
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", options.tracePath);
+
+    FILE *file = fopen(tempPath, "w");
+    if (file == NULL) return 0;
+
+    eventCount = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Lab05\"}}");
+    for (unsigned int i = 0; i < MAX_TRACE_THREADS; i++) {
+        TraceRing *ring = traceRings[i].load();
+        if (ring == NULL) break;
+
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"lane %u\"}}",
+                i + 1, i + 1);
+        unsigned long long head = ring->head.load(std::memory_order_acquire);
+        unsigned long long first = (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0;
+        for (unsigned long long e = first; e < head; e++) {
+            const TraceEvent &event = ring->events[e % TRACE_RING_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"value\":%llu}}", event.name, i + 1, event.start / 1000.0, event.duration / 1000.0,
+                    event.argument);
+            eventCount++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        remove(tempPath);
+        return 0;
+    }
+
+    return replaceFile(tempPath, options.tracePath);
+}
+
+/*******************************************************************************
+ * Function: writeTraceFile
+ * 
+ * Output:
+ *   - Writes every recorded event to --trace as Chrome trace JSON, one
+ *     thread lane per ring, and reports how many there were
+ * 
+ * Purpose:
+ *   Registered with atexit, when all worker threads have finished. Each run
+ *   also saves the file as it ends (see saveTraceFile)
+ *******************************************************************************/
+void writeTraceFile(void) {
+    unsigned long long eventCount;
+    if (!saveTraceFile(eventCount)) {
+        printf("Could not write trace file %s.\n", options.tracePath);
+        return;
+    }
+    fprintf(stderr, "Wrote %llu trace events to %s.\n", eventCount, options.tracePath);
+}
+
+/*******************************************************************************
+ * Range Job Executor
+ * 
+ * Task 2 and Task 3 split their range into fixed-size segments. Worker threads
+ * claim segments from an atomic counter, run a segment kernel on each one and
+ * add the result to a shared total. The calling thread waits for the workers,
+ * printing a progress/ETA line while it waits. Ctrl-C sets a flag that the
+ * workers and kernels poll, so a cancelled job returns the partial count.
+ * Finished segments are tracked so the job can be checkpointed and resumed.
+ * 
+ * Each query is one run, bracketed by beginRun and endRun (or a RunScope).
+ * The outermost beginRun clears the flag and installs the Ctrl-C handler;
+ * the matching endRun restores the previous handler. Jobs, engines and
+ * memory checks inside the run only ever stop it, with stopRun, so the
+ * entry point can tell a Ctrl-C from a query over --mem-limit afterwards.
+ *******************************************************************************/
+const unsigned long long SEGMENT_SIZE = 1ULL << 16;
+const unsigned int CANCEL_POLL_MASK = 1023;  // Kernels poll for Ctrl-C every 1024 numbers
+
+// Segment kernel: processes the inclusive range [lo, hi] and returns its count
+typedef std::function<unsigned long long(unsigned long long lo, unsigned long long hi)> SegmentKernel;
+
+struct RangeJob {
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long segmentSize;
+    unsigned long long segmentCount;
+    std::atomic<unsigned long long> nextSegment;
+    std::atomic<unsigned long long> numbersDone;
+    std::atomic<unsigned long long> total;
+    std::vector<unsigned long long> skipSegments;  // Finished in an earlier run (sorted)
+    unsigned int activeWorkers;
+    std::mutex lock;
+    std::condition_variable finished;
+
+    // Guarded by lock
+    unsigned long long watermark;                  // Every segment below this is done
+    std::set<unsigned long long> completedAbove;   // Finished segments at or above the watermark
+    unsigned long long completedTotal;             // Sum of the results of all finished segments
+};
+
+// Why a run ended early; a Ctrl-C only sets cancelRequested, so it is the default
+enum RunStatus {RUN_COMPLETE, RUN_INTERRUPTED, RUN_OVER_MEMORY, RUN_STOPPED};
+
+static std::atomic<bool> cancelRequested(false);           // Polled by kernels; set by any stop
+static std::atomic<int> runStopReason(RUN_INTERRUPTED);    // Set by stopRun before cancelRequested
+static std::mutex runLock;                                 // Guards the two below
+static unsigned int runDepth = 0;                          // Nested beginRun calls still open
+#ifndef _WIN32
+static struct sigaction previousInterruptAction;
+#endif
+
+/*******************************************************************************
+ * Function: handleInterrupt
+ * 
+ * Input:
+ *   - signalNumber / type: the signal or console event being handled
+ * 
+ * Output:
+ *   - Sets the cancellation flag polled by running range jobs
+ * 
+ * Purpose:
+ *   Ctrl-C handler installed by beginRun for the length of a run. It only
+ *   stores to a lock-free atomic, which is safe in a signal handler
+ *******************************************************************************/
+#ifdef _WIN32
+BOOL WINAPI handleInterrupt(DWORD type) {
+    if (type != CTRL_C_EVENT) return FALSE;
+    cancelRequested.store(true);
+    return TRUE;
+}
+#else
+void handleInterrupt(int signalNumber) {
+    (void) signalNumber;
+    cancelRequested.store(true);
+}
+#endif
+
+/*******************************************************************************
+ * Function: beginRun / endRun
+ * 
+ * Purpose:
+ *   Bracket one query. The outermost beginRun starts a fresh run: it clears
+ *   the cancellation flag and installs handleInterrupt with sigaction (a
+ *   console control handler on Windows). Nested calls, such as a range job
+ *   inside a query, join the run that is already open. The outermost endRun
+ *   puts the previous handler back and saves --trace; isCancelRequested and
+ *   runStatus keep describing the run until the next one begins.
+ *******************************************************************************/
+void beginRun(void) {
+    std::lock_guard<std::mutex> guard(runLock);
+    if (runDepth++ != 0) return;
+
+    runStopReason.store(RUN_INTERRUPTED);
+    cancelRequested.store(false);
+#ifdef _WIN32
+    SetConsoleCtrlHandler(handleInterrupt, TRUE);
+#else
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previousInterruptAction);
+#endif
+}
+
+void endRun(void) {
+    std::lock_guard<std::mutex> guard(runLock);
+    if (--runDepth != 0) return;
+
+#ifdef _WIN32
+    SetConsoleCtrlHandler(handleInterrupt, FALSE);
+#else
+    sigaction(SIGINT, &previousInterruptAction, NULL);
+#endif
+    unsigned long long eventCount;
+    if (options.tracePath != NULL) saveTraceFile(eventCount);
+}
+
+/*******************************************************************************
+ * Function: RunScope
+ * 
+ * Purpose:
+ *   Calls beginRun on construction and endRun on destruction, so every
+ *   return path of an entry point closes its run
+ *******************************************************************************/
+struct RunScope {
+    RunScope() { beginRun(); }
+    ~RunScope() { endRun(); }
+};
+
+/*******************************************************************************
+ * Function: stopRun
+ * 
+ * Input:
+ *   - reason: RUN_OVER_MEMORY or RUN_STOPPED (the job stopped itself, for
+ *     example at a deadline or on a write error)
+ * 
+ * Purpose:
+ *   Cancels the current run like Ctrl-C, but records why. The first reason
+ *   given wins
+ *******************************************************************************/
+void stopRun(const RunStatus reason) {
+    if (!cancelRequested.load()) runStopReason.store(reason);
+    cancelRequested.store(true);
+}
+
+/*******************************************************************************
+ * Function: isCancelRequested
+ * 
+ * Output:
+ *   - Returns true once the current run has been stopped, by Ctrl-C or by
+ *     stopRun
+ * 
+ * Purpose:
+ *   Cheap check for kernels to call from inside their loops
+ *******************************************************************************/
+inline bool isCancelRequested(void) {
+    return cancelRequested.load(std::memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * Function: runStatus
+ * 
+ * Output:
+ *   - Returns RUN_COMPLETE if the current (or last) run was never stopped,
+ *     otherwise why it stopped
+ *******************************************************************************/
+RunStatus runStatus(void) {
+    return cancelRequested.load() ? (RunStatus) runStopReason.load() : RUN_COMPLETE;
+}
+
+/*******************************************************************************
+ * Function: runStatusPrefix
+ * 
+ * Output:
+ *   - Returns "" for a complete run, otherwise a prefix for its summary line
+ *     saying why it stopped
+ *******************************************************************************/
+const char *runStatusPrefix(void) {
+    switch (runStatus()) {
+        case RUN_COMPLETE: return "";
+        case RUN_OVER_MEMORY: return "Stopped at the memory limit: ";
+        case RUN_STOPPED: return "Stopped: ";
+        default: return "Cancelled: ";
+    }
+}
+
+/*******************************************************************************
+ * Function: rangeJobWorker
+ * 
+ * Input:
+ *   - job: the shared job state
+ *   - kernel: function run on each claimed segment
+ * 
+ * Output:
+ *   - Adds each segment's result and size to the job counters
+ * 
+ * Purpose:
+ *   Worker thread loop that claims segments until none are left or the job
+ *   is cancelled
+ *******************************************************************************/
+void rangeJobWorker(RangeJob *job, const SegmentKernel *kernel) {
+    while (!isCancelRequested()) {
+        unsigned long long segment = job->nextSegment.fetch_add(1);
+        if (segment >= job->segmentCount) break;
+        if (std::binary_search(job->skipSegments.begin(), job->skipSegments.end(), segment)) continue;
+
+        unsigned long long lo = job->start + segment * job->segmentSize;
+        unsigned long long hi = (job->end - lo < job->segmentSize) ? job->end : lo + job->segmentSize - 1;
+
+        unsigned long long result = (*kernel)(lo, hi);
+        bool segmentFinished = !isCancelRequested();  // A cancelled kernel may have stopped early
+        job->total.fetch_add(result);
+        job->numbersDone.fetch_add(hi - lo + 1);
+
+        if (segmentFinished) {
+            std::lock_guard<std::mutex> guard(job->lock);
+            job->completedAbove.insert(segment);
+            job->completedTotal += result;
+            while (!job->completedAbove.empty() && *job->completedAbove.begin() == job->watermark) {
+                job->completedAbove.erase(job->completedAbove.begin());
+                job->watermark++;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(job->lock);
+    job->activeWorkers--;
+    job->finished.notify_one();
+}
+
+/*******************************************************************************
+ * Function: printProgress
+ * 
+ * Input:
+ *   - job: the running job
+ *   - elapsed: seconds since the job started
+ * 
+ * Output:
+ *   - Overwrites the current stderr line with percent done, elapsed time and ETA
+ * 
+ * Purpose:
+ *   Gives feedback on long runs without mixing into the results on stdout
+ *******************************************************************************/
+void printProgress(const RangeJob &job, double elapsed) {
+    unsigned long long done = job.numbersDone.load();
+    double width = (double) (job.end - job.start) + 1.0;
+    double fraction = (double) done / width;
+
+    fprintf(stderr, "\r%5.1f%% done, %llu found, %.0fs elapsed", fraction * 100.0, job.total.load(), elapsed);
+    if (done > 0) {
+        fprintf(stderr, ", ETA %.0fs   ", elapsed * (1.0 - fraction) / fraction);
+    } else {
+        fprintf(stderr, ", ETA --   ");
+    }
+    fflush(stderr);
+}
+
+/*******************************************************************************
+ * Function: snapshotCheckpoint
+ * 
+ * Input:
+ *   - job: the running job (caller holds job.lock)
+ *   - key: identifies the job
+ * 
+ * Output:
+ *   - Returns the job's progress in checkpoint form
+ * 
+ * Purpose:
+ *   Captures a consistent view of the finished segments for saveCheckpoint
+ *******************************************************************************/
+Checkpoint snapshotCheckpoint(const RangeJob &job, const CheckpointKey &key) {
+    Checkpoint checkpoint;
+    checkpoint.key = key;
+    checkpoint.segmentSize = job.segmentSize;
+    checkpoint.watermark = job.watermark;
+    checkpoint.completed.assign(job.completedAbove.begin(), job.completedAbove.end());
+    checkpoint.completedTotal = job.completedTotal;
+    return checkpoint;
+}
+
+/*******************************************************************************
+ * Function: runRangeJob
+ * 
+ * Input:
+ *   - start, end: inclusive range to process (start <= end)
+ *   - segmentSize: numbers handed to the kernel at a time
+ *   - threadCount: number of worker threads; 1 keeps segments in order
+ *   - kernel: function run on each segment, returning that segment's count
+ *   - showProgress: true to print a progress/ETA line while waiting
+ *   - key: identifies the job in checkpoint files; NULL if the job's output
+ *     cannot be resumed and it must not be checkpointed
+ * 
+ * Output:
+ *   - Returns the sum of all kernel results (partial if cancelled)
+ *   - isCancelRequested() reports whether the job was stopped, runStatus()
+ *     why
+ * 
+ * Purpose:
+ *   Runs a segmented range computation on background threads while the
+ *   calling thread reports progress, saves checkpoints every
+ *   options.checkpointInterval seconds and lets Ctrl-C cancel cooperatively.
+ *   With --resume, segments recorded in a matching checkpoint are skipped;
+ *   the job then uses the checkpoint's segment size, or stops if that is
+ *   larger than segmentSize.
+ *******************************************************************************/
+unsigned long long runRangeJob(const unsigned long long start, const unsigned long long end,
+                               const unsigned long long segmentSize, unsigned int threadCount,
+                               const SegmentKernel &kernel, const bool showProgress, const CheckpointKey *key) {
+    TraceScope trace("range job", end - start + 1);
+    PerfPhaseScope phase("range job", end - start + 1);
+    RangeJob job;
+    job.start = start;
+    job.end = end;
+    job.segmentSize = segmentSize;
+    job.segmentCount = (end - start) / segmentSize + 1;
+    job.nextSegment = 0;
+    job.numbersDone = 0;
+    job.total = 0;
+    job.watermark = 0;
+    job.completedTotal = 0;
+
+    RunScope run;  // Joins the caller's run, or is one on its own
+
+    // Pick up where an earlier run of the same job left off. Resuming with the other display choice would
+    // leave the finished segments unprinted (or print half a list), and starting over would overwrite the file
+    bool checkpointUsed = false;
+    Checkpoint resumed;
+    int loaded = (key != NULL && options.resume) ? loadCheckpoint(*key, resumed) : 0;
+    if (loaded < 0) {
+        printf("%s was saved with the results %s; answer the display prompt the same way to resume it.\n",
+               options.checkpointPath, (resumed.key.display == 'y') ? "shown" : "hidden");
+        stopRun(RUN_STOPPED);
+        return 0;
+    }
+    if (loaded > 0 && resumed.segmentSize > segmentSize) {
+        // Larger segments than this run fitted would break the memory limit it was fitted to
+        printf("%s was saved with segments of %llu numbers, but this run can only hold %llu; "
+               "resume it with the --mem-limit it was saved under.\n", options.checkpointPath, resumed.segmentSize,
+               segmentSize);
+        stopRun(RUN_STOPPED);
+        return 0;
+    }
+    if (loaded > 0 && resumed.segmentSize > 0) {
+        // The watermark and completed indices count the saved segments, and smaller ones always fit
+        job.segmentSize = resumed.segmentSize;
+        job.segmentCount = (end - start) / job.segmentSize + 1;
+    }
+    if (loaded > 0 && resumed.segmentSize == job.segmentSize && resumed.watermark <= job.segmentCount) {
+        job.watermark = resumed.watermark;
+        job.completedTotal = resumed.completedTotal;
+        for (unsigned long long segment : resumed.completed) {
+            if (segment >= job.watermark && segment < job.segmentCount) {
+                job.completedAbove.insert(segment);
+            }
+        }
+        job.skipSegments.assign(job.completedAbove.begin(), job.completedAbove.end());
+        job.nextSegment = job.watermark;
+        job.total = job.completedTotal;
+
+        unsigned long long size = job.segmentSize;
+        unsigned long long numbersDone = (job.watermark == job.segmentCount) ? end - start + 1 : job.watermark * size;
+        for (unsigned long long segment : job.completedAbove) {
+            unsigned long long lo = start + segment * size;
+            numbersDone += (end - lo < size) ? end - lo + 1 : size;
+        }
+        job.numbersDone = numbersDone;
+
+        checkpointUsed = true;
+        printf("Resuming from %s: %llu of %llu segments already done.\n", options.checkpointPath,
+               job.watermark + (unsigned long long) job.completedAbove.size(), job.segmentCount);
+    }
+
+    if (threadCount == 0) threadCount = 1;
+    if (threadCount > job.segmentCount) threadCount = (unsigned int) job.segmentCount;
+    job.activeWorkers = threadCount;
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threadCount; t++) {
+        workers.emplace_back(rangeJobWorker, &job, &kernel);
+    }
+
+    // Wait for the workers, refreshing the progress line every quarter second
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastCheckpoint = startTime;
+    bool progressShown = false;
+    {
+        std::unique_lock<std::mutex> guard(job.lock);
+        while (job.activeWorkers > 0) {
+            bool timedOut = job.finished.wait_for(guard, std::chrono::milliseconds(250)) == std::cv_status::timeout;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            if (timedOut && showProgress) {
+                std::chrono::duration<double> elapsed = now - startTime;
+                printProgress(job, elapsed.count());
+                progressShown = true;
+            }
+            if (key != NULL && options.checkpointInterval > 0
+                && now - lastCheckpoint >= std::chrono::seconds(options.checkpointInterval)) {
+                if (saveCheckpoint(snapshotCheckpoint(job, *key))) checkpointUsed = true;
+                lastCheckpoint = now;
+            }
+        }
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    if (progressShown) {
+        fprintf(stderr, "\r%70s\r", "");  // Clear the progress line
+    }
+
+    // An interrupted job keeps its progress for --resume; a finished one cleans up
+    if (runStatus() == RUN_INTERRUPTED) {
+        if (key != NULL && options.checkpointInterval > 0 && saveCheckpoint(snapshotCheckpoint(job, *key))) {
+            printf("Progress saved to %s; restart with --resume to continue this range.\n", options.checkpointPath);
+        }
+    } else if (checkpointUsed) {
+        remove(options.checkpointPath);
+    }
+    return job.total.load();
+}
+
+/*******************************************************************************
+ * Function: rangeThreadCount
+ * 
+ * Input:
+ *   - display: character 'y'/'Y' if results are printed as they are found
+ * 
+ * Output:
+ *   - Returns the number of worker threads to use for a range job
+ * 
+ * Purpose:
+ *   Printed results must stay in order, so displayed runs use one worker;
+ *   hidden runs use every hardware thread
+ *******************************************************************************/
+unsigned int rangeThreadCount(const unsigned char display) {
+    if (display == 'y' || display == 'Y') return 1;
+    unsigned int threads = std::thread::hardware_concurrency();
+    return (threads == 0) ? 1 : threads;
+}
+
+/*******************************************************************************
+ * Segmented Sieve of Eratosthenes
+ * 
+ * Task 2 sieves each executor segment instead of testing numbers one by one.
+ * A segment keeps one bit per odd number (1 = prime), so counting is a
+ * popcount over 64-bit words and listing walks the set bits in order. The
+ * base primes up to sqrt(n2) are sieved once per job and shared read-only by
+ * every worker.
+ *******************************************************************************/
+const unsigned long long MAX_SIEVE_SEGMENT = 1ULL << 24;  // 1 MB of bits per segment
+
+struct SieveSegment {
+    unsigned long long lo;                 // Inclusive range covered
+    unsigned long long hi;
+    unsigned long long firstOdd;           // Number represented by bit 0
+    unsigned long long step;               // Distance between the numbers of adjacent bits
+    unsigned long long bitCount;           // Numbers in the segment with a bit
+    bool includesTwo;                      // 2 is prime but has no bit
+    std::vector<unsigned long long> bits;  // Bit i set if firstOdd + step * i is prime
+};
+
+/*******************************************************************************
+ * Function: integerSqrt
+ * 
+ * Input:
+ *   - n: any 64-bit value
+ * 
+ * Output:
+ *   - Returns floor(sqrt(n)) exactly
+ * 
+ * Purpose:
+ *   sqrt() on a double can be off by one above 2^52
+ *******************************************************************************/
+unsigned long long integerSqrt(const unsigned long long n) {
+    unsigned long long r = (unsigned long long) sqrt((double) n);
+    while (r > 0 && (r > 0xFFFFFFFFULL || r * r > n)) r--;
+    while (r < 0xFFFFFFFFULL && (r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+/*******************************************************************************
+ * Function: sieveBasePrimes
+ * 
+ * Input:
+ *   - limit: largest value to sieve (at most 2^32 - 1)
+ * 
+ * Output:
+ *   - Returns every odd prime <= limit in increasing order
+ * 
+ * Purpose:
+ *   Simple odd-only sieve for the primes that cross off segment multiples
+ *******************************************************************************/
+std::vector<unsigned int> sieveBasePrimes(const unsigned long long limit) {
+    TraceScope trace("pre-sieve", limit);
+    std::vector<unsigned int> primes;
+    if (limit < 3) return primes;
+
+    // composite[i] describes the odd number 2i + 1
+    std::vector<bool> composite(limit / 2 + 1, false);
+    for (unsigned long long i = 1; (2 * i + 1) * (2 * i + 1) <= limit; i++) {
+        if (composite[i]) continue;
+        unsigned long long p = 2 * i + 1;
+        for (unsigned long long j = (p * p) / 2; j <= limit / 2; j += p) {
+            composite[j] = true;
+        }
+    }
+    for (unsigned long long i = 1; 2 * i + 1 <= limit; i++) {
+        if (!composite[i]) primes.push_back((unsigned int) (2 * i + 1));
+    }
+    return primes;
+}
+
+/*******************************************************************************
+ * Function: sieveSegmentSize
+ * 
+ * Input:
+ *   - end: largest number the job will sieve
+ * 
+ * Output:
+ *   - Returns the executor segment size for a sieve job
+ * 
+ * Purpose:
+ *   Every base prime costs a division per segment, so segments grow with
+ *   sqrt(end) until they stop fitting in cache
+ *******************************************************************************/
+unsigned long long sieveSegmentSize(const unsigned long long end) {
+    unsigned long long root = integerSqrt(end);
+    unsigned long long size = SEGMENT_SIZE;
+    while (size < MAX_SIEVE_SEGMENT && size / 16 < root) size <<= 1;
+    return size;
+}
+
+/*******************************************************************************
+ * Function: prepareSegment
+ * 
+ * Input:
+ *   - lo, hi: inclusive range the segment will cover
+ *   - fill: initial value of every bit word (~0 = all marked, 0 = none)
+ *   - segment: receives the range fields and a filled bitmap
+ * 
+ * Purpose:
+ *   Common setup for the sieve engines; bits past bitCount are left clear
+ *******************************************************************************/
+void prepareSegment(const unsigned long long lo, const unsigned long long hi, const unsigned long long fill,
+                    SieveSegment &segment) {
+    segment.lo = lo;
+    segment.hi = hi;
+    segment.includesTwo = (lo <= 2 && hi >= 2);
+    segment.firstOdd = (lo < 3) ? 3 : (lo | 1);
+    segment.step = 2;
+    segment.bitCount = (segment.firstOdd > hi) ? 0 : (hi - segment.firstOdd) / 2 + 1;
+
+    unsigned long long words = (segment.bitCount + 63) / 64;
+    segment.bits.assign(words, fill);
+    if (segment.bitCount % 64 != 0) {
+        segment.bits[words - 1] &= (1ULL << (segment.bitCount % 64)) - 1;
+    }
+}
+
+/*******************************************************************************
+ * Function: sieveSegment
+ * 
+ * Input:
+ *   - basePrimes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive range to sieve
+ *   - segment: receives the prime bitmap for [lo, hi]
+ * 
+ * Purpose:
+ *   Marks every odd number in the range, then runs the crossOff kernel to
+ *   clear the odd multiples of each base prime
+ *******************************************************************************/
+void sieveSegment(const std::vector<unsigned int> &basePrimes, const unsigned long long lo, const unsigned long long hi,
+                  SieveSegment &segment) {
+    TraceScope trace("sieve segment", lo);
+    prepareSegment(lo, hi, ~0ULL, segment);
+    kernels.crossOff(segment.bits.data(), segment.bitCount, segment.firstOdd, hi, basePrimes.data(), basePrimes.size());
+}
+
+/*******************************************************************************
+ * Function: countSegmentPrimes
+ * 
+ * Input:
+ *   - segment: a sieved segment
+ * 
+ * Output:
+ *   - Returns the number of primes in the segment's range
+ * 
+ * Purpose:
+ *   Counts set bits with the popcount kernel
+ *******************************************************************************/
+unsigned long long countSegmentPrimes(const SieveSegment &segment) {
+    TraceScope trace("count segment", segment.lo);
+    unsigned long long total = segment.includesTwo ? 1 : 0;
+    return total + kernels.popcount(segment.bits.data(), segment.bits.size());
+}
+
+/*******************************************************************************
+ * Function: forEachSegmentPrime
+ * 
+ * Input:
+ *   - segment: a sieved segment
+ *   - visit: called with each prime in increasing order
+ * 
+ * Purpose:
+ *   Walks the set bits of a segment for callers that list the primes
+ *******************************************************************************/
+template <typename Visitor>
+void forEachSegmentPrime(const SieveSegment &segment, Visitor visit) {
+    TraceScope trace("visit segment", segment.lo);
+    if (segment.includesTwo) visit(2ULL);
+    for (unsigned long long w = 0; w < segment.bits.size(); w++) {
+        unsigned long long word = segment.bits[w];
+        while (word != 0) {
+            unsigned long long bit = w * 64 + (unsigned long long) __builtin_ctzll(word);
+            visit(segment.firstOdd + segment.step * bit);
+            word &= word - 1;
+        }
+    }
+}
+
+/*******************************************************************************
+ * Segmented Sieve of Atkin
+ * 
+ * Fills the same odd-only bitmap as sieveSegment, so counting and listing
+ * are shared. Bits start clear. An odd n coprime to 3 is toggled once for
+ * each solution of the quadratic form its residue mod 12 selects:
+ *   n = 1, 5 (mod 12): 4x^2 + y^2 = n
+ *   n = 7 (mod 12):    3x^2 + y^2 = n
+ *   n = 11 (mod 12):   3x^2 - y^2 = n with x > y
+ * A squarefree n ends up set exactly when it is prime. Clearing the
+ * multiples of p^2 for each base prime p >= 5 removes the rest. Every x
+ * contributes to each segment, so a segment costs O(sqrt(hi)) loop heads
+ * plus about one candidate per number. Segments stop growing at
+ * MAX_SIEVE_SEGMENT, so above ATKIN_LIMIT the loop heads outnumber a whole
+ * segment's candidates (near 2^64 a segment takes minutes) and jobs there
+ * fall back to Eratosthenes.
+ *******************************************************************************/
+const unsigned char ATKIN_FORM[12] = {0, 1, 0, 0, 0, 1, 0, 2, 0, 0, 0, 3};  // Deciding form by n mod 12
+
+/*******************************************************************************
+ * Function: ceilSqrt
+ * 
+ * Input:
+ *   - n: any 64-bit value
+ * 
+ * Output:
+ *   - Returns the smallest r with r * r >= n
+ *******************************************************************************/
+unsigned long long ceilSqrt(const unsigned long long n) {
+    unsigned long long r = integerSqrt(n);
+    return (r * r < n) ? r + 1 : r;
+}
+
+/*******************************************************************************
+ * Function: sieveAtkinSegment
+ * 
+ * Input:
+ *   - basePrimes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive range to sieve
+ *   - segment: receives the prime bitmap for [lo, hi]
+ * 
+ * Purpose:
+ *   Atkin counterpart of sieveSegment
+ *******************************************************************************/
+void sieveAtkinSegment(const std::vector<unsigned int> &basePrimes, const unsigned long long lo,
+                       const unsigned long long hi, SieveSegment &segment) {
+    TraceScope trace("atkin segment", lo);
+    prepareSegment(lo, hi, 0, segment);
+    if (segment.bitCount == 0) return;
+
+    unsigned long long *bits = segment.bits.data();
+    unsigned long long firstOdd = segment.firstOdd;
+    auto toggle = [bits, firstOdd](unsigned long long n, unsigned char form) {
+        if (ATKIN_FORM[n % 12] != form) return;
+        unsigned long long i = (n - firstOdd) >> 1;
+        bits[i >> 6] ^= 1ULL << (i & 63);
+    };
+
+    // 4x^2 + y^2, y odd
+    for (unsigned long long x = 1, xMax = integerSqrt((hi - 1) / 4); x <= xMax; x++) {
+        unsigned long long base = 4 * x * x;
+        unsigned long long y = (lo > base + 1) ? ceilSqrt(lo - base) : 1;
+        unsigned long long yMax = integerSqrt(hi - base);
+        for (y |= 1; y <= yMax; y += 2) toggle(base + y * y, 1);
+    }
+
+    // 3x^2 + y^2, x + y odd
+    for (unsigned long long x = 1, xMax = integerSqrt((hi - 1) / 3); x <= xMax; x++) {
+        unsigned long long base = 3 * x * x;
+        unsigned long long y = (lo > base + 1) ? ceilSqrt(lo - base) : 1;
+        unsigned long long yMax = integerSqrt(hi - base);
+        if (((x + y) & 1) == 0) y++;
+        for (; y <= yMax; y += 2) toggle(base + y * y, 2);
+    }
+
+    // 3x^2 - y^2, x > y >= 1, x + y odd; 3x^2 can pass 2^64 near the top of the range
+    unsigned long long x = integerSqrt(lo / 3);
+    if (x < 2) x = 2;
+    for (; (uint128) 2 * x * x + 2 * x - 1 <= hi; x++) {
+        uint128 base = (uint128) 3 * x * x;
+        if (base <= lo) continue;
+        unsigned long long y = (base > hi) ? ceilSqrt((unsigned long long) (base - hi)) : 1;
+        unsigned long long yMax = (base - lo >= (uint128) x * x) ? x - 1 : integerSqrt((unsigned long long) (base - lo));
+        if (yMax > x - 1) yMax = x - 1;
+        if (((x + y) & 1) == 0) y++;
+        for (; y <= yMax; y += 2) toggle((unsigned long long) (base - (uint128) y * y), 3);
+    }
+
+    // Clear the odd multiples of p^2, which the forms cannot tell from primes
+    for (unsigned int p : basePrimes) {
+        if (p < 5) continue;
+        unsigned long long square = (unsigned long long) p * p;
+        if (square > hi) break;
+
+        unsigned long long remainder = firstOdd % square;
+        if (remainder != 0 && square - remainder > hi - firstOdd) continue;
+        unsigned long long m = (remainder == 0) ? firstOdd : firstOdd + (square - remainder);
+        if ((m & 1) == 0) {
+            if (square > hi - m) continue;
+            m += square;
+        }
+        while (true) {
+            unsigned long long i = (m - firstOdd) >> 1;
+            bits[i >> 6] &= ~(1ULL << (i & 63));
+            if ((hi - m) / 2 < square) break;
+            m += 2 * square;
+        }
+    }
+
+    // 3 is the one prime no form reaches
+    if (lo <= 3 && hi >= 3) bits[0] |= 1;
+}
+
+/*******************************************************************************
+ * Sieve Engines
+ * 
+ * Task 2 counts through whichever engine --engine selects. Both engines
+ * fill the same SieveSegment, so they can be swapped per run and compared
+ * by --benchmark.
+ *******************************************************************************/
+struct SieveEngine {
+    const char *name;
+    void (*sieve)(const std::vector<unsigned int> &basePrimes, const unsigned long long lo,
+                  const unsigned long long hi, SieveSegment &segment);
+};
+
+const SieveEngine SIEVE_ENGINES[] = {
+    {"eratosthenes", sieveSegment},
+    {"atkin", sieveAtkinSegment},
+};
+const unsigned int SIEVE_ENGINE_COUNT = sizeof(SIEVE_ENGINES) / sizeof(SIEVE_ENGINES[0]);
+
+static const SieveEngine *sieveEngine = &SIEVE_ENGINES[0];
+const unsigned long long ATKIN_LIMIT = 1ULL << 48;  // sqrt(2^48) = MAX_SIEVE_SEGMENT loop heads
+
+/*******************************************************************************
+ * Function: configureSieveEngine
+ * 
+ * Output:
+ *   - Selects the engine named by --engine (Eratosthenes by default)
+ *   - Returns 0 if --engine names an unknown engine
+ *******************************************************************************/
+int configureSieveEngine(void) {
+    if (options.engineName == NULL) return 1;
+    for (unsigned int i = 0; i < SIEVE_ENGINE_COUNT; i++) {
+        if (strcmp(options.engineName, SIEVE_ENGINES[i].name) == 0) {
+            sieveEngine = &SIEVE_ENGINES[i];
+            return 1;
+        }
+    }
+    printf("Unknown engine: %s (expected eratosthenes or atkin)\n", options.engineName);
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: sieveEngineFor
+ * 
+ * Input:
+ *   - end: largest number the job will sieve
+ * 
+ * Output:
+ *   - Returns the engine --engine selected, or Eratosthenes (saying so) for
+ *     an Atkin job past ATKIN_LIMIT
+ *******************************************************************************/
+const SieveEngine *sieveEngineFor(const unsigned long long end) {
+    if (sieveEngine->sieve != sieveAtkinSegment || end <= ATKIN_LIMIT) return sieveEngine;
+
+    printf("The Atkin sieve is impractical past 2^48; sieving this range with eratosthenes.\n");
+    return &SIEVE_ENGINES[0];
+}
+
+/*******************************************************************************
+ * Shared Prime Table
+ * 
+ * One process-wide list of the odd primes up to a limit. It serves Task 1's
+ * trial division, the sieve base primes of Tasks 2 and 4, and Task 3's
+ * trial division and k-almost-prime count. Later queries in the session
+ * reuse the earlier work.
+ * 
+ * The list is published as immutable snapshots, read-copy-update style.
+ * Readers pin the current snapshot without taking a lock: they record the
+ * global epoch in their thread's slot and load the snapshot pointer. A
+ * query that needs primes past the limit builds a larger copy, extended by
+ * whole PRIME_TABLE_SEGMENT blocks, and swaps it in with one atomic store.
+ * Only writers take primeTableWriterLock. The replaced snapshot is retired
+ * with the epoch it was replaced in. It is freed once every pinned reader
+ * has recorded a later epoch, since such a reader can only have loaded a
+ * newer pointer. Growth at least doubles the limit, so the copies cost
+ * about as much as the extension itself.
+ *******************************************************************************/
+const unsigned long long PRIME_TABLE_SEGMENT = 1ULL << 18;
+const unsigned long long PRIME_TABLE_MAX = 1ULL << 32;  // Entries are 32-bit; enough for sqrt(2^64)
+const unsigned int MAX_TABLE_READERS = 256;            // Threads that can pin at once without a fallback
+
+struct PrimeTableSnapshot {
+    unsigned long long limit;          // Every odd prime <= limit is listed
+    std::vector<unsigned int> primes;  // Odd primes in increasing order
+};
+
+struct RetiredPrimeTable {
+    const PrimeTableSnapshot *snapshot;
+    unsigned long long epoch;  // Epoch in which it stopped being current
+};
+
+static std::atomic<const PrimeTableSnapshot *> primeTableCurrent(NULL);
+static std::atomic<unsigned long long> primeTableEpoch(1);
+static std::atomic<unsigned long long> primeTableReaderEpochs[MAX_TABLE_READERS];  // 0 = not pinned
+static std::atomic<bool> primeTableSlotTaken[MAX_TABLE_READERS];
+static std::atomic<unsigned int> primeTableOverflowReaders(0);  // Pinned readers without a slot
+static std::mutex primeTableWriterLock;
+static std::vector<RetiredPrimeTable> primeTableRetired;       // Guarded by primeTableWriterLock
+static std::thread primeTableBuilder;                          // Background extension, if any
+static std::atomic<bool> primeTableBuilding(false);            // primeTableBuilder has not finished
+static std::once_flag primeTableBuilderRegistered;             // waitForPrimeTableBuilder is set to run at exit
+
+// The calling thread's reader slot and how many pins it holds
+struct PrimeTableSlot {
+    int index;  // -1 until claimed, -2 if every slot was taken
+    unsigned int depth;
+
+    ~PrimeTableSlot() {
+        if (index >= 0) {
+            primeTableReaderEpochs[index].store(0);
+            primeTableSlotTaken[index].store(false);
+        }
+    }
+};
+
+static thread_local PrimeTableSlot primeTableSlot = {-1, 0};
+
+/*******************************************************************************
+ * Function: reclaimPrimeTables
+ * 
+ * Purpose:
+ *   Frees retired snapshots no pinned reader can still hold. Called by
+ *   writers, under primeTableWriterLock.
+ *******************************************************************************/
+void reclaimPrimeTables(void) {
+    if (primeTableOverflowReaders.load() != 0) return;
+
+    unsigned long long oldest = ULLONG_MAX;
+    for (unsigned int i = 0; i < MAX_TABLE_READERS; i++) {
+        unsigned long long epoch = primeTableReaderEpochs[i].load();
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < primeTableRetired.size(); i++) {
+        if (primeTableRetired[i].epoch < oldest) {
+            delete primeTableRetired[i].snapshot;
+        } else {
+            primeTableRetired[kept++] = primeTableRetired[i];
+        }
+    }
+    primeTableRetired.resize(kept);
+}
+
+/*******************************************************************************
+ * Function: growPrimeTable
+ * 
+ * Input:
+ *   - limit: largest number whose odd prime divisors will be needed
+ * 
+ * Output:
+ *   - Publishes a snapshot covering limit, unless the current one already does
+ * 
+ * Purpose:
+ *   Writer side of the table. Readers keep using the old snapshot while the
+ *   new one is sieved.
+ *******************************************************************************/
+void growPrimeTable(const unsigned long long limit) {
+    std::lock_guard<std::mutex> guard(primeTableWriterLock);
+    const PrimeTableSnapshot *current = primeTableCurrent.load();
+    if (current != NULL && limit <= current->limit) return;
+
+    // Whole segments, at least doubling; each needs primes up to sqrt(hi),
+    // which are already listed
+    unsigned long long target = (limit + PRIME_TABLE_SEGMENT - 1) / PRIME_TABLE_SEGMENT * PRIME_TABLE_SEGMENT;
+    if (current != NULL && target < 2 * current->limit) target = 2 * current->limit;
+    if (target > PRIME_TABLE_MAX) target = PRIME_TABLE_MAX;
+    TraceScope trace("grow prime table", target);
+    PerfPhaseScope phase("base primes", target - ((current != NULL) ? current->limit : 0));
+
+    PrimeTableSnapshot *next = new PrimeTableSnapshot;
+    if (current == NULL) {
+        next->primes = sieveBasePrimes(PRIME_TABLE_SEGMENT);
+        next->limit = PRIME_TABLE_SEGMENT;
+    } else {
+        next->primes = current->primes;
+        next->limit = current->limit;
+    }
+    while (next->limit < target) {
+        unsigned long long lo = next->limit + 1;
+        unsigned long long hi = next->limit + PRIME_TABLE_SEGMENT;
+        if (hi > target) hi = target;
+
+        SieveSegment segment;
+        sieveSegment(next->primes, lo, hi, segment);
+        forEachSegmentPrime(segment, [next](unsigned long long prime) { next->primes.push_back((unsigned int) prime); });
+        next->limit = hi;
+    }
+
+    // Publish, then open a new epoch: readers that record it see next or later
+    primeTableCurrent.store(next);
+    unsigned long long epoch = primeTableEpoch.fetch_add(1);
+    if (current != NULL) primeTableRetired.push_back({current, epoch});
+    reclaimPrimeTables();
+}
+
+/*******************************************************************************
+ * Function: pinPrimeTable
+ * 
+ * Input:
+ *   - limit: largest number whose odd prime divisors the caller will need
+ *     (at most 2^32)
+ * 
+ * Output:
+ *   - Returns the list of a snapshot holding at least every odd prime
+ *     <= limit (it may hold more), valid until the matching unpinPrimeTable
+ * 
+ * Purpose:
+ *   Reader side of the table: lock-free unless the table must grow first.
+ *   Pins nest within a thread.
+ *******************************************************************************/
+const std::vector<unsigned int> &pinPrimeTable(const unsigned long long limit) {
+    PrimeTableSlot &slot = primeTableSlot;
+    if (slot.depth++ == 0) {
+        if (slot.index == -1) {
+            slot.index = -2;
+            for (unsigned int i = 0; i < MAX_TABLE_READERS; i++) {
+                bool expected = false;
+                if (primeTableSlotTaken[i].compare_exchange_strong(expected, true)) {
+                    slot.index = (int) i;
+                    break;
+                }
+            }
+        }
+        if (slot.index >= 0) {
+            primeTableReaderEpochs[slot.index].store(primeTableEpoch.load());
+        } else {
+            primeTableOverflowReaders.fetch_add(1);  // Holds off all reclamation instead
+        }
+    }
+
+    const PrimeTableSnapshot *snapshot = primeTableCurrent.load();
+    if (snapshot == NULL || snapshot->limit < limit) {
+        growPrimeTable(limit);
+        snapshot = primeTableCurrent.load();  // Still protected: our epoch predates its retirement
+    }
+    return snapshot->primes;
+}
+
+/*******************************************************************************
+ * Function: unpinPrimeTable
+ * 
+ * Purpose:
+ *   Releases the calling thread's most recent pinPrimeTable
+ *******************************************************************************/
+void unpinPrimeTable(void) {
+    PrimeTableSlot &slot = primeTableSlot;
+    if (--slot.depth != 0) return;
+    if (slot.index >= 0) {
+        primeTableReaderEpochs[slot.index].store(0);
+    } else {
+        primeTableOverflowReaders.fetch_sub(1);
+    }
+}
+
+/*******************************************************************************
+ * Function: PrimeTableReader
+ * 
+ * Input:
+ *   - limit: largest number whose odd prime divisors the caller will need
+ * 
+ * Purpose:
+ *   Pins the table for the lifetime of the object; primes stays valid
+ *   until it is destroyed
+ *******************************************************************************/
+struct PrimeTableReader {
+    const std::vector<unsigned int> &primes;
+
+    PrimeTableReader(const unsigned long long limit) : primes(pinPrimeTable(limit)) {}
+    ~PrimeTableReader() { unpinPrimeTable(); }
+};
+
+/*******************************************************************************
+ * Function: cachedPrimeLimit
+ * 
+ * Output:
+ *   - Returns a bound below which the current snapshot lists every prime
+ *     (its largest prime), without growing the table
+ * 
+ * Purpose:
+ *   Lets the query planner use the table for free when it already covers
+ *   a query
+ *******************************************************************************/
+unsigned long long cachedPrimeLimit(void) {
+    const std::vector<unsigned int> &primes = pinPrimeTable(0);
+    unsigned long long limit = primes.empty() ? 2 : primes.back();
+    unpinPrimeTable();
+    return limit;
+}
+
+/*******************************************************************************
+ * Function: isCachedPrime
+ * 
+ * Input:
+ *   - n: number no larger than cachedPrimeLimit()
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, by binary search in the table
+ *******************************************************************************/
+int isCachedPrime(const unsigned long long n) {
+    if (n == 2) return 1;
+    if (n < 3 || n % 2 == 0) return 0;
+    PrimeTableReader table(n);
+    return std::binary_search(table.primes.begin(), table.primes.end(), (unsigned int) n) ? 1 : 0;
+}
+
+/*******************************************************************************
+ * Function: countCachedPrimes
+ * 
+ * Input:
+ *   - start, end: range within cachedPrimeLimit()
+ *   - showResults: print each prime
+ * 
+ * Output:
+ *   - Returns the number of primes in [start, end], read from the table
+ *******************************************************************************/
+unsigned long long countCachedPrimes(const unsigned long long start, const unsigned long long end,
+                                     const bool showResults) {
+    PerfPhaseScope phase("table lookup", 0);
+    PrimeTableReader table(end);
+    std::vector<unsigned int>::const_iterator first =
+        std::lower_bound(table.primes.begin(), table.primes.end(), (unsigned int) ((start < 3) ? 3 : start));
+    std::vector<unsigned int>::const_iterator last =
+        std::upper_bound(table.primes.begin(), table.primes.end(), (unsigned int) end);
+    bool includesTwo = (start <= 2 && end >= 2);
+
+    if (showResults) {
+        if (includesTwo) printf("2\n");
+        for (std::vector<unsigned int>::const_iterator p = first; p < last; ++p) printf("%u\n", *p);
+    }
+    return (unsigned long long) (last - first) + (includesTwo ? 1 : 0);
+}
+
+/*******************************************************************************
+ * Function: waitForPrimeTableBuilder
+ * 
+ * Purpose:
+ *   Joins the background extension, if one was started. Registered with
+ *   atexit by prefetchPrimeTable, which also calls it to reclaim a builder
+ *   that has already finished.
+ *******************************************************************************/
+void waitForPrimeTableBuilder(void) {
+    if (primeTableBuilder.joinable()) primeTableBuilder.join();
+}
+
+/*******************************************************************************
+ * Function: prefetchPrimeTable
+ * 
+ * Input:
+ *   - limit: largest number a later query is expected to need
+ * 
+ * Purpose:
+ *   Extends the table on a background thread, so the next query finds it
+ *   ready. Lookups keep using the current snapshot meanwhile. A prefetch
+ *   made while the builder is still running is dropped rather than waited
+ *   for: a query that needs more than the builder publishes grows the
+ *   table itself.
+ *******************************************************************************/
+void prefetchPrimeTable(const unsigned long long limit) {
+    if (limit <= cachedPrimeLimit()) return;
+
+    std::call_once(primeTableBuilderRegistered, [] { atexit(waitForPrimeTableBuilder); });
+    bool idle = false;
+    if (!primeTableBuilding.compare_exchange_strong(idle, true)) return;
+    waitForPrimeTableBuilder();  // The previous builder has finished; this only reclaims it
+    primeTableBuilder = std::thread([limit] {
+        growPrimeTable(limit);
+        primeTableBuilding.store(false);
+    });
+}
+
+/*******************************************************************************
+ * Memory Budget
+ * 
+ * --mem-limit caps what a query may allocate. Before a job starts its engine
+ * estimates the memory it needs:
+ *   - sieves: base primes, plus one segment bitset per worker thread
+ *   - Lucy tables: two arrays of about sqrt(n) entries
+ *   - batch factorization: the SPF table and one chunk of results
+ * Sieve jobs first shrink their segments, then their thread count. The
+ * combinatorial Task 3 count falls back to per-number factoring, and batch
+ * runs shrink the SPF table and chunk. A query that still cannot fit is
+ * refused with a message (reported like a cancelled run) instead of
+ * running into the OOM killer. Peak resident memory is printed at exit.
+ *******************************************************************************/
+
+/*******************************************************************************
+ * Function: memoryLimit
+ * 
+ * Output:
+ *   - Returns the --mem-limit budget in bytes (ULLONG_MAX without a limit)
+ *******************************************************************************/
+unsigned long long memoryLimit(void) {
+    return (options.memLimit == 0) ? ULLONG_MAX : options.memLimit;
+}
+
+/*******************************************************************************
+ * Function: fitsMemory
+ * 
+ * Input:
+ *   - bytes: estimated memory a step needs
+ *   - what: name of the step for the message
+ * 
+ * Output:
+ *   - Returns 1 if the step fits the budget
+ *   - Otherwise prints why, stops the current run as over the limit and
+ *     returns 0
+ *******************************************************************************/
+int fitsMemory(const unsigned long long bytes, const char *what) {
+    if (bytes <= memoryLimit()) return 1;
+
+    printf("%s needs about %llu MiB, over the --mem-limit of %llu MiB.\n", what, (bytes >> 20) + 1,
+           options.memLimit >> 20);
+    stopRun(RUN_OVER_MEMORY);
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: basePrimeBytes
+ * 
+ * Input:
+ *   - limit: bound passed to sieveBasePrimes
+ * 
+ * Output:
+ *   - Returns the peak memory sieveBasePrimes(limit) uses: its odd-only
+ *     bit array plus the returned primes (pi(x) < 1.26 x / ln x)
+ *******************************************************************************/
+unsigned long long basePrimeBytes(const unsigned long long limit) {
+    if (limit < 3) return 0;
+    double primes = 1.26 * (double) limit / log((double) limit);
+    return limit / 16 + (unsigned long long) (primes * sizeof(unsigned int));
+}
+
+/*******************************************************************************
+ * Function: lucyTableBytes
+ * 
+ * Input:
+ *   - n: bound of the table
+ *   - valueSize: bytes per entry (8 for counts, 16 for sums)
+ * 
+ * Output:
+ *   - Returns the memory buildLucyTable(n) needs
+ *******************************************************************************/
+unsigned long long lucyTableBytes(const unsigned long long n, const unsigned long long valueSize) {
+    return 2 * (integerSqrt(n) + 1) * valueSize;
+}
+
+/*******************************************************************************
+ * Function: fitRangeJob
+ * 
+ * Input:
+ *   - fixedBytes: memory shared by the whole job
+ *   - bytesPerNumber: memory each worker needs per number in its segment
+ *   - minSegment: smallest segment the engine accepts
+ *   - segmentSize, threadCount: the engine's preferred values
+ * 
+ * Output:
+ *   - Shrinks segmentSize (down to minSegment) and then threadCount (down to
+ *     1) until the job fits the budget
+ *   - Returns 0 (after fitsMemory's message) if even that does not fit
+ *******************************************************************************/
+int fitRangeJob(const unsigned long long fixedBytes, const double bytesPerNumber, const unsigned long long minSegment,
+                unsigned long long &segmentSize, unsigned int &threadCount) {
+    unsigned long long limit = memoryLimit();
+    if (limit == ULLONG_MAX) return 1;
+
+    while (segmentSize > minSegment
+           && fixedBytes + threadCount * (unsigned long long) (segmentSize * bytesPerNumber) > limit) {
+        segmentSize >>= 1;
+    }
+    while (threadCount > 1 && fixedBytes + threadCount * (unsigned long long) (segmentSize * bytesPerNumber) > limit) {
+        threadCount--;
+    }
+    return fitsMemory(fixedBytes + threadCount * (unsigned long long) (segmentSize * bytesPerNumber), "This range");
+}
+
+/*******************************************************************************
+ * Function: peakMemoryUsage
+ * 
+ * Output:
+ *   - Returns the process's peak resident set size in bytes (0 if unknown)
+ *******************************************************************************/
+unsigned long long peakMemoryUsage(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return (unsigned long long) counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (unsigned long long) usage.ru_maxrss;  // Already bytes on macOS
+#else
+    return (unsigned long long) usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/*******************************************************************************
+ * Function: reportPeakMemory
+ * 
+ * Output:
+ *   - Prints the peak resident set size next to the --mem-limit budget
+ * 
+ * Purpose:
+ *   Registered with atexit when --mem-limit is given
+ *******************************************************************************/
+void reportPeakMemory(void) {
+    fprintf(stderr, "Peak memory: %.1f MiB (limit %.1f MiB)\n", peakMemoryUsage() / 1048576.0,
+            options.memLimit / 1048576.0);
+}
+
+/*******************************************************************************
+ * Primes in a Residue Class
+ * 
+ * With --residue=A,Q, Task 2 only counts and lists the primes p = A (mod Q).
+ * Every prime of the class but 2 is odd. The odd members form one
+ * progression first + k * step, where step is Q for even Q and 2Q for odd
+ * Q. A class segment keeps one bit per member, so a range needs 1/Q of
+ * the odd-only sieve's bits and crossing-off work. An odd base prime p not
+ * dividing step divides exactly the members whose k falls in one residue
+ * class mod p. That root is computed once per job with a modular inverse,
+ * and each segment then steps through the bitmap p bits at a time. If
+ * gcd(A, Q) > 1, the class holds at most one prime and is not sieved.
+ *******************************************************************************/
+const unsigned int NO_ROOT = UINT_MAX;  // Base prime divides step, so no member
+
+struct ResidueClass {
+    unsigned long long residue;       // A mod Q
+    unsigned long long modulus;       // Q
+    unsigned long long first;         // Smallest odd member
+    unsigned long long step;          // Distance between odd members
+    std::vector<unsigned int> roots;  // roots[i]: k mod basePrimes[i] of the members it divides
+};
+
+/*******************************************************************************
+ * Function: classOnlyPrime
+ * 
+ * Input:
+ *   - residue, modulus: the class A mod Q (A < Q)
+ * 
+ * Output:
+ *   - Returns 1 if gcd(A, Q) = 1, so the class holds infinitely many primes
+ *   - Otherwise returns 0 and sets *prime to its only prime, or 0 if none
+ * 
+ * Purpose:
+ *   A common factor g of A and Q divides every member, so the only member
+ *   that can be prime is g itself
+ *******************************************************************************/
+int classOnlyPrime(const unsigned long long residue, const unsigned long long modulus, unsigned long long *prime) {
+    unsigned long long g = modulus, r = residue;
+    while (r != 0) {
+        unsigned long long t = g % r;
+        g = r;
+        r = t;
+    }
+    if (g == 1) return 1;
+
+    *prime = 0;
+    if (g % modulus == residue && isPrime64(g)) *prime = g;
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: setupResidueClass
+ * 
+ * Input:
+ *   - residue, modulus: the class A mod Q, with gcd(A, Q) = 1
+ *   - basePrimes: odd primes up to sqrt of the range end
+ *   - cls: receives the progression and one root per base prime
+ *******************************************************************************/
+void setupResidueClass(const unsigned long long residue, const unsigned long long modulus,
+                       const std::vector<unsigned int> &basePrimes, ResidueClass &cls) {
+    cls.residue = residue;
+    cls.modulus = modulus;
+    cls.step = (modulus % 2 == 0) ? modulus : 2 * modulus;
+    cls.first = (residue % 2 == 1) ? residue : residue + modulus;  // An even residue needs an odd modulus here
+
+    cls.roots.resize(basePrimes.size());
+    for (size_t i = 0; i < basePrimes.size(); i++) {
+        long long p = basePrimes[i];
+        long long s = (long long) (cls.step % (unsigned long long) p);
+        if (s == 0) {
+            cls.roots[i] = NO_ROOT;
+            continue;
+        }
+
+        // Extended Euclid for s^-1 mod p; first + k * step = 0 (mod p)
+        long long oldR = s, r = p, oldX = 1, x = 0;
+        while (r != 0) {
+            long long q = oldR / r, t;
+            t = oldR - q * r; oldR = r; r = t;
+            t = oldX - q * x; oldX = x; x = t;
+        }
+        unsigned long long inverse = (unsigned long long) ((oldX % p + p) % p);
+        unsigned long long minusFirst = (unsigned long long) ((p - (long long) (cls.first % p)) % p);
+        cls.roots[i] = (unsigned int) (minusFirst * inverse % (unsigned long long) p);
+    }
+}
+
+/*******************************************************************************
+ * Function: sieveClassSegment
+ * 
+ * Input:
+ *   - cls: the residue class, set up for basePrimes
+ *   - basePrimes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive range to sieve
+ *   - segment: receives the prime bitmap of the class members in [lo, hi]
+ * 
+ * Purpose:
+ *   Residue-class counterpart of sieveSegment; bit i stands for
+ *   segment.firstOdd + i * cls.step
+ *******************************************************************************/
+void sieveClassSegment(const ResidueClass &cls, const std::vector<unsigned int> &basePrimes,
+                       const unsigned long long lo, const unsigned long long hi, SieveSegment &segment) {
+    TraceScope trace("class segment", lo);
+    segment.lo = lo;
+    segment.hi = hi;
+    segment.step = cls.step;
+    segment.includesTwo = (cls.modulus % 2 == 1 && 2 % cls.modulus == cls.residue && lo <= 2 && hi >= 2);
+
+    // Members first + k * step for k in [kFirst, kLast]
+    unsigned long long kFirst = (lo <= cls.first) ? 0 : (lo - cls.first + cls.step - 1) / cls.step;
+    unsigned long long kLast = (hi < cls.first) ? 0 : (hi - cls.first) / cls.step;
+    segment.bitCount = (hi < cls.first || kFirst > kLast) ? 0 : kLast - kFirst + 1;
+    segment.firstOdd = cls.first + kFirst * cls.step;
+
+    unsigned long long words = (segment.bitCount + 63) / 64;
+    segment.bits.assign(words, ~0ULL);
+    if (segment.bitCount % 64 != 0) {
+        segment.bits[words - 1] = (1ULL << (segment.bitCount % 64)) - 1;
+    }
+    if (segment.bitCount == 0) return;
+    if (segment.firstOdd == 1) segment.bits[0] &= ~1ULL;  // 1 is not prime
+
+    unsigned long long *bits = segment.bits.data();
+    for (size_t i = 0; i < basePrimes.size(); i++) {
+        unsigned long long p = basePrimes[i];
+        if (p * p > hi) break;
+        if (cls.roots[i] == NO_ROOT) continue;
+
+        // First k >= kFirst on the root whose member is at least p^2 (p itself stays)
+        unsigned long long kStart = kFirst;
+        if (p * p > segment.firstOdd) kStart = (p * p - cls.first + cls.step - 1) / cls.step;
+        unsigned long long k = kStart + (cls.roots[i] + p - kStart % p) % p;
+        for (unsigned long long bit = k - kFirst; bit < segment.bitCount; bit += p) {
+            bits[bit >> 6] &= ~(1ULL << (bit & 63));
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: sieveJobSegment
+ * 
+ * Input:
+ *   - engine: engine for unrestricted jobs, from sieveEngineFor
+ *   - cls: residue class to restrict to, or NULL for every prime
+ *   - basePrimes, lo, hi, segment: as for sieveSegment
+ * 
+ * Purpose:
+ *   The sieve step shared by Task 2's count, display and text output
+ *******************************************************************************/
+inline void sieveJobSegment(const SieveEngine *engine, const ResidueClass *cls,
+                            const std::vector<unsigned int> &basePrimes, const unsigned long long lo,
+                            const unsigned long long hi, SieveSegment &segment) {
+    if (cls == NULL) {
+        engine->sieve(basePrimes, lo, hi, segment);
+    } else {
+        sieveClassSegment(*cls, basePrimes, lo, hi, segment);
+    }
+}
+
+/*******************************************************************************
+ * Function: fitSieveJob
+ * 
+ * Input:
+ *   - start, end: range of a Task 2 job
+ *   - segmentSize, threadCount: receive the executor settings
+ * 
+ * Output:
+ *   - Sets segmentSize for the sieve in use and fits the job to --mem-limit
+ *   - Returns 0 (after fitsMemory's message) if it does not fit
+ * 
+ * Purpose:
+ *   A class segment holds one bit per member rather than per odd number, so
+ *   its segments cover step / 2 times as many numbers for the same bitmap.
+ *   The roots take as much room as the base primes they belong to.
+ *******************************************************************************/
+int fitSieveJob(const unsigned long long start, const unsigned long long end, unsigned long long &segmentSize,
+                unsigned int &threadCount) {
+    unsigned long long root = integerSqrt(end);
+    segmentSize = sieveSegmentSize(end);
+    if (options.residueModulus == 0) {
+        return fitRangeJob(basePrimeBytes(root), 1.0 / 16, SEGMENT_SIZE, segmentSize, threadCount);
+    }
+
+    unsigned long long step = (options.residueModulus % 2 == 0) ? options.residueModulus : 2 * options.residueModulus;
+    unsigned long long width = end - start;
+    segmentSize = (segmentSize > width / (step / 2)) ? width + 1 : segmentSize * (step / 2);
+    if (segmentSize == 0) segmentSize = width;  // The whole 64-bit range
+    return fitRangeJob(2 * basePrimeBytes(root), 1.0 / (8.0 * step), SEGMENT_SIZE, segmentSize, threadCount);
+}
+
+/*******************************************************************************
+ * Function: countPrimes
+ * 
+ * Input:
+ *   - n1, n2: unsigned 64-bit integers defining the range to search
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ *   - resumable: false to skip the checkpoint file, for chunks served to a
+ *     coordinator that tracks progress itself
+ * 
+ * Output:
+ *   - Returns total count of primes found
+ *   - If display='y', prints each prime number found
+ * 
+ * Purpose:
+ *   Core function that finds all prime numbers within a given range and
+ *   optionally displays them, sieving with the --engine selection (or only
+ *   the --residue class when one is given)
+ *******************************************************************************/
+unsigned long long countPrimes(const unsigned long long n1, const unsigned long long n2, const unsigned char display,
+                               const bool resumable) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    bool showResults = (display == 'y' || display == 'Y');
+    bool restricted = (options.residueModulus != 0);
+
+    unsigned long long onlyPrime;
+    if (restricted && !classOnlyPrime(options.residueClass, options.residueModulus, &onlyPrime)) {
+        if (onlyPrime == 0 || onlyPrime < start || onlyPrime > end) return 0;
+        if (showResults) printf("%llu\n", onlyPrime);
+        return 1;
+    }
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize;
+    unsigned int threadCount = rangeThreadCount(display);
+    if (!fitSieveJob(start, end, segmentSize, threadCount)) return 0;
+
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &basePrimes = table.primes;
+    ResidueClass cls;
+    if (restricted) setupResidueClass(options.residueClass, options.residueModulus, basePrimes, cls);
+    const ResidueClass *classFilter = restricted ? &cls : NULL;
+    const SieveEngine *engine = restricted ? sieveEngine : sieveEngineFor(end);
+
+    // Each segment is sieved whole; Ctrl-C is checked between segments
+    SegmentKernel kernel = [&basePrimes, engine, classFilter, showResults](unsigned long long lo,
+                                                                           unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        SieveSegment segment;
+        sieveJobSegment(engine, classFilter, basePrimes, lo, hi, segment);
+        if (showResults) {
+            forEachSegmentPrime(segment, [](unsigned long long prime) { printf("%llu\n", prime); });
+        }
+        return countSegmentPrimes(segment);
+    };
+
+    // A restricted count checkpoints separately from the full count of the same range
+    unsigned long long parameter = restricted ? (options.residueModulus << 32) | options.residueClass : 0;
+    CheckpointKey key = {TASK2, start, end, parameter, (unsigned char) (showResults ? 'y' : 'n')};
+    return runRangeJob(start, end, segmentSize, threadCount, kernel, !showResults, resumable ? &key : NULL);
+}
+
+/*******************************************************************************
+ * Prime Constellations
+ * 
+ * With --tuple=0,O1,...,Ok, Task 2 counts and lists the n in its range for
+ * which n, n + O1, ..., n + Ok are all prime: 0,2 for twin primes, 0,2,6
+ * and 0,4,6 for triplets, and so on. The primes up to 13 form a wheel of
+ * 30030 numbers. Only the residues r where no member n + Oi is divisible by
+ * a wheel prime can start a constellation above 13. For twins that is 1485
+ * residues in 30030. Each residue's candidates 30030 j + r get one bit per
+ * j. For a sieve prime p and offset Oi, the j that put a member on a
+ * multiple of p form one class mod p, found with the wheel's inverse mod p.
+ * Finding that first j costs the same for every residue and segment, so
+ * segments grow with the sieve limit, up to a 32 KB bitmap per residue, but
+ * only while the range still splits into TUPLE_SEGMENTS_PER_THREAD segments
+ * per worker. The sieve stops at TUPLE_SIEVE_LIMIT,
+ * which covers every range below 2^40. Above that, each survivor's members
+ * are confirmed with isPrime64.
+ * Segments run in parallel like any other Task 2 range. An inadmissible
+ * pattern (one that covers every residue of some prime, like 0,2,4) leaves
+ * no wheel residues. Its few solutions are all at most 13, where every
+ * start is tested directly.
+ *******************************************************************************/
+const unsigned int TUPLE_WHEEL = 2 * 3 * 5 * 7 * 11 * 13;
+const unsigned int TUPLE_WHEEL_PRIMES[] = {2, 3, 5, 7, 11, 13};
+const unsigned int TUPLE_LARGEST_WHEEL_PRIME = 13;
+const unsigned long long TUPLE_SEGMENT_WHEELS = 1 << 13;      // Smallest bits per residue in a segment
+const unsigned long long TUPLE_SEGMENTS_PER_THREAD = 4;       // Fewest segments per worker before growing
+const unsigned long long MAX_TUPLE_SEGMENT_WHEELS = 1 << 18;  // 32 KB bitmap per residue
+const unsigned long long TUPLE_SIEVE_LIMIT = 1 << 20;
+
+struct TupleWheel {
+    std::vector<unsigned int> residues;          // Wheel positions that can start a constellation
+    std::vector<unsigned int> sievePrimes;       // Primes above the wheel up to the sieve limit
+    std::vector<unsigned int> wheelInverse;      // wheelInverse[i]: TUPLE_WHEEL^-1 mod sievePrimes[i]
+    std::vector<unsigned long long> reciprocal;  // reciprocal[i]: 2^64 / sievePrimes[i], rounded up
+    unsigned long long sieveLimit;
+};
+
+/*******************************************************************************
+ * Function: setupTupleWheel
+ * 
+ * Input:
+ *   - basePrimes: odd primes up to the sieve limit
+ *   - sieveLimit: largest prime to sieve with
+ *   - wheel: receives the admissible residues and the sieve primes
+ *******************************************************************************/
+void setupTupleWheel(const std::vector<unsigned int> &basePrimes, const unsigned long long sieveLimit,
+                     TupleWheel &wheel) {
+    wheel.sieveLimit = sieveLimit;
+    for (unsigned int r = 0; r < TUPLE_WHEEL; r++) {
+        bool admissible = true;
+        for (unsigned int w = 0; w < sizeof(TUPLE_WHEEL_PRIMES) / sizeof(TUPLE_WHEEL_PRIMES[0]) && admissible; w++) {
+            for (unsigned int i = 0; i < options.tupleSize; i++) {
+                if ((r + options.tupleOffsets[i]) % TUPLE_WHEEL_PRIMES[w] == 0) {
+                    admissible = false;
+                    break;
+                }
+            }
+        }
+        if (admissible) wheel.residues.push_back(r);
+    }
+
+    for (size_t i = 0; i < basePrimes.size() && basePrimes[i] <= sieveLimit; i++) {
+        unsigned int p = basePrimes[i];
+        if (p <= TUPLE_LARGEST_WHEEL_PRIME) continue;
+
+        // p is prime, so the inverse is M^(p-2) mod p
+        unsigned long long inverse = 1, base = TUPLE_WHEEL % p;
+        for (unsigned int e = p - 2; e != 0; e >>= 1) {
+            if (e & 1) inverse = inverse * base % p;
+            base = base * base % p;
+        }
+        wheel.sievePrimes.push_back(p);
+        wheel.wheelInverse.push_back((unsigned int) inverse);
+        wheel.reciprocal.push_back(ULLONG_MAX / p + 1);
+    }
+}
+
+/*******************************************************************************
+ * Function: reduceSmall
+ * 
+ * Input:
+ *   - a: value below 2^40
+ *   - p: sieve prime below 2^20
+ *   - reciprocal: 2^64 / p, rounded up
+ * 
+ * Output:
+ *   - Returns a mod p
+ * 
+ * Purpose:
+ *   The constellation sieve finds a start per residue, prime and member in
+ *   every segment; a multiply by the reciprocal replaces the divisions. The
+ *   quotient's error is below a * 2^-64, too small to cross an integer
+ *   when a / p is at least 1 / p away from the next one.
+ *******************************************************************************/
+inline unsigned long long reduceSmall(const unsigned long long a, const unsigned long long p,
+                                      const unsigned long long reciprocal) {
+    unsigned long long quotient = (unsigned long long) (((uint128) a * reciprocal) >> 64);
+    return a - quotient * p;
+}
+
+/*******************************************************************************
+ * Function: isTupleStart
+ * 
+ * Input:
+ *   - n: candidate first member
+ * 
+ * Output:
+ *   - Returns 1 if every member of the --tuple pattern at n is prime
+ *******************************************************************************/
+int isTupleStart(const unsigned long long n) {
+    for (unsigned int i = 0; i < options.tupleSize; i++) {
+        if (!isPrime64(n + options.tupleOffsets[i])) return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: findSegmentTuples
+ * 
+ * Input:
+ *   - wheel: set up for the job
+ *   - lo, hi: inclusive range of first members
+ *   - starts: receives the first member of every constellation, in
+ *     increasing order
+ * 
+ * Purpose:
+ *   Segment kernel of the constellation search; see the section comment
+ *******************************************************************************/
+void findSegmentTuples(const TupleWheel &wheel, const unsigned long long lo, const unsigned long long hi,
+                       std::vector<unsigned long long> &starts) {
+    TraceScope trace("tuple segment", lo);
+    starts.clear();
+    for (unsigned long long n = lo; n <= hi && n <= TUPLE_LARGEST_WHEEL_PRIME; n++) {
+        if (isTupleStart(n)) starts.push_back(n);
+    }
+    if (hi <= TUPLE_LARGEST_WHEEL_PRIME) return;
+
+    unsigned long long from = (lo > TUPLE_LARGEST_WHEEL_PRIME) ? lo : TUPLE_LARGEST_WHEEL_PRIME + 1;
+    unsigned long long span = options.tupleOffsets[options.tupleSize - 1];
+    bool complete = wheel.sieveLimit >= integerSqrt(hi + span);  // Survivors are then prime
+    unsigned long long jFirst = from / TUPLE_WHEEL;
+    unsigned long long bitCount = hi / TUPLE_WHEEL - jFirst + 1;
+    size_t firstWheelStart = starts.size();
+
+    // Wheel base of the segment plus each member's offset, mod each sieve prime
+    std::vector<unsigned int> baseMod(wheel.sievePrimes.size() * options.tupleSize);
+    for (size_t i = 0; i < wheel.sievePrimes.size(); i++) {
+        for (unsigned int k = 0; k < options.tupleSize; k++) {
+            unsigned long long member = jFirst * TUPLE_WHEEL + options.tupleOffsets[k];
+            baseMod[i * options.tupleSize + k] = (unsigned int) (member % wheel.sievePrimes[i]);
+        }
+    }
+
+    std::vector<unsigned long long> bits((bitCount + 63) / 64);
+    for (size_t w = 0; w < wheel.residues.size(); w++) {
+        unsigned long long r = wheel.residues[w];
+        std::fill(bits.begin(), bits.end(), ~0ULL);
+
+        for (size_t i = 0; i < wheel.sievePrimes.size(); i++) {
+            unsigned long long p = wheel.sievePrimes[i];
+            unsigned long long reciprocal = wheel.reciprocal[i];
+            for (unsigned int k = 0; k < options.tupleSize; k++) {
+                // Member value at bit b: TUPLE_WHEEL * (jFirst + b) + r + offset
+                unsigned long long member = r + options.tupleOffsets[k];
+                unsigned long long residue = reduceSmall(baseMod[i * options.tupleSize + k] + r, p, reciprocal);
+                unsigned long long b = reduceSmall((p - residue) * wheel.wheelInverse[i], p, reciprocal);
+                // A member equal to p is prime, not a multiple
+                if (jFirst * TUPLE_WHEEL <= p && TUPLE_WHEEL * (jFirst + b) + member == p) b += p;
+                for (; b < bitCount; b += p) bits[b >> 6] &= ~(1ULL << (b & 63));
+            }
+        }
+
+        for (unsigned long long word = 0; word < bits.size(); word++) {
+            unsigned long long set = bits[word];
+            while (set != 0) {
+                unsigned long long b = word * 64 + (unsigned long long) __builtin_ctzll(set);
+                set &= set - 1;
+                if (b >= bitCount) break;
+                unsigned long long n = TUPLE_WHEEL * (jFirst + b) + r;
+                if (n < from || n > hi) continue;
+                if (complete || isTupleStart(n)) starts.push_back(n);
+            }
+        }
+    }
+    std::sort(starts.begin() + firstWheelStart, starts.end());
+}
+
+/*******************************************************************************
+ * Function: tupleCheckpointParameter
+ * 
+ * Output:
+ *   - Returns a checkpoint key parameter identifying the --tuple pattern
+ *     (FNV-1a over its offsets)
+ *******************************************************************************/
+unsigned long long tupleCheckpointParameter(void) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned int i = 0; i < options.tupleSize; i++) {
+        hash = (hash ^ options.tupleOffsets[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*******************************************************************************
+ * Function: countPrimeTuples
+ * 
+ * Input:
+ *   - n1, n2: range of first members
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns the number of n in the range starting a --tuple constellation
+ *   - If display='y', prints the members of each one
+ * 
+ * Purpose:
+ *   The countPrimes of --tuple runs
+ *******************************************************************************/
+unsigned long long countPrimeTuples(const unsigned long long n1, const unsigned long long n2,
+                                    const unsigned char display) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    bool showResults = (display == 'y' || display == 'Y');
+
+    // Every member has to fit in 64 bits
+    unsigned long long span = options.tupleOffsets[options.tupleSize - 1];
+    if (end > ULLONG_MAX - span) end = ULLONG_MAX - span;
+    if (start > end) return 0;
+
+    unsigned long long sieveLimit = integerSqrt(end + span);
+    if (sieveLimit > TUPLE_SIEVE_LIMIT) sieveLimit = TUPLE_SIEVE_LIMIT;
+    // Each sieve prime costs one start per residue and segment, so segments grow with it, but
+    // not past TUPLE_SEGMENTS_PER_THREAD segments per worker, or the last ones would run alone
+    unsigned int threadCount = rangeThreadCount(display);
+    unsigned long long spread = ((end - start) / TUPLE_WHEEL + 1) / (TUPLE_SEGMENTS_PER_THREAD * threadCount);
+    unsigned long long wheels = TUPLE_SEGMENT_WHEELS;
+    while (wheels < sieveLimit && wheels < MAX_TUPLE_SEGMENT_WHEELS && 2 * wheels <= spread) wheels <<= 1;
+    unsigned long long segmentSize = TUPLE_WHEEL * wheels;
+
+    if (!fitRangeJob(basePrimeBytes(sieveLimit) + TUPLE_WHEEL * sizeof(unsigned int), 1.0 / (8.0 * TUPLE_WHEEL),
+                     TUPLE_WHEEL, segmentSize, threadCount)) {
+        return 0;
+    }
+
+    PrimeTableReader table(sieveLimit);
+    TupleWheel wheel;
+    setupTupleWheel(table.primes, sieveLimit, wheel);
+
+    SegmentKernel kernel = [&wheel, showResults](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        std::vector<unsigned long long> starts;
+        findSegmentTuples(wheel, lo, hi, starts);
+        if (showResults) {
+            for (size_t s = 0; s < starts.size(); s++) {
+                printf("%llu", starts[s]);
+                for (unsigned int i = 1; i < options.tupleSize; i++) {
+                    printf(", %llu", starts[s] + options.tupleOffsets[i]);
+                }
+                printf("\n");
+            }
+        }
+        return (unsigned long long) starts.size();
+    };
+
+    CheckpointKey key = {TASK2, start, end, tupleCheckpointParameter(), (unsigned char) (showResults ? 'y' : 'n')};
+    return runRangeJob(start, end, segmentSize, threadCount, kernel, !showResults, &key);
+}
+
+/*******************************************************************************
+ * Function: runEngineBenchmark
+ * 
+ * Output:
+ *   - Counts the primes in each benchmark range with every sieve engine and
+ *     prints the times side by side, with hardware counters when
+ *     --perf-counters is on
+ *   - Returns 0 if the engines agree on every range, 1 otherwise
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --benchmark" runs (the "benchmark" build target)
+ *******************************************************************************/
+int runEngineBenchmark(void) {
+    // Prefix ranges of growing size, then windows of the same width at growing heights
+    const unsigned long long ranges[][2] = {
+        {1, 1000000ULL},
+        {1, 10000000ULL},
+        {1, 100000000ULL},
+        {1, 1000000000ULL},
+        {1000000000000ULL, 1000100000000ULL},
+        {1000000000000000ULL, 1000000100000000ULL},
+    };
+    const unsigned int rangeCount = sizeof(ranges) / sizeof(ranges[0]);
+    unsigned int threadCount = rangeThreadCount('n');
+    int mismatches = 0;
+
+    // Any "counters unavailable" message goes above the table, not inside a row
+    PerfCounters probe;
+    startPerfCounters(probe);
+    stopPerfCounters(probe);
+
+    printf("Sieve engine benchmark: %u thread%s\n\n", threadCount, (threadCount == 1) ? "" : "s");
+    printf("%-44s", "Range");
+    for (unsigned int e = 0; e < SIEVE_ENGINE_COUNT; e++) printf(" %14s", SIEVE_ENGINES[e].name);
+    printf(" %12s\n", "primes");
+
+    for (unsigned int r = 0; r < rangeCount; r++) {
+        unsigned long long start = ranges[r][0];
+        unsigned long long end = ranges[r][1];
+        char label[64];
+        snprintf(label, sizeof(label), "[%llu, %llu]", start, end);
+        printf("%-44s", label);
+        fflush(stdout);
+
+        unsigned long long root = integerSqrt(end);
+        PrimeTableReader table(root);
+        const std::vector<unsigned int> &basePrimes = table.primes;
+        unsigned long long expected = 0;
+        std::vector<PerfCounters> counters(SIEVE_ENGINE_COUNT);
+
+        for (unsigned int e = 0; e < SIEVE_ENGINE_COUNT; e++) {
+            const SieveEngine *engine = &SIEVE_ENGINES[e];
+            unsigned long long segmentSize = sieveSegmentSize(end);
+            unsigned int threads = threadCount;
+            RunScope run;
+            if (!fitRangeJob(basePrimeBytes(root), 1.0 / 16, SEGMENT_SIZE, segmentSize, threads)) return 1;
+
+            SegmentKernel kernel = [&basePrimes, engine](unsigned long long lo, unsigned long long hi) {
+                if (isCancelRequested()) return 0ULL;
+
+                SieveSegment segment;
+                engine->sieve(basePrimes, lo, hi, segment);
+                return countSegmentPrimes(segment);
+            };
+
+            auto begin = std::chrono::steady_clock::now();
+            startPerfCounters(counters[e]);
+            unsigned long long total = runRangeJob(start, end, segmentSize, threads, kernel, false, NULL);
+            stopPerfCounters(counters[e]);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            if (isCancelRequested()) return 1;
+
+            if (e == 0) expected = total;
+            if (total != expected) mismatches++;
+            printf(" %13.3fs", elapsed.count());
+            fflush(stdout);
+        }
+        printf(" %12llu\n", expected);
+
+        for (unsigned int e = 0; e < SIEVE_ENGINE_COUNT; e++) {
+            reportPerfCounters(counters[e], SIEVE_ENGINES[e].name, 0);
+        }
+    }
+
+    if (mismatches != 0) {
+        printf("\nThe engines disagreed on %d count%s.\n", mismatches, (mismatches == 1) ? "" : "s");
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Memory-Mapped Files
+ *******************************************************************************/
+struct MappedFile {
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+struct MappedOutput {
+    unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+/*******************************************************************************
+ * Function: mapFile
+ * 
+ * Input:
+ *   - path: file to map
+ *   - mapped: receives the read-only mapping
+ * 
+ * Output:
+ *   - Returns 1 on success, 0 if the file cannot be opened or mapped
+ * 
+ * Purpose:
+ *   Maps a whole file read-only (MapViewOfFile on Windows, mmap elsewhere)
+ *******************************************************************************/
+int mapFile(const char *path, MappedFile &mapped) {
+    mapped.data = NULL;
+    mapped.size = 0;
+#ifdef _WIN32
+    mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE) return 0;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped.file, &size) || size.QuadPart == 0) {
+        CloseHandle(mapped.file);
+        return 0;
+    }
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping == NULL) {
+        CloseHandle(mapped.file);
+        return 0;
+    }
+    mapped.data = (const unsigned char *) MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapped.data == NULL) {
+        CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        return 0;
+    }
+    mapped.size = (size_t) size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file alive
+    if (data == MAP_FAILED) return 0;
+
+    mapped.data = (const unsigned char *) data;
+    mapped.size = (size_t) info.st_size;
+#endif
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: unmapFile
+ * 
+ * Input:
+ *   - mapped: a mapping made by mapFile
+ * 
+ * Purpose:
+ *   Releases the mapping
+ *******************************************************************************/
+void unmapFile(MappedFile &mapped) {
+    if (mapped.data == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+    CloseHandle(mapped.mapping);
+    CloseHandle(mapped.file);
+#else
+    munmap((void *) mapped.data, mapped.size);
+#endif
+    mapped.data = NULL;
+    mapped.size = 0;
+}
+
+/*******************************************************************************
+ * Function: createMappedOutput
+ * 
+ * Input:
+ *   - path: file to create (replaced if it exists)
+ *   - size: bytes to reserve (at least 1)
+ *   - mapped: receives the writable mapping
+ * 
+ * Output:
+ *   - Returns 1 on success, 0 if the file cannot be created or mapped
+ * 
+ * Purpose:
+ *   Sizes a new file and maps it read-write, so threads can fill it at
+ *   offsets of their own while the OS writes pages back in the background.
+ *   On file systems with sparse files, unwritten space costs nothing.
+ *******************************************************************************/
+int createMappedOutput(const char *path, const unsigned long long size, MappedOutput &mapped) {
+    mapped.data = NULL;
+    mapped.size = 0;
+#ifdef _WIN32
+    mapped.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE) return 0;
+
+    mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READWRITE, (DWORD) (size >> 32), (DWORD) size, NULL);
+    if (mapped.mapping == NULL) {
+        CloseHandle(mapped.file);
+        return 0;
+    }
+    mapped.data = (unsigned char *) MapViewOfFile(mapped.mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (mapped.data == NULL) {
+        CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        return 0;
+    }
+#else
+    mapped.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mapped.fd < 0) return 0;
+
+    void *data = MAP_FAILED;
+    if (ftruncate(mapped.fd, (off_t) size) == 0) {
+        data = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, mapped.fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        close(mapped.fd);
+        unlink(path);
+        return 0;
+    }
+    mapped.data = (unsigned char *) data;
+#endif
+    mapped.size = (size_t) size;
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: closeMappedOutput
+ * 
+ * Input:
+ *   - mapped: a mapping made by createMappedOutput
+ *   - length: bytes actually written, from the start of the file
+ * 
+ * Output:
+ *   - Unmaps the file and cuts it to length
+ *   - Returns 1 on success, 0 if the file could not be finished
+ *******************************************************************************/
+int closeMappedOutput(MappedOutput &mapped, const unsigned long long length) {
+    int ok = 1;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+    CloseHandle(mapped.mapping);
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG) length;
+    ok = SetFilePointerEx(mapped.file, end, NULL, FILE_BEGIN) && SetEndOfFile(mapped.file);
+    ok = CloseHandle(mapped.file) && ok;
+#else
+    ok = munmap(mapped.data, mapped.size) == 0;
+    ok = (ftruncate(mapped.fd, (off_t) length) == 0) && ok;
+    ok = (close(mapped.fd) == 0) && ok;
+#endif
+    mapped.data = NULL;
+    mapped.size = 0;
+    return ok;
+}
+
+/*******************************************************************************
+ * Binary Prime Lists
+ * 
+ * Task 2 can save its primes to a compact binary file instead of printing
+ * them. All integers are little-endian:
+ * 
+ *   Header (64 bytes)
+ *     0  "L05PRIME"          magic
+ *     8  u32 version         PRIME_LIST_VERSION
+ *     12 u32 blockPrimes     primes per block (the last block may hold fewer)
+ *     16 u64 rangeLo         range that was sieved, inclusive
+ *     24 u64 rangeHi
+ *     32 u64 primeCount
+ *     40 u64 blockCount
+ *     48 u64 indexOffset     file offset of the block index
+ *     56 u64 reserved        0
+ *   Blocks, starting at offset 64
+ *     The first prime of a block is kept in the index. Each later prime is
+ *     the gap from the previous one as a varint (7 bits per byte, low bits
+ *     first, high bit set on all but the last byte) of gap/2; the single odd
+ *     gap, 2 -> 3, is stored as 0.
+ *   Index: blockCount entries of {u64 firstPrime, u64 blockOffset}
+ * 
+ * Gaps below 256 take one byte, so a list costs about a byte per prime. The
+ * index is sorted by firstPrime, so a reader that maps the file can binary
+ * search it and decode a single block to reach any value.
+ *******************************************************************************/
+const char PRIME_LIST_MAGIC[8] = {'L', '0', '5', 'P', 'R', 'I', 'M', 'E'};
+const unsigned int PRIME_LIST_VERSION = 1;
+const unsigned int PRIME_LIST_HEADER_SIZE = 64;
+const unsigned int PRIME_LIST_BLOCK_PRIMES = 16384;
+
+struct PrimeListWriter {
+    FILE *file;
+    unsigned long long offset;             // Bytes written so far
+    unsigned long long count;              // Primes written so far
+    unsigned long long previous;           // Last prime written
+    std::vector<unsigned long long> index; // firstPrime, blockOffset pairs
+    std::vector<unsigned char> block;      // Encoded gaps of the current block
+};
+
+struct PrimeListReader {
+    MappedFile mapped;
+    unsigned int blockPrimes;
+    unsigned long long rangeLo;
+    unsigned long long rangeHi;
+    unsigned long long primeCount;
+    unsigned long long blockCount;
+    const unsigned char *index;     // Also where the last block's gaps end
+};
+
+// Position inside a prime list, produced by seekPrimeList
+struct PrimeListCursor {
+    const PrimeListReader *reader;
+    unsigned long long block;      // Block holding the next prime
+    unsigned long long remaining;  // Primes left in that block, including the next one
+    const unsigned char *data;     // Next gap to decode
+    const unsigned char *end;      // End of the block's gaps
+    unsigned long long next;       // Next prime to return
+    bool damaged;                  // A gap ran past its block or overflowed
+};
+
+/*******************************************************************************
+ * Function: storeLE64 / loadLE64 / storeLE32 / loadLE32
+ * 
+ * Purpose:
+ *   Fixed little-endian byte order for the binary file formats, whatever the
+ *   host byte order
+ *******************************************************************************/
+void storeLE64(unsigned char *out, unsigned long long value) {
+    for (int i = 0; i < 8; i++) out[i] = (unsigned char) (value >> (8 * i));
+}
+
+unsigned long long loadLE64(const unsigned char *in) {
+    unsigned long long value = 0;
+    for (int i = 7; i >= 0; i--) value = (value << 8) | in[i];
+    return value;
+}
+
+void storeLE32(unsigned char *out, unsigned int value) {
+    for (int i = 0; i < 4; i++) out[i] = (unsigned char) (value >> (8 * i));
+}
+
+unsigned int loadLE32(const unsigned char *in) {
+    return (unsigned int) in[0] | ((unsigned int) in[1] << 8) | ((unsigned int) in[2] << 16) | ((unsigned int) in[3] << 24);
+}
+
+/*******************************************************************************
+ * Function: openPrimeListWriter
+ * 
+ * Input:
+ *   - path: file to create
+ *   - writer: receives the open writer
+ * 
+ * Output:
+ *   - Returns 1 on success, 0 if the file cannot be created
+ * 
+ * Purpose:
+ *   Reserves room for the header, which is filled in by closePrimeListWriter
+ *******************************************************************************/
+int openPrimeListWriter(const char *path, PrimeListWriter &writer) {
+    writer.file = fopen(path, "wb");
+    if (writer.file == NULL) return 0;
+    setvbuf(writer.file, NULL, _IOFBF, 1 << 20);
+
+    unsigned char header[PRIME_LIST_HEADER_SIZE] = {0};
+    fwrite(header, 1, sizeof(header), writer.file);
+    writer.offset = PRIME_LIST_HEADER_SIZE;
+    writer.count = 0;
+    writer.previous = 0;
+    writer.index.clear();
+    writer.block.clear();
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: flushPrimeListBlock
+ * 
+ * Input:
+ *   - writer: an open writer
+ * 
+ * Purpose:
+ *   Writes the encoded gaps of the current block to the file
+ *******************************************************************************/
+void flushPrimeListBlock(PrimeListWriter &writer) {
+    TraceScope trace("output flush", writer.block.size());
+    fwrite(writer.block.data(), 1, writer.block.size(), writer.file);
+    writer.offset += writer.block.size();
+    writer.block.clear();
+}
+
+/*******************************************************************************
+ * Function: appendPrime
+ * 
+ * Input:
+ *   - writer: an open writer
+ *   - prime: next prime, larger than every prime appended before it
+ * 
+ * Purpose:
+ *   Starts a new block every PRIME_LIST_BLOCK_PRIMES primes and otherwise
+ *   appends the varint-coded gap
+ *******************************************************************************/
+void appendPrime(PrimeListWriter &writer, const unsigned long long prime) {
+    if (writer.count % PRIME_LIST_BLOCK_PRIMES == 0) {
+        flushPrimeListBlock(writer);
+        writer.index.push_back(prime);
+        writer.index.push_back(writer.offset);
+    } else {
+        unsigned long long gap = prime - writer.previous;
+        unsigned long long code = (gap == 1) ? 0 : gap / 2;
+        while (code >= 0x80) {
+            writer.block.push_back((unsigned char) (code | 0x80));
+            code >>= 7;
+        }
+        writer.block.push_back((unsigned char) code);
+    }
+    writer.previous = prime;
+    writer.count++;
+}
+
+/*******************************************************************************
+ * Function: closePrimeListWriter
+ * 
+ * Input:
+ *   - writer: an open writer
+ *   - rangeLo, rangeHi: range the primes were taken from
+ * 
+ * Output:
+ *   - Returns 1 if the file was completed without write errors
+ * 
+ * Purpose:
+ *   Writes the last block, the block index and the header
+ *******************************************************************************/
+int closePrimeListWriter(PrimeListWriter &writer, const unsigned long long rangeLo, const unsigned long long rangeHi) {
+    flushPrimeListBlock(writer);
+
+    unsigned long long indexOffset = writer.offset;
+    unsigned char entry[8];
+    for (unsigned long long value : writer.index) {
+        storeLE64(entry, value);
+        fwrite(entry, 1, sizeof(entry), writer.file);
+    }
+
+    unsigned char header[PRIME_LIST_HEADER_SIZE] = {0};
+    memcpy(header, PRIME_LIST_MAGIC, sizeof(PRIME_LIST_MAGIC));
+    storeLE32(header + 8, PRIME_LIST_VERSION);
+    storeLE32(header + 12, PRIME_LIST_BLOCK_PRIMES);
+    storeLE64(header + 16, rangeLo);
+    storeLE64(header + 24, rangeHi);
+    storeLE64(header + 32, writer.count);
+    storeLE64(header + 40, writer.index.size() / 2);
+    storeLE64(header + 48, indexOffset);
+
+    int ok = fseek(writer.file, 0, SEEK_SET) == 0 && fwrite(header, 1, sizeof(header), writer.file) == sizeof(header);
+    ok = !ferror(writer.file) && ok;
+    ok = (fclose(writer.file) == 0) && ok;
+    writer.file = NULL;
+    return ok;
+}
+
+/*******************************************************************************
+ * Function: exportPrimesBinary
+ * 
+ * Input:
+ *   - n1, n2: range to search
+ *   - path: binary prime list to create
+ * 
+ * Output:
+ *   - Returns the number of primes written (partial if cancelled)
+ *   - Returns 0 and prints a message if the file cannot be written
+ * 
+ * Purpose:
+ *   The display='y' path of countPrimes, but writing the compact binary
+ *   format. Segments are sieved in order on one worker so the file can be
+ *   streamed; a cancelled run still leaves a valid file covering the
+ *   segments finished so far.
+ *******************************************************************************/
+unsigned long long exportPrimesBinary(const unsigned long long n1, const unsigned long long n2, const char *path) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize = sieveSegmentSize(end);
+    unsigned int threadCount = 1;
+    if (!fitRangeJob(basePrimeBytes(root), 1.0 / 16, SEGMENT_SIZE, segmentSize, threadCount)) return 0;
+
+    PrimeListWriter writer;
+    if (!openPrimeListWriter(path, writer)) {
+        printf("Could not create %s.\n", path);
+        return 0;
+    }
+
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &basePrimes = table.primes;
+    unsigned long long coveredTo = start - 1;  // Last number whose segment was written
+    const SieveEngine *engine = sieveEngineFor(end);
+
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        SieveSegment segment;
+        engine->sieve(basePrimes, lo, hi, segment);
+        forEachSegmentPrime(segment, [&writer](unsigned long long prime) { appendPrime(writer, prime); });
+        coveredTo = hi;
+        return countSegmentPrimes(segment);
+    };
+
+    // The file is rewritten from scratch on every run, so it is not checkpointed
+    unsigned long long total = runRangeJob(start, end, segmentSize, threadCount, kernel, true, NULL);
+
+    if (!closePrimeListWriter(writer, start, (coveredTo < start) ? start : coveredTo)) {
+        printf("Error while writing %s.\n", path);
+        return 0;
+    }
+    return total;
+}
+
+/*******************************************************************************
+ * Function: openPrimeList
+ * 
+ * Input:
+ *   - path: binary prime list to read
+ *   - reader: receives the mapped list
+ * 
+ * Output:
+ *   - Returns 1 if the file is a complete, well-formed prime list
+ * 
+ * Purpose:
+ *   Maps the file and checks its header and index against the file size.
+ *   Every block must start between the header and the index, after the
+ *   block before it, so a block's gaps end where the next block starts
+ *******************************************************************************/
+int openPrimeList(const char *path, PrimeListReader &reader) {
+    if (!mapFile(path, reader.mapped)) return 0;
+
+    const unsigned char *data = reader.mapped.data;
+    unsigned long long size = reader.mapped.size;
+    int ok = size >= PRIME_LIST_HEADER_SIZE
+             && memcmp(data, PRIME_LIST_MAGIC, sizeof(PRIME_LIST_MAGIC)) == 0
+             && loadLE32(data + 8) == PRIME_LIST_VERSION;
+    if (ok) {
+        reader.blockPrimes = loadLE32(data + 12);
+        reader.rangeLo = loadLE64(data + 16);
+        reader.rangeHi = loadLE64(data + 24);
+        reader.primeCount = loadLE64(data + 32);
+        reader.blockCount = loadLE64(data + 40);
+        unsigned long long indexOffset = loadLE64(data + 48);
+        reader.index = data + indexOffset;
+
+        // Every prime after the first of its block takes at least one byte
+        ok = reader.blockPrimes > 0
+             && indexOffset >= PRIME_LIST_HEADER_SIZE && indexOffset <= size
+             && reader.blockCount <= (size - indexOffset) / 16
+             && reader.primeCount - reader.blockCount <= indexOffset - PRIME_LIST_HEADER_SIZE
+             && reader.blockCount == reader.primeCount / reader.blockPrimes
+                                     + (reader.primeCount % reader.blockPrimes != 0);
+
+        unsigned long long previousOffset = PRIME_LIST_HEADER_SIZE, previousPrime = 0;
+        for (unsigned long long block = 0; ok && block < reader.blockCount; block++) {
+            unsigned long long firstPrime = loadLE64(reader.index + 16 * block);
+            unsigned long long blockOffset = loadLE64(reader.index + 16 * block + 8);
+            ok = blockOffset >= previousOffset && blockOffset <= indexOffset && firstPrime >= previousPrime;
+            previousOffset = blockOffset;
+            previousPrime = firstPrime;
+        }
+    }
+    if (!ok) unmapFile(reader.mapped);
+    return ok;
+}
+
+/*******************************************************************************
+ * Function: closePrimeList
+ * 
+ * Input:
+ *   - reader: a list opened by openPrimeList
+ * 
+ * Purpose:
+ *   Releases the mapping
+ *******************************************************************************/
+void closePrimeList(PrimeListReader &reader) {
+    unmapFile(reader.mapped);
+}
+
+/*******************************************************************************
+ * Function: startPrimeListBlock
+ * 
+ * Input:
+ *   - cursor: cursor to position
+ *   - block: block number (< blockCount)
+ * 
+ * Purpose:
+ *   Points the cursor at the first prime of a block. The offsets were
+ *   checked by openPrimeList
+ *******************************************************************************/
+void startPrimeListBlock(PrimeListCursor &cursor, const unsigned long long block) {
+    const PrimeListReader &reader = *cursor.reader;
+    cursor.block = block;
+    cursor.next = loadLE64(reader.index + 16 * block);
+    cursor.data = reader.mapped.data + loadLE64(reader.index + 16 * block + 8);
+    cursor.end = (block + 1 < reader.blockCount) ? reader.mapped.data + loadLE64(reader.index + 16 * block + 24)
+                                                 : reader.index;
+    cursor.remaining = (block + 1 < reader.blockCount) ? reader.blockPrimes
+                     : reader.primeCount - block * reader.blockPrimes;
+}
+
+/*******************************************************************************
+ * Function: nextListedPrime
+ * 
+ * Input:
+ *   - cursor: a positioned cursor
+ *   - prime: receives the next prime
+ * 
+ * Output:
+ *   - Returns 1 if a prime was read, 0 at the end of the list
+ *   - A gap that runs past its block or past 64 bits sets cursor.damaged
+ *     and ends the list after the last good prime
+ * 
+ * Purpose:
+ *   Returns primes in increasing order, decoding one gap per call
+ *******************************************************************************/
+int nextListedPrime(PrimeListCursor &cursor, unsigned long long *prime) {
+    if (cursor.damaged) return 0;
+    if (cursor.remaining == 0) {
+        if (cursor.block + 1 >= cursor.reader->blockCount) return 0;
+        startPrimeListBlock(cursor, cursor.block + 1);
+    }
+    *prime = cursor.next;
+    cursor.remaining--;
+
+    if (cursor.remaining > 0) {
+        unsigned long long code = 0;
+        unsigned int shift = 0;
+        unsigned char byte;
+        do {
+            if (cursor.data == cursor.end || shift >= 64) {
+                cursor.damaged = true;
+                return 1;
+            }
+            byte = *cursor.data++;
+            code |= (unsigned long long) (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (code > (ULLONG_MAX - cursor.next) / 2) {
+            cursor.damaged = true;
+            return 1;
+        }
+        cursor.next += (code == 0) ? 1 : 2 * code;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: seekPrimeList
+ * 
+ * Input:
+ *   - reader: an open list
+ *   - value: where to start
+ *   - cursor: receives the position of the first listed prime >= value
+ * 
+ * Output:
+ *   - Returns 1 if such a prime exists, 0 if value is past the last prime
+ * 
+ * Purpose:
+ *   Binary searches the block index, then decodes within a single block
+ *******************************************************************************/
+int seekPrimeList(const PrimeListReader &reader, const unsigned long long value, PrimeListCursor &cursor) {
+    cursor.reader = &reader;
+    cursor.damaged = false;
+    if (reader.blockCount == 0) return 0;
+
+    // Last block whose first prime is <= value
+    unsigned long long low = 0, high = reader.blockCount;
+    while (high - low > 1) {
+        unsigned long long middle = low + (high - low) / 2;
+        if (loadLE64(reader.index + 16 * middle) <= value) low = middle;
+        else high = middle;
+    }
+    startPrimeListBlock(cursor, low);
+
+    PrimeListCursor previous = cursor;
+    unsigned long long prime;
+    while (nextListedPrime(cursor, &prime)) {
+        if (prime >= value) {
+            cursor = previous;
+            return 1;
+        }
+        previous = cursor;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: runPrimeListReader
+ * 
+ * Output:
+ *   - Prints the header of the --read-primes file and the primes in the
+ *     --read-range interval (the whole list if no interval was given)
+ *   - Returns 0 on success, 1 if the file is not a valid prime list
+ * 
+ * Purpose:
+ *   Command line reader for files written by Task 2's binary output
+ *******************************************************************************/
+int runPrimeListReader(void) {
+    PrimeListReader reader;
+    if (!openPrimeList(options.primeListPath, reader)) {
+        printf("%s is not a valid prime list.\n", options.primeListPath);
+        return 1;
+    }
+
+    printf("# %llu primes between %llu and %llu in %llu blocks (%llu bytes)\n", reader.primeCount, reader.rangeLo,
+           reader.rangeHi, reader.blockCount, (unsigned long long) reader.mapped.size);
+
+    unsigned long long from = options.readRange ? options.readFrom : 0;
+    unsigned long long to = options.readRange ? options.readTo : ULLONG_MAX;
+    PrimeListCursor cursor;
+    unsigned long long prime;
+    if (seekPrimeList(reader, from, cursor)) {
+        while (nextListedPrime(cursor, &prime) && prime <= to) {
+            printf("%llu\n", prime);
+        }
+    }
+
+    closePrimeList(reader);
+    if (cursor.damaged) {
+        fprintf(stderr, "%s is damaged; the listing stopped early.\n", options.primeListPath);
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Text Prime Lists
+ * 
+ * Task 2 can also save its primes as text, one per line, without the
+ * single-worker limit of the display path. The output file is sized ahead
+ * from an upper bound on the prime count and mapped into memory. Every
+ * worker sieves its segment and works out exactly how many bytes its lines
+ * take. It then takes its offset from an ordered chain: segment k waits
+ * only until segment k - 1 has claimed its bytes, not until it has
+ * written them. Formatting into the mapping then runs in parallel, and the
+ * OS writes dirty pages back while later segments are still being sieved.
+ * At the end the file is cut to the bytes actually used.
+ *******************************************************************************/
+
+/*******************************************************************************
+ * Function: decimalDigits
+ * 
+ * Input:
+ *   - n: any 64-bit number
+ * 
+ * Output:
+ *   - Returns the number of decimal digits in n (1 for 0)
+ *******************************************************************************/
+unsigned int decimalDigits(unsigned long long n) {
+    unsigned int digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+/*******************************************************************************
+ * Function: primeCountUpperBound
+ * 
+ * Input:
+ *   - lo, hi: inclusive range
+ * 
+ * Output:
+ *   - Returns a number no smaller than the count of primes in [lo, hi]
+ * 
+ * Purpose:
+ *   Sizes text output ahead of time. Takes the smallest of three bounds:
+ *   odd numbers only; Dusart's pi(x) <= x/ln x (1 + 1.2762/ln x) minus
+ *   pi(x) >= x/ln x (x >= 17); and Montgomery-Vaughan's
+ *   pi(x + y) - pi(x) <= 2y/ln y, which is the tight one for short windows.
+ *******************************************************************************/
+unsigned long long primeCountUpperBound(const unsigned long long lo, const unsigned long long hi) {
+    unsigned long long width = hi - lo + 1;
+    unsigned long long bound = width / 2 + 2;
+
+    if (hi >= 17) {
+        long double x = (long double) hi;
+        long double upper = x / logl(x) * (1.0L + 1.2762L / logl(x));
+        long double lower = 0;
+        if (lo > 17) {
+            long double y = (long double) (lo - 1);
+            lower = y / logl(y);
+        }
+        long double dusart = upper - lower + 2;  // +2 absorbs rounding
+        if (dusart < (long double) bound) bound = (unsigned long long) dusart;
+    }
+    if (width >= 3) {
+        long double y = (long double) width;
+        long double shortInterval = 2 * y / logl(y) + 2;
+        if (shortInterval < (long double) bound) bound = (unsigned long long) shortInterval;
+    }
+    return bound;
+}
+
+/*******************************************************************************
+ * Function: segmentTextLength
+ * 
+ * Input:
+ *   - segment: a sieved segment
+ *   - count: its prime count
+ * 
+ * Output:
+ *   - Returns the bytes its primes take as text, one per line
+ *******************************************************************************/
+unsigned long long segmentTextLength(const SieveSegment &segment, const unsigned long long count) {
+    unsigned int digits = decimalDigits(segment.lo);
+    if (digits == decimalDigits(segment.hi)) return count * (digits + 1);
+
+    // The segment crosses a power of ten
+    unsigned long long length = 0;
+    forEachSegmentPrime(segment, [&length](unsigned long long prime) { length += decimalDigits(prime) + 1; });
+    return length;
+}
+
+/*******************************************************************************
+ * Function: formatSegmentText
+ * 
+ * Input:
+ *   - segment: a sieved segment
+ *   - text: where its lines go (segmentTextLength bytes)
+ * 
+ * Purpose:
+ *   Writes each prime's digits back to front, since its length is known
+ *******************************************************************************/
+void formatSegmentText(const SieveSegment &segment, char *text) {
+    TraceScope trace("format segment", segment.lo);
+    forEachSegmentPrime(segment, [&text](unsigned long long prime) {
+        unsigned int digits = decimalDigits(prime);
+        char *end = text + digits;
+        *end = '\n';
+        do {
+            *--end = (char) ('0' + prime % 10);
+            prime /= 10;
+        } while (prime != 0);
+        text += digits + 1;
+    });
+}
+
+// Hands out file offsets to segments in order
+struct OffsetChain {
+    std::mutex lock;
+    std::condition_variable advanced;
+    unsigned long long nextSegment;  // Segment whose turn it is to claim bytes
+    unsigned long long nextOffset;   // Where that segment's text starts
+};
+
+/*******************************************************************************
+ * Function: exportPrimesText
+ * 
+ * Input:
+ *   - n1, n2: range to search
+ *   - path: text file to create
+ * 
+ * Output:
+ *   - Returns the number of primes written (partial if cancelled)
+ *   - Returns 0 and prints a message if the file cannot be written
+ * 
+ * Purpose:
+ *   The display='y' path of countPrimes, but writing to a file on every
+ *   worker thread. A cancelled run leaves the lines of every segment that
+ *   claimed its offset, which is always a prefix of the range.
+ *******************************************************************************/
+unsigned long long exportPrimesText(const unsigned long long n1, const unsigned long long n2, const char *path) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    bool restricted = (options.residueModulus != 0);
+
+    // A class with a common factor holds one prime at most; nothing to sieve
+    unsigned long long onlyPrime;
+    if (restricted && !classOnlyPrime(options.residueClass, options.residueModulus, &onlyPrime)) {
+        bool inRange = (onlyPrime != 0 && onlyPrime >= start && onlyPrime <= end);
+        FILE *file = fopen(path, "w");
+        int ok = (file != NULL);
+        if (ok && inRange) ok = fprintf(file, "%llu\n", onlyPrime) > 0;
+        if (file != NULL) ok = (fclose(file) == 0) && ok;
+        if (!ok) {
+            printf("Could not create %s.\n", path);
+            return 0;
+        }
+        return inRange ? 1 : 0;
+    }
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize;
+    unsigned int threadCount = rangeThreadCount('n');
+    if (!fitSieveJob(start, end, segmentSize, threadCount)) return 0;
+
+    // The reservation only costs address space; the file is cut to size at the end
+    unsigned long long reserve = primeCountUpperBound(start, end) * (decimalDigits(end) + 1) + 1;
+    MappedOutput output;
+    if (reserve > (unsigned long long) SIZE_MAX || !createMappedOutput(path, reserve, output)) {
+        printf("Could not create %s.\n", path);
+        return 0;
+    }
+
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &basePrimes = table.primes;
+    ResidueClass cls;
+    if (restricted) setupResidueClass(options.residueClass, options.residueModulus, basePrimes, cls);
+    const ResidueClass *classFilter = restricted ? &cls : NULL;
+    const SieveEngine *engine = restricted ? sieveEngine : sieveEngineFor(end);
+    OffsetChain chain;
+    chain.nextSegment = 0;
+    chain.nextOffset = 0;
+    std::atomic<bool> overflowed(false);
+
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        SieveSegment segment;
+        sieveJobSegment(engine, classFilter, basePrimes, lo, hi, segment);
+        unsigned long long count = countSegmentPrimes(segment);
+        unsigned long long length = segmentTextLength(segment, count);
+
+        // Claim bytes in segment order; lower segments are already claimed by
+        // running workers, so the wait is one sieve at most
+        unsigned long long index = (lo - start) / segmentSize;
+        unsigned long long offset;
+        {
+            std::unique_lock<std::mutex> guard(chain.lock);
+            while (chain.nextSegment != index) {
+                if (isCancelRequested()) return 0ULL;
+                chain.advanced.wait_for(guard, std::chrono::milliseconds(100));
+            }
+            offset = chain.nextOffset;
+            if (offset + length > output.size) {
+                overflowed = true;  // Cannot happen while the bound holds
+                stopRun(RUN_STOPPED);
+                chain.advanced.notify_all();
+                return 0ULL;
+            }
+            chain.nextOffset += length;
+            chain.nextSegment++;
+        }
+        chain.advanced.notify_all();
+
+        formatSegmentText(segment, (char *) output.data + offset);
+        return count;
+    };
+
+    unsigned long long total = runRangeJob(start, end, segmentSize, threadCount, kernel, true, NULL);
+
+    if (!closeMappedOutput(output, chain.nextOffset) || overflowed) {
+        printf("Error while writing %s.\n", path);
+        return 0;
+    }
+    return total;
+}
+
+/*******************************************************************************
+ * Function: countPrimesTest
+ * 
+ * Input:
+ *   - Two integers (n1,n2) defining the range, comma-separated
+ *   - Display option (y/n, or b / t to save the primes to a binary / text file)
+ *   - Enter 0 for either number to exit
+ * 
+ * Output:
+ *   - If display=y: Lists all prime numbers found
+ *   - If display=b: Writes them to a binary prime list (see exportPrimesBinary)
+ *   - If display=t: Writes them to a text file, one per line (see exportPrimesText)
+ *   - Total count of prime numbers in range
+ *   With --residue=A,Q only the primes = A (mod Q) are counted and listed;
+ *   with --tuple the constellations starting in the range (countPrimeTuples);
+ *   with --approximate a count may end as an estimate with proven bounds
+ * 
+ * Purpose:
+ *   Interactive function that finds and optionally displays all prime numbers
+ *   within a user-specified range
+ *******************************************************************************/
+void countPrimesTest(void) {
+    unsigned long long n1, n2;
+    char display;
+    char path[1024];
+
+    while (1) {
+        printf("Please enter n1, n2: ");
+        scanf("%llu,%llu", &n1, &n2);
+
+        // Exit condition
+        if (n1 == 0 || n2 == 0) {
+            printf("Press ENTER to exit...");
+            getchar();  // Consume the newline from previous scanf
+            getchar();  // Wait for ENTER
+            break;
+        }
+
+        printf("Display the results? (y/n, b = save to a binary file, t = save to a text file) ");
+        getchar();  // Consume the newline from previous scanf
+        scanf_s("%c", &display,1);
+
+        bool binary = (display == 'b' || display == 'B');
+        bool text = (display == 't' || display == 'T');
+        if (binary && options.residueModulus != 0) {
+            // A binary list promises every prime of its range to readers
+            printf("Binary lists hold every prime; use t for a text file with --residue.\n");
+            continue;
+        } else if ((binary || text) && options.tupleSize != 0) {
+            printf("Constellations can only be displayed (y) or counted (n).\n");
+            continue;
+        } else if (binary || text) {
+            printf("%s file name: ", binary ? "Binary" : "Text");
+            scanf_s("%1023s", path, (unsigned int) sizeof(path));
+        }
+
+        // Ctrl-C cancels the query from here on
+        RunScope run;
+        unsigned long long total, lower, upper;
+        bool approximate = false;
+        PerfCounters counters;
+        if (binary) {
+            startPerfCounters(counters);
+            total = exportPrimesBinary(n1, n2, path);
+        } else if (text) {
+            startPerfCounters(counters);
+            total = exportPrimesText(n1, n2, path);
+        } else if (options.tupleSize != 0) {
+            startPerfCounters(counters);
+            total = countPrimeTuples(n1, n2, display);
+        } else if (options.approximateSeconds >= 0 && display != 'y' && display != 'Y') {
+            startPerfCounters(counters);
+            total = countPrimesApproximate(n1, n2, options.approximateSeconds, &lower, &upper);
+            approximate = (lower != upper);
+        } else {
+            startPerfCounters(counters);
+            total = countPrimesPlanned(n1, n2, display);
+        }
+        stopPerfCounters(counters);
+
+        char found[256] = "primes";
+        if (options.residueModulus != 0) {
+            snprintf(found, sizeof(found), "primes = %llu (mod %llu)", options.residueClass, options.residueModulus);
+        } else if (options.tupleSize != 0) {
+            int length = snprintf(found, sizeof(found), "prime constellations (0");
+            for (unsigned int i = 1; i < options.tupleSize; i++) {
+                length += snprintf(found + length, sizeof(found) - length, ", %u", options.tupleOffsets[i]);
+            }
+            snprintf(found + length, sizeof(found) - length, ")");
+        }
+        if (approximate) {
+            printf("About %llu %s between %llu and %llu; proven between %llu and %llu.\n", total, found, n1, n2,
+                   lower, upper);
+        } else if (runStatus() == RUN_OVER_MEMORY) {
+            printf("Not counted: the range between %llu and %llu exceeds the memory limit.\n", n1, n2);
+        } else if (isCancelRequested()) {
+            printf("%s%llu %s found between %llu and %llu before stopping.\n", runStatusPrefix(), total, found, n1, n2);
+        } else {
+            printf("%llu total %s found between %llu and %llu.\n", total, found, n1, n2);
+        }
+        reportPerfCounters(counters, "Task 2", 0);
+    }
+}
+
+/*******************************************************************************
+ * Combinatorial Prime Counting (Lucy_Hedgehog)
+ * 
+ * For a bound n, every value floor(n/k) is either <= sqrt(n) or equal to
+ * n/k for some k <= sqrt(n). The table holds S(v) for all those values in
+ * two arrays of about sqrt(n) entries. It starts with S(v) = sum of i^e for
+ * 2 <= i <= v, and for each prime p <= sqrt(n) subtracts
+ * p^e * (S(v/p) - S(p-1)) from every v >= p*p. That strips the composites
+ * whose smallest factor is p. What is left is the sum (e = 1) or count
+ * (e = 0) of primes up to each v, after O(n^(3/4)) steps.
+ * Sums (Task 4) use 128-bit values; Task 3 uses the counts to count
+ * k-almost-primes without enumerating the range.
+ *******************************************************************************/
+template <typename Value>
+struct LucyTable {
+    unsigned long long n;
+    unsigned long long root;    // floor(sqrt(n))
+    std::vector<Value> small;   // small[v] = S(v) for v <= root
+    std::vector<Value> large;   // large[k] = S(n / k) for 1 <= k <= root
+
+    Value at(const unsigned long long v) const {
+        return (v <= root) ? small[v] : large[n / v];
+    }
+};
+
+/*******************************************************************************
+ * Function: buildLucyTable
+ * 
+ * Input:
+ *   - n: upper bound
+ *   - sumPrimes: true for sums of primes, false for counts
+ *   - table: receives S(v) for every v = floor(n/k)
+ * 
+ * Purpose:
+ *   Core of the Lucy_Hedgehog algorithm; see the section comment. Values are
+ *   only ever reduced towards a final result that fits, so the subtraction
+ *   is exact even where an intermediate product would not fit. A stopped
+ *   run ends the build between primes; callers discard the partial table.
+ *******************************************************************************/
+template <typename Value>
+void buildLucyTable(const unsigned long long n, const bool sumPrimes, LucyTable<Value> &table) {
+    TraceScope trace(sumPrimes ? "lucy sum table" : "lucy count table", n);
+    PerfPhaseScope phase("Lucy table", 0);
+    table.n = n;
+    table.root = integerSqrt(n);
+    unsigned long long root = table.root;
+
+    // Sum of i^e over 2 <= i <= v, written to avoid overflowing v * (v + 1)
+    auto initial = [sumPrimes](unsigned long long v) -> Value {
+        if (v < 2) return 0;
+        if (!sumPrimes) return (Value) (v - 1);
+        uint128 triangle = (v % 2 == 0) ? (uint128) (v / 2) * (v + 1) : (uint128) v * ((v + 1) / 2);
+        return (Value) (triangle - 1);
+    };
+
+    table.small.assign(root + 1, 0);
+    table.large.assign(root + 1, 0);
+    for (unsigned long long v = 0; v <= root; v++) table.small[v] = initial(v);
+    for (unsigned long long k = 1; k <= root; k++) table.large[k] = initial(n / k);
+
+    Value *small = table.small.data();
+    Value *large = table.large.data();
+    for (unsigned long long p = 2; p <= root; p++) {
+        if (small[p] == small[p - 1]) continue;  // p is composite
+        if (isCancelRequested()) return;
+
+        Value below = small[p - 1];               // S(p - 1)
+        Value weight = sumPrimes ? (Value) p : 1;
+        unsigned long long square = p * p;
+
+        // Large values n/k, for every k with n/k >= p*p
+        unsigned long long kLimit = n / square;
+        if (kLimit > root) kLimit = root;
+        for (unsigned long long k = 1; k <= kLimit; k++) {
+            unsigned long long d = k * p;
+            Value quotient = (d <= root) ? large[d] : small[n / d];
+            large[k] -= weight * (quotient - below);
+        }
+
+        // Small values, high to low so small[v / p] is still the old value
+        for (unsigned long long v = root; v >= square; v--) {
+            small[v] -= weight * (small[v / p] - below);
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: factorize
+ * 
+ * Input:
+ *   - n: number to factor (n >= 1)
+ *   - primes: odd primes up to at least sqrt(n), e.g. from a PrimeTableReader
+ * 
+ * Output:
+ *   - Returns the (prime, exponent) pairs of n in increasing prime order,
+ *     plus the number of prime factors counted with multiplicity
+ *     (e.g. 12 = 2^2 * 3 gives {(2,2), (3,1)} and 3)
+ * 
+ * Purpose:
+ *   Shared factoring kernel for Task 3 and distributed Omega jobs. Trial
+ *   division only tries the listed primes, and any cofactor left above
+ *   sqrt(n) is prime.
+ *   The result lives in a fixed-size array so callers never allocate.
+ *******************************************************************************/
+const unsigned int OMEGA_BINS = 64;  // A 64-bit number has at most 63 prime factors
+
+template <typename Int>
+struct FactorList {
+    unsigned int count;               // Distinct primes stored below (at most 27 for 128 bits)
+    unsigned int total;               // Prime factors counted with multiplicity
+    Int prime[OMEGA_BINS];
+    unsigned char exponent[OMEGA_BINS];
+};
+
+typedef FactorList<unsigned long long> Factorization;
+typedef FactorList<uint128> WideFactorization;  // Batch factorization of values up to 2^128
+
+Factorization factorize(unsigned long long n, const std::vector<unsigned int> &primes) {
+    Factorization result;
+    result.count = 0;
+    result.total = 0;
+
+    if (n % 2 == 0 && n > 1) {
+        unsigned char e = 0;
+        while (n % 2 == 0) {
+            e++;
+            n /= 2;
+        }
+        result.prime[result.count] = 2;
+        result.exponent[result.count++] = e;
+        result.total += e;
+    }
+    for (unsigned int p : primes) {
+        if ((unsigned long long) p > n / p) break;
+        if (n % p != 0) continue;
+
+        unsigned char e = 0;
+        while (n % p == 0) {
+            e++;
+            n /= p;
+        }
+        result.prime[result.count] = p;
+        result.exponent[result.count++] = e;
+        result.total += e;
+    }
+    if (n > 1) {  // Remaining cofactor is prime
+        result.prime[result.count] = n;
+        result.exponent[result.count++] = 1;
+        result.total++;
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * Function: printFactorization
+ * 
+ * Input:
+ *   - n: the number that was factored
+ *   - factors: its factorization from factorize()
+ * 
+ * Output:
+ *   - Prints "n | p | p | q |" with each prime repeated by its exponent
+ * 
+ * Purpose:
+ *   One line format for every Task 3 engine, so the plan chosen never shows
+ *   in the listing
+ *******************************************************************************/
+void printFactorization(const unsigned long long n, const Factorization &factors) {
+    printf("%llu |", n);
+    for (unsigned int i = 0; i < factors.count; i++) {
+        for (unsigned int e = 0; e < factors.exponent[i]; e++) printf(" %llu |", factors.prime[i]);
+    }
+    printf("\n");
+}
+
+/*******************************************************************************
+ * Function: countAlmostPrimesFrom
+ * 
+ * Input:
+ *   - pi: prime counts for every floor(n/m)
+ *   - primes: all primes up to sqrt(n), in increasing order
+ *   - x: bound, itself of the form floor(n/m)
+ *   - k: number of prime factors still to choose (k >= 1)
+ *   - first: index in primes of the smallest prime allowed
+ * 
+ * Output:
+ *   - Returns how many products of k primes, each >= primes[first] and
+ *     counted with multiplicity, are <= x
+ * 
+ * Purpose:
+ *   Walks nondecreasing prime sequences p1 <= ... <= pk-1 and counts the last
+ *   factor with a single pi(x / (p1 ... pk-1)) lookup
+ *******************************************************************************/
+unsigned long long countAlmostPrimesFrom(const LucyTable<unsigned long long> &pi, const std::vector<unsigned long long> &primes,
+                                         const unsigned long long x, const unsigned int k, const size_t first) {
+    if (k == 1) {
+        // Primes in [primes[first], x]; first is also the number of primes below primes[first]
+        unsigned long long count = pi.at(x);
+        return (count > first) ? count - first : 0;
+    }
+
+    unsigned long long total = 0;
+    for (size_t i = first; i < primes.size(); i++) {
+        unsigned long long p = primes[i];
+
+        // Stop once p^k > x, since every later factor is at least p
+        unsigned long long rest = x;
+        for (unsigned int j = 1; j < k && rest >= p; j++) rest /= p;
+        if (rest < p) break;
+
+        total += countAlmostPrimesFrom(pi, primes, x / p, k - 1, i);
+    }
+    return total;
+}
+
+/*******************************************************************************
+ * Function: countAlmostPrimesUpTo
+ * 
+ * Input:
+ *   - n: upper bound
+ *   - k: number of prime factors, counted with multiplicity
+ * 
+ * Output:
+ *   - Returns how many numbers in [2, n] have exactly k prime factors
+ * 
+ * Purpose:
+ *   Builds the prime-count table for n once and hands it to the recursion
+ *******************************************************************************/
+unsigned long long countAlmostPrimesUpTo(const unsigned long long n, const unsigned int k) {
+    if (k == 0 || k >= OMEGA_BINS || n < 2) return 0;
+
+    LucyTable<unsigned long long> pi;
+    buildLucyTable(n, false, pi);
+    if (isCancelRequested()) return 0;
+
+    std::vector<unsigned long long> primes;
+    if (k >= 2) {
+        primes.push_back(2);
+        PrimeTableReader table(pi.root);
+        for (unsigned int p : table.primes) {
+            if (p > pi.root) break;
+            primes.push_back(p);
+        }
+    }
+    return countAlmostPrimesFrom(pi, primes, n, k, 0);
+}
+
+/*******************************************************************************
+ * Function: countAlmostPrimes
+ * 
+ * Input:
+ *   - n1, n2: range to search, in either order
+ *   - k: number of prime factors, counted with multiplicity
+ * 
+ * Output:
+ *   - Returns how many numbers in the range have exactly k prime factors
+ * 
+ * Purpose:
+ *   Answers Task 3's count in about O(n2^(3/4)) time without visiting each
+ *   number: A_k(n2) - A_k(n1 - 1)
+ *******************************************************************************/
+unsigned long long countAlmostPrimes(const unsigned long long n1, const unsigned long long n2, const unsigned int k) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    unsigned long long below = (start > 2) ? countAlmostPrimesUpTo(start - 1, k) : 0;
+    return countAlmostPrimesUpTo(end, k) - below;
+}
+
+/*******************************************************************************
+ * Function: countPrimesLucy
+ * 
+ * Input:
+ *   - start, end: range to count, start <= end
+ * 
+ * Output:
+ *   - Returns the number of primes in [start, end] as pi(end) - pi(start - 1)
+ * 
+ * Purpose:
+ *   Count-only Task 2 engine for the query planner: O(end^(3/4)) time and
+ *   O(sqrt(end)) memory however wide the range
+ *******************************************************************************/
+unsigned long long countPrimesLucy(const unsigned long long start, const unsigned long long end) {
+    if (end < 2) return 0;
+
+    LucyTable<unsigned long long> pi;
+    buildLucyTable(end, false, pi);
+    unsigned long long total = pi.at(end);
+    if (start > 2) {
+        buildLucyTable(start - 1, false, pi);
+        total -= pi.at(start - 1);
+    }
+    return isCancelRequested() ? 0 : total;
+}
+
+/*******************************************************************************
+ * Function: primeFactorization
+ * 
+ * Input:
+ *   - n1, n2: unsigned 64-bit integers defining the range to search
+ *   - nFactors: number of prime factors to look for
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns count of numbers with exactly nFactors prime factors
+ *   - If display='y', prints each number and its prime factorization
+ * 
+ * Purpose:
+ *   Core function that finds all numbers in a range with a specific count
+ *   of prime factors by trial division of every number. The query planner
+ *   (primeFactorizationPlanned) picks it or one of the faster engines.
+ *******************************************************************************/
+unsigned long long primeFactorization(const unsigned long long n1, const unsigned long long n2, const unsigned int nFactors, const unsigned char display) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 > n2) ? n1 : n2;
+    bool showResults = (display == 'y' || display == 'Y');
+
+    // Skip 1 since it has no prime factors
+    if (start < 2) start = 2;
+    if (start > end) return 0;
+
+    PrimeTableReader table(integerSqrt(end));
+    const std::vector<unsigned int> &primes = table.primes;
+    SegmentKernel kernel = [nFactors, showResults, &primes](unsigned long long lo, unsigned long long hi) {
+        TraceScope trace("factor segment", lo);
+        unsigned long long total = 0;
+        for (unsigned long long i = lo; i <= hi; i++) {
+            if ((i & CANCEL_POLL_MASK) == 0 && isCancelRequested()) break;
+
+            Factorization factors = factorize(i, primes);
+            if (factors.total == nFactors) {
+                total++;
+                if (showResults) printFactorization(i, factors);
+            }
+        }
+        return total;
+    };
+
+    CheckpointKey key = {TASK3, start, end, nFactors, (unsigned char) (showResults ? 'y' : 'n')};
+    return runRangeJob(start, end, SEGMENT_SIZE, rangeThreadCount(display), kernel, !showResults, &key);
+}
+
+/*******************************************************************************
+ * Function: primeFactorizationTest
+ * 
+ * Input:
+ *   - Two integers (n1,n2) defining the range, comma-separated
+ *   - Number of prime factors to find
+ *   - Display option (y/n)
+ *   - Enter 0 for either range number to exit
+ * 
+ * Output:
+ *   - If display=y: Shows each number and its prime factorization
+ *   - Total count of numbers with specified factor count
+ * 
+ * Purpose:
+ *   Interactive function that finds numbers with a specific count of prime
+ *   factors within a range
+ *******************************************************************************/
+void primeFactorizationTest() {
+    unsigned long long n1, n2;
+    unsigned int nFactors;
+    unsigned char display;
+
+    while (1) {
+        printf("Please enter n1, n2: ");
+        scanf_s("%llu,%llu", &n1, &n2);
+
+        if (n1 == 0 || n2 == 0) {
+            printf("Press ENTER to exit...");
+            getchar();  // Consume newline
+            getchar();  // Wait for ENTER
+            break;
+        }
+
+        printf("Please enter the number of prime factors to find: ");
+        scanf_s("%u", &nFactors);
+
+        printf("Display the results? (y/n) ");
+        getchar();  // Consume the newline from previous scanf
+        scanf_s("%c", &display, 1);
+
+        RunScope run;
+        PerfCounters counters;
+        startPerfCounters(counters);
+        unsigned long long total = primeFactorizationPlanned(n1, n2, nFactors, display);
+        stopPerfCounters(counters);
+
+        if (runStatus() == RUN_OVER_MEMORY) {
+            printf("Not counted: the range between %llu and %llu exceeds the memory limit.\n", n1, n2);
+        } else if (isCancelRequested()) {
+            printf("%s%llu numbers with %u prime factors found between %llu and %llu before stopping.\n",
+                   runStatusPrefix(), total, nFactors, n1, n2);
+        } else {
+            printf("%llu total numbers with %u prime factors found between %llu and %llu.\n",
+                   total, nFactors, n1, n2);
+        }
+        reportPerfCounters(counters, "Task 3", 0);
+    }
+}
+
+/*******************************************************************************
+ * Batch Factorization
+ * 
+ * --factor-file factors a list of unrelated values below 2^128 (any
+ * non-digit characters separate them) and prints one "n | p | p | q |" line
+ * per value, in input order. Values are read through a buffered parser in
+ * chunks. Each chunk is split by size: values below SPF_LIMIT (less under
+ * --mem-limit) are factored on the spot from a smallest-prime-factor table,
+ * and larger ones are spread over the range job executor and split with
+ * Pollard's rho, using Miller-Rabin below 2^64 and Baillie-PSW above.
+ * 128-bit values whose factors are too large for rho go to the elliptic
+ * curve method.
+ *******************************************************************************/
+const unsigned int SPF_LIMIT = 1U << 22;       // Smallest-prime-factor table covers [0, SPF_LIMIT)
+const size_t BATCH_CHUNK = 8192;               // Values read, factored and written per round
+const unsigned long long LARGE_SEGMENT = 64;   // Large values per executor segment
+const unsigned int RHO_TRIAL_LIMIT = 1000;     // Trial divide by primes below this before rho
+const unsigned long long RHO_WIDE_STEPS = 1ULL << 16;  // Rho budget on 128-bit pieces before ECM
+const size_t IO_BUFFER_SIZE = 1 << 16;
+
+struct NumberReader {
+    FILE *file;
+    std::vector<char> buffer;
+    size_t position;
+    size_t length;
+    unsigned long long tokenCount;  // Values read so far, for error messages
+
+    NumberReader(FILE *file) : file(file), buffer(IO_BUFFER_SIZE), position(0), length(0), tokenCount(0) {}
+};
+
+struct OutputBuffer {
+    FILE *file;
+    std::vector<char> buffer;
+    size_t length;
+
+    OutputBuffer(FILE *file) : file(file), buffer(IO_BUFFER_SIZE), length(0) {}
+};
+
+/*******************************************************************************
+ * Function: readNumber
+ * 
+ * Input:
+ *   - reader: buffered input opened on the number file
+ * 
+ * Output:
+ *   - Stores the next value in *value and returns 1
+ *   - Returns 0 at end of input, -1 if a value does not fit in 128 bits
+ * 
+ * Purpose:
+ *   Replaces fscanf for large inputs: refills a 64 KiB buffer with fread and
+ *   parses digits directly
+ *******************************************************************************/
+int readNumber(NumberReader &reader, uint128 *value) {
+    bool inNumber = false;
+    uint128 n = 0;
+
+    while (1) {
+        if (reader.position == reader.length) {
+            reader.length = fread(reader.buffer.data(), 1, IO_BUFFER_SIZE, reader.file);
+            reader.position = 0;
+            if (reader.length == 0) break;
+        }
+
+        unsigned char c = (unsigned char) reader.buffer[reader.position];
+        if (c >= '0' && c <= '9') {
+            unsigned int digit = c - '0';
+            if (n > (UINT128_MAX_VALUE - digit) / 10) return -1;
+            n = n * 10 + digit;
+            inNumber = true;
+        } else if (inNumber) {
+            break;
+        }
+        reader.position++;
+    }
+
+    if (!inNumber) return 0;
+    reader.tokenCount++;
+    *value = n;
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: writeText / writeBytes / writeNumber / flushOutput
+ * 
+ * Input:
+ *   - out: buffered output
+ *   - text / data, length / value: what to append
+ * 
+ * Purpose:
+ *   Buffered replacements for printf on the batch output path
+ *******************************************************************************/
+void flushOutput(OutputBuffer &out) {
+    TraceScope trace("output flush", out.length);
+    fwrite(out.buffer.data(), 1, out.length, out.file);
+    out.length = 0;
+}
+
+void writeBytes(OutputBuffer &out, const char *data, size_t length) {
+    if (out.length + length > IO_BUFFER_SIZE) flushOutput(out);
+    if (length >= IO_BUFFER_SIZE) {
+        fwrite(data, 1, length, out.file);  // Too big to be worth copying
+        return;
+    }
+    memcpy(out.buffer.data() + out.length, data, length);
+    out.length += length;
+}
+
+void writeText(OutputBuffer &out, const char *text) {
+    writeBytes(out, text, strlen(text));
+}
+
+void writeNumber(OutputBuffer &out, uint128 value) {
+    char digits[40];
+    int count = 0;
+    while (value > ULLONG_MAX) {
+        digits[count++] = (char) ('0' + (int) (value % 10));
+        value /= 10;
+    }
+    unsigned long long low = (unsigned long long) value;  // 64-bit division from here on
+    do {
+        digits[count++] = (char) ('0' + low % 10);
+        low /= 10;
+    } while (low != 0);
+
+    if (out.length + count > IO_BUFFER_SIZE) flushOutput(out);
+    while (count > 0) out.buffer[out.length++] = digits[--count];
+}
+
+/*******************************************************************************
+ * Function: buildSmallestFactorTable
+ * 
+ * Input:
+ *   - limit: table size
+ * 
+ * Output:
+ *   - Returns spf where spf[n] is the smallest prime factor of n (n >= 2)
+ * 
+ * Purpose:
+ *   Sieve of Eratosthenes that keeps the first prime to strike each number,
+ *   so small numbers factor by lookup instead of trial division
+ *******************************************************************************/
+std::vector<unsigned int> buildSmallestFactorTable(const unsigned int limit) {
+    std::vector<unsigned int> spf(limit, 0);
+    for (unsigned int i = 2; i < limit; i++) {
+        if (spf[i] != 0) continue;
+        spf[i] = i;
+        for (unsigned long long j = (unsigned long long) i * i; j < limit; j += i) {
+            if (spf[j] == 0) spf[j] = i;
+        }
+    }
+    return spf;
+}
+
+/*******************************************************************************
+ * Function: factorizeSmall
+ * 
+ * Input:
+ *   - n: number to factor (1 <= n < spf.size())
+ *   - spf: smallest-prime-factor table
+ * 
+ * Output:
+ *   - Returns the factorization of n after O(log n) table lookups
+ * 
+ * Purpose:
+ *   Fast path for batch values below the table limit and for dense Task 3
+ *   ranges of small numbers
+ *******************************************************************************/
+template <typename Int>
+FactorList<Int> factorizeSmall(unsigned int n, const std::vector<unsigned int> &spf) {
+    FactorList<Int> result;
+    result.count = 0;
+    result.total = 0;
+
+    while (n > 1) {
+        unsigned int p = spf[n];
+        unsigned char e = 0;
+        while (n % p == 0) {
+            e++;
+            n /= p;
+        }
+        result.prime[result.count] = p;
+        result.exponent[result.count++] = e;
+        result.total += e;
+    }
+    return result;
+}
+
+/*******************************************************************************
+ * Function: mulMod64 / powMod64
+ * 
+ * Input:
+ *   - a, b (or base, exponent), m: 64-bit operands and modulus (m > 0)
+ * 
+ * Output:
+ *   - Returns a * b mod m (or base^exponent mod m) without overflow
+ * 
+ * Purpose:
+ *   Modular arithmetic for Miller-Rabin and Pollard rho below 2^64, with a
+ *   128-bit product only when an operand needs more than 32 bits
+ *******************************************************************************/
+inline unsigned long long mulMod64(const unsigned long long a, const unsigned long long b, const unsigned long long m) {
+    if (((a | b) >> 32) == 0) return a * b % m;  // 32-bit operands: skip the 128-bit division
+    return (unsigned long long) ((uint128) a * b % m);
+}
+
+unsigned long long powMod64(unsigned long long base, unsigned long long exponent, const unsigned long long m) {
+    unsigned long long result = 1 % m;
+    base %= m;
+    while (exponent > 0) {
+        if (exponent & 1) result = mulMod64(result, base, m);
+        base = mulMod64(base, base, m);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+/*******************************************************************************
+ * Function: isPrime64
+ * 
+ * Input:
+ *   - n: any 64-bit number
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, 0 otherwise
+ * 
+ * Purpose:
+ *   Deterministic Miller-Rabin: the first twelve prime bases are enough for
+ *   every n < 2^64, and bases 2, 7 and 61 below 4,759,123,141
+ *******************************************************************************/
+int isPrime64(const unsigned long long n) {
+    static const unsigned int BASES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    static const unsigned int SMALL_BASES[] = {2, 7, 61};  // Enough below 4,759,123,141
+
+    if (n < 2) return 0;
+    for (unsigned int p : BASES) {
+        if (n % p == 0) return n == p;
+    }
+    if (n < 37 * 37) return 1;  // Also keeps the base 61 below n
+
+    unsigned long long d = n - 1;
+    unsigned int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s++;
+    }
+
+    bool small = n < 4759123141ULL;
+    const unsigned int *bases = small ? SMALL_BASES : BASES;
+    unsigned int baseCount = small ? 3 : 12;
+    for (unsigned int i = 0; i < baseCount; i++) {
+        unsigned long long x = powMod64(bases[i], d, n);
+        if (x == 1 || x == n - 1) continue;
+
+        unsigned int r = 1;
+        for (; r < s; r++) {
+            x = mulMod64(x, x, n);
+            if (x == n - 1) break;
+        }
+        if (r == s) return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: pollardRho
+ * 
+ * Input:
+ *   - n: odd composite number
+ * 
+ * Output:
+ *   - Returns a nontrivial factor of n
+ * 
+ * Purpose:
+ *   Brent's variant of Pollard's rho. Differences are multiplied together
+ *   and only checked with a gcd every 128 steps; a failed batch is replayed
+ *   one step at a time, and a failed constant c is replaced by c + 1.
+ *******************************************************************************/
+unsigned long long gcd64(unsigned long long a, unsigned long long b) {
+    while (b != 0) {
+        unsigned long long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+unsigned long long pollardRho(const unsigned long long n) {
+    const unsigned long long BATCH = 128;
+
+    for (unsigned long long c = 1;; c++) {
+        unsigned long long y = 2, x = 2, saved = 2, q = 1, g = 1;
+
+        for (unsigned long long r = 1; g == 1; r <<= 1) {
+            x = y;
+            for (unsigned long long i = 0; i < r; i++) y = (mulMod64(y, y, n) + c) % n;
+
+            for (unsigned long long k = 0; k < r && g == 1; k += BATCH) {
+                saved = y;
+                unsigned long long steps = (r - k < BATCH) ? r - k : BATCH;
+                for (unsigned long long i = 0; i < steps; i++) {
+                    y = (mulMod64(y, y, n) + c) % n;
+                    q = mulMod64(q, (x > y) ? x - y : y - x, n);
+                }
+                g = gcd64(q, n);
+            }
+        }
+
+        if (g == n) {
+            // The batch overshot; replay it one step at a time
+            do {
+                saved = (mulMod64(saved, saved, n) + c) % n;
+                g = gcd64((x > saved) ? x - saved : saved - x, n);
+            } while (g == 1);
+        }
+        if (g != n) return g;
+    }
+}
+
+/*******************************************************************************
+ * Function: pollardRhoWide
+ * 
+ * Input:
+ *   - n: odd composite number of at least 2^64
+ *   - maxSteps: iterations to try before giving up
+ * 
+ * Output:
+ *   - Returns a nontrivial factor of n, or 0 if none turned up in time
+ * 
+ * Purpose:
+ *   pollardRho over 128-bit Montgomery arithmetic. The iteration runs on
+ *   Montgomery residues, which is just another polynomial map mod n, so
+ *   the gcds find the same kind of factors. Factors near sqrt(n) would
+ *   take ~2^32 steps, so the budget hands those over to ecmFactor.
+ *******************************************************************************/
+uint128 gcd128(uint128 a, uint128 b) {
+    while (b != 0) {
+        uint128 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+uint128 pollardRhoWide(const uint128 n, const unsigned long long maxSteps) {
+    const unsigned long long BATCH = 128;
+    Montgomery128 m;
+    setupMontgomery128(n, m);
+
+    unsigned long long steps = 0;
+    for (unsigned long long c = 1;; c++) {
+        uint128 cMont = toMontgomery128(c, m);
+        uint128 y = addMod128(m.one, m.one, n), x = y, saved = y, q = m.one, g = 1;
+
+        for (unsigned long long r = 1; g == 1; r <<= 1) {
+            if (steps >= maxSteps) return 0;
+            steps += 2 * r;
+
+            x = y;
+            for (unsigned long long i = 0; i < r; i++) y = addMod128(montMul128(y, y, m), cMont, n);
+
+            for (unsigned long long k = 0; k < r && g == 1; k += BATCH) {
+                saved = y;
+                unsigned long long steps = (r - k < BATCH) ? r - k : BATCH;
+                for (unsigned long long i = 0; i < steps; i++) {
+                    y = addMod128(montMul128(y, y, m), cMont, n);
+                    q = montMul128(q, (x > y) ? x - y : y - x, m);
+                }
+                g = gcd128(q, n);
+            }
+        }
+
+        if (g == n) {
+            // The batch overshot; replay it one step at a time
+            do {
+                saved = addMod128(montMul128(saved, saved, m), cMont, n);
+                g = gcd128((x > saved) ? x - saved : saved - x, n);
+            } while (g == 1);
+        }
+        if (g != n) return g;
+    }
+}
+
+/*******************************************************************************
+ * Function: curveDouble / curveAdd / curveMultiply
+ * 
+ * Input:
+ *   - curve: Montgomery curve By^2 = x^3 + Ax^2 + x with (A + 2) / 4 kept
+ *     as the fraction a24num / a24den, so setting up a curve needs no
+ *     modular inverse
+ *   - p, q: points in projective X:Z form (Montgomery residues)
+ *   - difference: p - q, needed by the differential addition
+ *   - k: scalar (k >= 1)
+ * 
+ * Output:
+ *   - result receives 2p, p + q or k * p (it may alias an input)
+ *******************************************************************************/
+struct CurvePoint {
+    uint128 x;
+    uint128 z;
+};
+
+struct EcmCurve {
+    const Montgomery128 *m;
+    uint128 a24num;
+    uint128 a24den;
+};
+
+void curveDouble(const EcmCurve &curve, const CurvePoint &p, CurvePoint &result) {
+    const Montgomery128 &m = *curve.m;
+    uint128 sum = addMod128(p.x, p.z, m.n), difference = subMod128(p.x, p.z, m.n);
+    uint128 sum2 = montMul128(sum, sum, m), difference2 = montMul128(difference, difference, m);
+    uint128 t = subMod128(sum2, difference2, m.n);  // 4XZ
+    uint128 scaled = montMul128(difference2, curve.a24den, m);
+
+    result.x = montMul128(sum2, scaled, m);
+    result.z = montMul128(t, addMod128(scaled, montMul128(curve.a24num, t, m), m.n), m);
+}
+
+void curveAdd(const EcmCurve &curve, const CurvePoint &p, const CurvePoint &q, const CurvePoint &difference,
+              CurvePoint &result) {
+    const Montgomery128 &m = *curve.m;
+    uint128 u = montMul128(subMod128(p.x, p.z, m.n), addMod128(q.x, q.z, m.n), m);
+    uint128 v = montMul128(addMod128(p.x, p.z, m.n), subMod128(q.x, q.z, m.n), m);
+    uint128 sum = addMod128(u, v, m.n), diff = subMod128(u, v, m.n);
+    uint128 x = montMul128(difference.z, montMul128(sum, sum, m), m);
+    uint128 z = montMul128(difference.x, montMul128(diff, diff, m), m);
+
+    result.x = x;
+    result.z = z;
+}
+
+void curveMultiply(const EcmCurve &curve, const CurvePoint &p, const unsigned long long k, CurvePoint &result) {
+    // Montgomery ladder: low and high always differ by p
+    CurvePoint low = p, high;
+    curveDouble(curve, p, high);
+    for (int bit = 62 - __builtin_clzll(k | 1); bit >= 0; bit--) {
+        if ((k >> bit) & 1) {
+            curveAdd(curve, high, low, p, low);
+            curveDouble(curve, high, high);
+        } else {
+            curveAdd(curve, low, high, p, high);
+            curveDouble(curve, low, low);
+        }
+    }
+    result = low;
+}
+
+/*******************************************************************************
+ * Function: ecmCurve
+ * 
+ * Input:
+ *   - m: Montgomery constants for the odd composite n
+ *   - sigma: Suyama curve parameter (sigma >= 6)
+ *   - b1, b2: stage 1 and stage 2 bounds
+ *   - primes: odd primes up to at least b2
+ * 
+ * Output:
+ *   - Returns gcd(n, ...) after both stages: a proper factor when the
+ *     curve's group order mod some p | n is b1-smooth apart from one prime
+ *     up to b2, otherwise 1 or n
+ * 
+ * Purpose:
+ *   One curve of the elliptic curve method. Stage 1 multiplies the start
+ *   point by every prime power up to b1. Stage 2 walks the remaining primes
+ *   q = kD +- j with D = ECM_WHEEL: giant steps kD * Q come from
+ *   differential additions, baby steps j * Q are precomputed, and the
+ *   product of X_kD Z_j - X_j Z_kD over all q is checked with one gcd.
+ *******************************************************************************/
+const unsigned int ECM_WHEEL = 210;
+
+uint128 ecmCurve(const Montgomery128 &m, const unsigned long long sigma, const unsigned long long b1,
+                 const unsigned long long b2, const std::vector<unsigned int> &primes) {
+    const uint128 n = m.n;
+
+    // Suyama: u = sigma^2 - 5, v = 4 sigma, start (u^3 : v^3),
+    // (A + 2) / 4 = (v - u)^3 (3u + v) / (16 u^3 v)
+    uint128 s = toMontgomery128(sigma, m);
+    uint128 u = subMod128(montMul128(s, s, m), toMontgomery128(5, m), n);
+    uint128 v = toMontgomery128((uint128) 4 * sigma, m);
+    uint128 u3 = montMul128(montMul128(u, u, m), u, m);
+    uint128 vu = subMod128(v, u, n);
+    uint128 threeUPlusV = addMod128(addMod128(addMod128(u, u, n), u, n), v, n);
+
+    EcmCurve curve;
+    curve.m = &m;
+    curve.a24num = montMul128(montMul128(montMul128(vu, vu, m), vu, m), threeUPlusV, m);
+    curve.a24den = montMul128(montMul128(toMontgomery128(16, m), u3, m), v, m);
+    uint128 g = gcd128(curve.a24den, n);
+    if (g != 1) return g;
+
+    CurvePoint q;
+    q.x = u3;
+    q.z = montMul128(montMul128(v, v, m), v, m);
+
+    // Stage 1
+    for (unsigned long long power = 2; power <= b1; power *= 2) curveDouble(curve, q, q);
+    for (size_t i = 0; i < primes.size() && primes[i] <= b1; i++) {
+        unsigned long long power = primes[i];
+        while (power * primes[i] <= b1) power *= primes[i];
+        curveMultiply(curve, q, power, q);
+    }
+    g = gcd128(q.z, n);
+    if (g != 1) return g;
+
+    // Stage 2 baby steps: j * Q for odd j < ECM_WHEEL / 2
+    CurvePoint baby[ECM_WHEEL / 4 + 1];
+    CurvePoint twice;
+    curveDouble(curve, q, twice);
+    baby[0] = q;
+    curveAdd(curve, twice, q, q, baby[1]);
+    for (unsigned int j = 2; j <= ECM_WHEEL / 4; j++) curveAdd(curve, baby[j - 1], twice, baby[j - 2], baby[j]);
+
+    // Giant steps current = k * D * Q and next = (k + 1) * D * Q
+    unsigned long long k = b1 / ECM_WHEEL;
+    CurvePoint step, current, next;
+    curveMultiply(curve, q, ECM_WHEEL, step);
+    curveMultiply(curve, q, k * ECM_WHEEL, current);
+    curveMultiply(curve, q, (k + 1) * ECM_WHEEL, next);
+
+    uint128 product = m.one;
+    for (size_t i = 0; i < primes.size() && primes[i] <= b2; i++) {
+        if (primes[i] <= b1) continue;
+
+        unsigned long long target = (primes[i] + ECM_WHEEL / 2) / ECM_WHEEL;
+        while (k < target) {
+            CurvePoint following;
+            curveAdd(curve, next, step, current, following);
+            current = next;
+            next = following;
+            k++;
+        }
+
+        unsigned long long offset = k * ECM_WHEEL;
+        unsigned long long j = (primes[i] > offset) ? primes[i] - offset : offset - primes[i];
+        const CurvePoint &b = baby[j / 2];
+        uint128 cross = subMod128(montMul128(current.x, b.z, m), montMul128(b.x, current.z, m), n);
+        product = montMul128(product, cross, m);
+    }
+    return gcd128(product, n);
+}
+
+/*******************************************************************************
+ * Function: ecmFactor
+ * 
+ * Input:
+ *   - n: odd composite number with no factor below RHO_TRIAL_LIMIT
+ * 
+ * Output:
+ *   - Returns a nontrivial factor of n
+ * 
+ * Purpose:
+ *   Runs ecmCurve on successive Suyama curves, raising the bounds as curves
+ *   fail: the usual settings for 15-, 20- and 25-digit factors. A 128-bit
+ *   composite always has a factor of at most 20 digits.
+ *******************************************************************************/
+struct EcmLevel {
+    unsigned long long b1;
+    unsigned int curves;
+};
+
+const EcmLevel ECM_LEVELS[] = {{2000, 25}, {11000, 90}, {50000, 0}};  // 0 = until a factor turns up
+const unsigned long long ECM_B2_FACTOR = 100;
+
+uint128 ecmFactor(const uint128 n) {
+    // Stage 2 of the last level reaches furthest; the shared table grows to cover it once per process
+    PrimeTableReader table(50000 * ECM_B2_FACTOR);
+    const std::vector<unsigned int> &primes = table.primes;
+
+    Montgomery128 m;
+    setupMontgomery128(n, m);
+    unsigned long long sigma = 6;
+    for (const EcmLevel &level : ECM_LEVELS) {
+        for (unsigned int curve = 0; level.curves == 0 || curve < level.curves; curve++) {
+            uint128 g = ecmCurve(m, sigma++, level.b1, level.b1 * ECM_B2_FACTOR, primes);
+            if (g != 1 && g != n) return g;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: factorizeLarge
+ * 
+ * Input:
+ *   - n: number to factor (1 <= n < 2^128)
+ * 
+ * Output:
+ *   - Returns the factorization of n
+ * 
+ * Purpose:
+ *   Strips small primes by trial division, then splits what is left until
+ *   every piece passes isPrime64 or isPrimeWide. The splitter depends on
+ *   the piece's size: pollardRho below 2^64; above that, a short run of
+ *   pollardRhoWide for small factors, then ecmFactor. Pieces wait on a
+ *   small fixed stack.
+ *******************************************************************************/
+WideFactorization factorizeLarge(uint128 n) {
+    WideFactorization result;
+    result.count = 0;
+    result.total = 0;
+
+    for (unsigned int d = 2; d < RHO_TRIAL_LIMIT && (uint128) d * d <= n; d += (d == 2) ? 1 : 2) {
+        if (n % d != 0) continue;
+        unsigned char e = 0;
+        while (n % d == 0) {
+            e++;
+            n /= d;
+        }
+        result.prime[result.count] = d;
+        result.exponent[result.count++] = e;
+        result.total += e;
+    }
+    if (n == 1) return result;
+
+    // Split the cofactor into primes, all of which exceed RHO_TRIAL_LIMIT;
+    // pieces that fit in 64 bits switch to the cheaper 64-bit arithmetic
+    uint128 pending[OMEGA_BINS];
+    uint128 found[OMEGA_BINS];
+    unsigned int pendingCount = 0, foundCount = 0;
+    pending[pendingCount++] = n;
+    while (pendingCount > 0) {
+        uint128 m = pending[--pendingCount];
+        bool narrow = m <= ULLONG_MAX;
+        if (narrow ? isPrime64((unsigned long long) m) : isPrimeWide(m)) {
+            found[foundCount++] = m;
+        } else {
+            uint128 d = narrow ? pollardRho((unsigned long long) m) : pollardRhoWide(m, RHO_WIDE_STEPS);
+            if (d == 0) d = ecmFactor(m);
+            pending[pendingCount++] = d;
+            pending[pendingCount++] = m / d;
+        }
+    }
+
+    std::sort(found, found + foundCount);
+    for (unsigned int i = 0; i < foundCount; i++) {
+        if (i > 0 && found[i] == found[i - 1]) {
+            result.exponent[result.count - 1]++;
+        } else {
+            result.prime[result.count] = found[i];
+            result.exponent[result.count++] = 1;
+        }
+        result.total++;
+    }
+    return result;
+}
+/*******************************************************************************
+ * Function: writeFactorization
+ * 
+ * Input:
+ *   - out: buffered output
+ *   - n: the number that was factored
+ *   - factors: its factorization
+ * 
+ * Output:
+ *   - Appends the same "n | p | p | q |" line printFactorization prints
+ * 
+ * Purpose:
+ *   Batch output goes through OutputBuffer rather than printf, so millions
+ *   of lines leave in a few large writes
+ *******************************************************************************/
+void writeFactorization(OutputBuffer &out, const uint128 n, const WideFactorization &factors) {
+    writeNumber(out, n);
+    writeText(out, " |");
+    for (unsigned int i = 0; i < factors.count; i++) {
+        for (unsigned int e = 0; e < factors.exponent[i]; e++) {
+            writeText(out, " ");
+            writeNumber(out, factors.prime[i]);
+            writeText(out, " |");
+        }
+    }
+    writeText(out, "\n");
+}
+
+/*******************************************************************************
+ * Function: runBatchFactorization
+ * 
+ * Output:
+ *   - Writes the factorization of every value in --factor-file to
+ *     --factor-output (standard output by default), in input order
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 on unreadable input or an out-of-range value
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --factor-file=FILE" runs
+ *******************************************************************************/
+int runBatchFactorization(void) {
+    RunScope run;
+    NumberReader reader(fopen(options.factorInputPath, "rb"));
+    if (reader.file == NULL) {
+        printf("Could not open %s.\n", options.factorInputPath);
+        return 1;
+    }
+
+    OutputBuffer out((options.factorOutputPath != NULL) ? fopen(options.factorOutputPath, "wb") : stdout);
+    if (out.file == NULL) {
+        printf("Could not create %s.\n", options.factorOutputPath);
+        fclose(reader.file);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    // Under --mem-limit the table gets at most half the budget and a chunk a quarter
+    unsigned int spfLimit = SPF_LIMIT;
+    size_t chunkSize = BATCH_CHUNK;
+    unsigned long long chunkBytes = sizeof(WideFactorization) + sizeof(uint128) + sizeof(size_t);
+    while (spfLimit > (1U << 16) && spfLimit * sizeof(unsigned int) > memoryLimit() / 2) spfLimit >>= 1;
+    while (chunkSize > 256 && chunkSize * chunkBytes > memoryLimit() / 4) chunkSize >>= 1;
+    if (!fitsMemory(spfLimit * sizeof(unsigned int) + chunkSize * chunkBytes, "Batch factorization")) {
+        fclose(reader.file);
+        if (out.file != stdout) fclose(out.file);
+        return 1;
+    }
+
+    std::vector<unsigned int> spf = buildSmallestFactorTable(spfLimit);
+    std::vector<uint128> values;
+    std::vector<WideFactorization> results(chunkSize);
+    std::vector<size_t> large;
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    unsigned long long smallCount = 0, largeCount = 0;
+    int status = 0, more = 1;
+
+    while (more == 1) {
+        // Read a chunk and factor the small values straight from the table
+        values.clear();
+        large.clear();
+        uint128 value;
+        TraceScope trace("read and factor small", smallCount + largeCount);
+        while (values.size() < chunkSize && (more = readNumber(reader, &value)) == 1) {
+            if (value < spfLimit) {
+                results[values.size()] = factorizeSmall<uint128>((unsigned int) value, spf);
+                smallCount++;
+            } else {
+                large.push_back(values.size());
+            }
+            values.push_back(value);
+        }
+        if (more == -1) {
+            fprintf(stderr, "Value %llu in %s does not fit in 128 bits.\n", reader.tokenCount + 1,
+                    options.factorInputPath);
+            status = 1;
+        }
+
+        // Hand the large values to the worker threads
+        if (!large.empty()) {
+            SegmentKernel kernel = [&values, &results, &large](unsigned long long lo, unsigned long long hi) {
+                TraceScope trace("factor large", lo);
+                for (unsigned long long i = lo; i <= hi; i++) {
+                    results[large[i]] = factorizeLarge(values[large[i]]);
+                }
+                return hi - lo + 1;
+            };
+            largeCount += runRangeJob(0, large.size() - 1, LARGE_SEGMENT, threadCount, kernel, false, NULL);
+            if (isCancelRequested()) break;  // Some results in this chunk were never filled in
+        }
+
+        for (size_t i = 0; i < values.size(); i++) {
+            writeFactorization(out, values[i], results[i]);
+        }
+    }
+    flushOutput(out);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    fprintf(stderr, "%s%llu numbers factored (%llu from the table, %llu by rho or ECM) in %.2f s.\n",
+            runStatusPrefix(), smallCount + largeCount, smallCount, largeCount, elapsed.count());
+
+    fclose(reader.file);
+    if (out.file != stdout) fclose(out.file);
+    return status;
+}
+
+/*******************************************************************************
+ * Query Planner
+ * 
+ * Tasks 1 to 3 each have several engines that give the same answer at very
+ * different costs, depending on the size of the input, the width of the
+ * range, whether results are displayed and what the prime table already
+ * holds:
+ *   - Task 1: a prime table lookup, trial division (32-bit only),
+ *     Miller-Rabin (64-bit only) or Baillie-PSW
+ *   - Task 2: a prime table lookup, the segmented sieve, or two Lucy tables
+ *     for count-only runs
+ *   - Task 3: the k-almost-prime count for count-only runs, factoring every
+ *     number by trial division, or a smallest-prime-factor table
+ * Before each query the planner estimates every engine's run time from a
+ * cost model and runs the cheapest one. The model's unit costs are measured
+ * on this machine the first time a plan is made, in a few milliseconds.
+ * --explain prints the estimates and the choice.
+ *******************************************************************************/
+const double CALIBRATION_SECONDS = 0.002;     // Minimum timing per unit cost
+const unsigned long long PLAN_SPF_LIMIT = 1ULL << 25;  // Largest Task 3 SPF table (128 MB)
+
+// Seconds per unit of work, measured by calibratePlanner
+struct PlannerCosts {
+    double division;           // One trial division in the Task 1 kernel
+    double millerRabinStep;    // One squaring of a Miller-Rabin round (per base and bit)
+    double bpswTest;           // One Baillie-PSW test of a 128-bit number
+    double sievedNumber;       // Sieving and counting one number
+    double lucyStep;           // Building a Lucy count table, per n^(3/4)
+    double almostPrimeStep;    // Counting 2-almost-primes up to n, per n^(3/4)
+    double factorDivision;     // Factoring a range, per number and prime below sqrt(n)
+    double spfEntry;           // Building one smallest-prime-factor table entry
+    double spfFactor;          // Factoring one number from that table
+    double rangeJob;           // Starting and joining the range job executor
+    double calibrationTime;    // Seconds calibratePlanner took
+};
+
+struct PlanCandidate {
+    const char *engine;  // Name printed by --explain
+    double seconds;      // Estimated run time (< 0: the engine cannot run this query)
+    const char *note;    // Why not, when it cannot
+};
+
+static PlannerCosts plannerCosts;
+static bool plannerCalibrated = false;
+static std::atomic<unsigned long long> plannerSink(0);  // Keeps timed work from being optimised away
+
+/*******************************************************************************
+ * Function: measureSeconds
+ * 
+ * Input:
+ *   - work: callable to time
+ * 
+ * Output:
+ *   - Returns the average seconds per call over at least CALIBRATION_SECONDS
+ *******************************************************************************/
+template <typename Work>
+double measureSeconds(Work work) {
+    unsigned long long runs = 0;
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        work();
+        runs++;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    } while (elapsed.count() < CALIBRATION_SECONDS);
+    return elapsed.count() / runs;
+}
+
+/*******************************************************************************
+ * Function: calibratePlanner
+ * 
+ * Output:
+ *   - Fills plannerCosts by timing each engine on a small fixed input
+ * 
+ * Purpose:
+ *   Runs once, before the first plan. Each input is chosen so the work it
+ *   does is known exactly (a prime walks every trial divisor, and so on).
+ *******************************************************************************/
+void calibratePlanner(void) {
+    TraceScope trace("calibrate planner", 0);
+    PerfPhaseScope phase("planning", 0);
+    auto begin = std::chrono::steady_clock::now();
+
+    // The largest 32-bit prime is divided by every prime below 2^16
+    const unsigned int prime32 = 4294967291U;
+    const unsigned long long prime64 = 18446744073709551557ULL;
+    const uint128 prime127 = ((uint128) 1 << 127) - 1;
+    PrimeTableReader table(1ULL << 16);
+    double divisions = 1;
+    for (unsigned int p : table.primes) {
+        if ((unsigned long long) p * p <= prime32) divisions++;
+    }
+    plannerCosts.division = measureSeconds([prime32]() { plannerSink += isPrime(prime32); }) / divisions;
+    plannerCosts.millerRabinStep = measureSeconds([prime64]() { plannerSink += isPrime64(prime64); }) / (12 * 64);
+    plannerCosts.bpswTest = measureSeconds([prime127]() { plannerSink += kernels.isPrimeWide(prime127); });
+
+    // One 2^20 segment at 10^9
+    const unsigned long long lo = 1000000000ULL, hi = lo + (1ULL << 20) - 1;
+    PrimeTableReader basePrimes(integerSqrt(hi));
+    plannerCosts.sievedNumber = measureSeconds([&basePrimes, lo, hi]() {
+        SieveSegment segment;
+        sieveEngine->sieve(basePrimes.primes, lo, hi, segment);
+        plannerSink += countSegmentPrimes(segment);
+    }) / (double) (hi - lo + 1);
+
+    const unsigned long long lucyN = 1ULL << 24;
+    double lucySteps = pow((double) lucyN, 0.75);
+    plannerCosts.lucyStep = measureSeconds([lucyN]() {
+        LucyTable<unsigned long long> pi;
+        buildLucyTable(lucyN, false, pi);
+        plannerSink += pi.at(lucyN);
+    }) / lucySteps;
+    plannerCosts.almostPrimeStep = measureSeconds([lucyN]() { plannerSink += countAlmostPrimesUpTo(lucyN, 2); })
+                                   / lucySteps;
+
+    // 1024 numbers just above 2^32, against the primes below 2^16
+    const unsigned long long block = 1ULL << 32;
+    plannerCosts.factorDivision = measureSeconds([&table, block]() {
+        unsigned long long total = 0;
+        for (unsigned long long n = block; n < block + 1024; n++) total += factorize(n, table.primes).total;
+        plannerSink += total;
+    }) / (1024 * divisions);
+
+    const unsigned int spfLimit = 1U << 18;
+    std::vector<unsigned int> spf;
+    plannerCosts.spfEntry = measureSeconds([&spf, spfLimit]() {
+        spf = buildSmallestFactorTable(spfLimit);
+        plannerSink += spf[spfLimit - 1];
+    }) / spfLimit;
+    plannerCosts.spfFactor = measureSeconds([&spf, spfLimit]() {
+        unsigned long long total = 0;
+        for (unsigned int n = spfLimit - 4096; n < spfLimit; n++) total += factorizeSmall<unsigned long long>(n, spf).total;
+        plannerSink += total;
+    }) / 4096;
+
+    SegmentKernel idle = [](unsigned long long lo, unsigned long long hi) { return hi - lo; };
+    plannerCosts.rangeJob = measureSeconds([&idle]() {
+        plannerSink += runRangeJob(1, SEGMENT_SIZE, SEGMENT_SIZE, rangeThreadCount('n'), idle, false, NULL);
+    });
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    plannerCosts.calibrationTime = elapsed.count();
+    plannerCalibrated = !isCancelRequested();  // A stopped run cut some measurements short
+}
+
+/*******************************************************************************
+ * Function: primesBelowEstimate
+ * 
+ * Input:
+ *   - x: bound
+ * 
+ * Output:
+ *   - Returns about pi(x), as x / (ln x - 1)
+ *******************************************************************************/
+double primesBelowEstimate(const double x) {
+    return (x < 3) ? 1 : x / (log(x) - 1);
+}
+
+/*******************************************************************************
+ * Function: checkpointPlanNote
+ * 
+ * Output:
+ *   - Returns why an engine that never checkpoints is ruled out when
+ *     --resume or --checkpoint was given, NULL otherwise
+ *******************************************************************************/
+const char *checkpointPlanNote(void) {
+    if (options.resume) return "no checkpoint to resume";
+    if (options.checkpointPath != DEFAULT_CHECKPOINT_PATH) return "never checkpoints";
+    return NULL;
+}
+
+/*******************************************************************************
+ * Function: choosePlan
+ * 
+ * Input:
+ *   - query: description printed by --explain
+ *   - candidates, count: the engines with their estimates
+ * 
+ * Output:
+ *   - Returns the index of the cheapest engine that can run the query
+ *   - With --explain, prints every estimate and marks the choice
+ *******************************************************************************/
+unsigned int choosePlan(const char *query, const PlanCandidate *candidates, const unsigned int count) {
+    unsigned int best = count;
+    for (unsigned int i = 0; i < count; i++) {
+        if (candidates[i].seconds < 0) continue;
+        if (best == count || candidates[i].seconds < candidates[best].seconds) best = i;
+    }
+
+    if (options.explain) {
+        printf("Plan for %s (costs calibrated in %.1f ms):\n", query, plannerCosts.calibrationTime * 1000);
+        for (unsigned int i = 0; i < count; i++) {
+            if (candidates[i].seconds < 0) {
+                printf("    %-22s -- %s\n", candidates[i].engine, candidates[i].note);
+            } else {
+                printf("  %c %-22s ~%.3g s\n", (i == best) ? '*' : ' ', candidates[i].engine, candidates[i].seconds);
+            }
+        }
+    }
+    return best;
+}
+
+/*******************************************************************************
+ * Function: isPrimePlanned
+ * 
+ * Input:
+ *   - n: any number below 2^128
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, 0 otherwise
+ * 
+ * Purpose:
+ *   Task 1 through the planner: a cached table answers with a binary
+ *   search; otherwise trial division wins for small n and Miller-Rabin or
+ *   Baillie-PSW for large n
+ *******************************************************************************/
+int isPrimePlanned(const uint128 n) {
+    enum {TABLE, TRIAL, MILLER_RABIN, BPSW};
+    if (!plannerCalibrated) calibratePlanner();
+    const PlannerCosts &c = plannerCosts;
+
+    // Estimates are for a prime n, which runs every round of every test
+
+    double bits = 1;
+    for (uint128 v = n; v > 1; v >>= 1) bits++;
+    unsigned long long cached = cachedPrimeLimit();
+    double tableFill = (cached < (1ULL << 16)) ? c.sievedNumber * (1 << 16) : 0;  // isPrime needs primes below 2^16
+
+    PlanCandidate candidates[] = {
+        {"prime table lookup", -1, "past the cached table"},
+        {"trial division", -1, "above 2^32"},
+        {"Miller-Rabin", -1, "above 2^64"},
+        {"Baillie-PSW", c.bpswTest * bits / 128, ""},
+    };
+    if (n <= cached) candidates[TABLE].seconds = c.division * bits;
+    if (n <= UINT_MAX) {
+        candidates[TRIAL].seconds = c.division * primesBelowEstimate(sqrt((double) n)) + tableFill;
+    }
+    if (n <= ULLONG_MAX) candidates[MILLER_RABIN].seconds = c.millerRabinStep * bits * ((n < 4759123141ULL) ? 3 : 12);
+
+    char query[96], digits[40];
+    snprintf(query, sizeof(query), "primality of %s", formatUint128(n, digits));
+    switch (choosePlan(query, candidates, 4)) {
+        case TABLE: return isCachedPrime((unsigned long long) n);
+        case TRIAL: return isPrime((unsigned int) n);
+        case MILLER_RABIN: return isPrime64((unsigned long long) n);
+        default: return kernels.isPrimeWide(n);
+    }
+}
+
+/*******************************************************************************
+ * Function: countPrimesPlanned
+ * 
+ * Input:
+ *   - n1, n2: range to search, in either order
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns the number of primes in the range (in the --residue class, if
+ *     one is given), printing them if display='y'
+ * 
+ * Purpose:
+ *   Task 2 through the planner: the cached table for ranges it covers, Lucy
+ *   tables for wide count-only ranges and the sieve for everything else
+ *******************************************************************************/
+unsigned long long countPrimesPlanned(const unsigned long long n1, const unsigned long long n2,
+                                      const unsigned char display) {
+    enum {TABLE, SIEVE, LUCY};
+    if (!plannerCalibrated) calibratePlanner();
+    const PlannerCosts &c = plannerCosts;
+
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    bool showResults = (display == 'y' || display == 'Y');
+    bool restricted = (options.residueModulus != 0);
+    double width = (double) (end - start) + 1;
+    unsigned long long root = integerSqrt(end);
+    unsigned long long cached = cachedPrimeLimit();
+    double baseFill = (cached < root) ? c.sievedNumber * (double) root : 0;
+
+    // Only the sieve knows --engine and the checkpoint file, so naming either pins the plan to it
+    const char *sieveOption = (options.engineName != NULL) ? "--engine needs the sieve" : checkpointPlanNote();
+
+    double sieveWidth = restricted ? width / options.residueModulus : width;
+    PlanCandidate candidates[] = {
+        {"prime table lookup", -1, "past the cached table"},
+        {"segmented sieve", c.sievedNumber * sieveWidth / rangeThreadCount(display) + baseFill + c.rangeJob, ""},
+        {"Lucy prime count", -1, "cannot list primes"},
+    };
+    if (sieveOption != NULL) {
+        candidates[TABLE].note = sieveOption;
+    } else if (end <= cached && !restricted) {
+        candidates[TABLE].seconds = c.division * 64 + (showResults ? c.sievedNumber * width : 0);  // Two searches
+    }
+    if (sieveOption != NULL) {
+        candidates[LUCY].note = sieveOption;
+    } else if (restricted) {
+        candidates[LUCY].note = "counts every prime";
+    } else if (lucyTableBytes(end, sizeof(unsigned long long)) > memoryLimit()) {
+        candidates[LUCY].note = "over --mem-limit";
+    } else if (!showResults) {
+        double steps = pow((double) end, 0.75) + ((start > 2) ? pow((double) (start - 1), 0.75) : 0);
+        candidates[LUCY].seconds = c.lucyStep * steps;
+    }
+
+    char query[96];
+    snprintf(query, sizeof(query), "primes in [%llu, %llu]%s", start, end, showResults ? ", displayed" : "");
+    switch (choosePlan(query, candidates, 3)) {
+        case TABLE: return countCachedPrimes(start, end, showResults);
+        case LUCY: return countPrimesLucy(start, end);
+        default: return countPrimes(start, end, display, true);
+    }
+}
+
+/*******************************************************************************
+ * Function: factorRangeSpf
+ * 
+ * Input:
+ *   - start, end: range to search (2 <= start <= end < PLAN_SPF_LIMIT)
+ *   - nFactors: number of prime factors to look for
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns what primeFactorization would, factoring from a smallest-prime-
+ *     factor table instead of by trial division
+ *******************************************************************************/
+unsigned long long factorRangeSpf(const unsigned long long start, const unsigned long long end,
+                                  const unsigned int nFactors, const unsigned char display) {
+    bool showResults = (display == 'y' || display == 'Y');
+    if (!fitsMemory((end + 1) * sizeof(unsigned int), "The smallest-prime-factor table")) return 0;
+
+    std::vector<unsigned int> spf;
+    {
+        PerfPhaseScope phase("factor table", end + 1);
+        spf = buildSmallestFactorTable((unsigned int) end + 1);
+    }
+    SegmentKernel kernel = [nFactors, showResults, &spf](unsigned long long lo, unsigned long long hi) {
+        TraceScope trace("factor segment", lo);
+        unsigned long long total = 0;
+        for (unsigned long long i = lo; i <= hi; i++) {
+            if ((i & CANCEL_POLL_MASK) == 0 && isCancelRequested()) break;
+
+            Factorization factors = factorizeSmall<unsigned long long>((unsigned int) i, spf);
+            if (factors.total == nFactors) {
+                total++;
+                if (showResults) printFactorization(i, factors);
+            }
+        }
+        return total;
+    };
+
+    CheckpointKey key = {TASK3, start, end, nFactors, (unsigned char) (showResults ? 'y' : 'n')};
+    return runRangeJob(start, end, SEGMENT_SIZE, rangeThreadCount(display), kernel, !showResults, &key);
+}
+
+/*******************************************************************************
+ * Function: primeFactorizationPlanned
+ * 
+ * Input:
+ *   - n1, n2: range to search, in either order
+ *   - nFactors: number of prime factors to look for
+ *   - display: character 'y'/'Y' to show results, any other to hide
+ * 
+ * Output:
+ *   - Returns the count of numbers with exactly nFactors prime factors,
+ *     printing each with its factorization if display='y'
+ * 
+ * Purpose:
+ *   Task 3 through the planner: the combinatorial count for wide count-only
+ *   ranges, a smallest-prime-factor table for dense ranges of small
+ *   numbers, and trial division otherwise
+ *******************************************************************************/
+unsigned long long primeFactorizationPlanned(const unsigned long long n1, const unsigned long long n2,
+                                             const unsigned int nFactors, const unsigned char display) {
+    enum {ALMOST_PRIMES, SPF, TRIAL};
+    if (!plannerCalibrated) calibratePlanner();
+    const PlannerCosts &c = plannerCosts;
+
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 > n2) ? n1 : n2;
+    bool showResults = (display == 'y' || display == 'Y');
+    if (start < 2) start = 2;  // 1 has no prime factors
+    if (start > end) return 0;
+
+    double width = (double) (end - start) + 1;
+    unsigned long long root = integerSqrt(end);
+    unsigned int threads = rangeThreadCount(display);
+    unsigned long long cached = cachedPrimeLimit();
+    double baseFill = (cached < root) ? c.sievedNumber * (double) root : 0;
+
+    // Within --mem-limit: the count table plus the primes up to sqrt(end) it walks
+    unsigned long long tableBytes = lucyTableBytes(end, sizeof(unsigned long long)) + 3 * basePrimeBytes(root);
+    PlanCandidate candidates[] = {
+        {"k-almost-prime count", -1, "cannot list numbers"},
+        {"smallest-factor table", -1, "range too high"},
+        {"trial division", c.factorDivision * width * primesBelowEstimate((double) root) / threads + baseFill + c.rangeJob,
+         ""},
+    };
+    if (checkpointPlanNote() != NULL) {
+        candidates[ALMOST_PRIMES].note = checkpointPlanNote();
+    } else if (nFactors >= OMEGA_BINS) {
+        candidates[ALMOST_PRIMES].note = "too many factors";
+    } else if (tableBytes > memoryLimit()) {
+        candidates[ALMOST_PRIMES].note = "over --mem-limit";
+    } else if (!showResults) {
+        double steps = pow((double) end, 0.75) + ((start > 2) ? pow((double) (start - 1), 0.75) : 0);
+        candidates[ALMOST_PRIMES].seconds = c.almostPrimeStep * steps;
+    }
+    if (end < PLAN_SPF_LIMIT) {
+        if ((end + 1) * sizeof(unsigned int) > memoryLimit()) {
+            candidates[SPF].note = "over --mem-limit";
+        } else {
+            candidates[SPF].seconds = c.spfEntry * (double) end + c.spfFactor * width / threads + c.rangeJob;
+        }
+    }
+
+    char query[128];
+    snprintf(query, sizeof(query), "numbers with %u prime factors in [%llu, %llu]%s", nFactors, start, end,
+             showResults ? ", displayed" : "");
+    switch (choosePlan(query, candidates, 3)) {
+        case ALMOST_PRIMES: return countAlmostPrimes(start, end, nFactors);
+        case SPF: return factorRangeSpf(start, end, nFactors, display);
+        default: return primeFactorization(start, end, nFactors, display);
+    }
+}
+
+/*******************************************************************************
+ * Approximate Prime Counts
+ * 
+ * With --approximate=SECONDS, count-only Task 2 queries answer within a
+ * deadline. The first answer comes from Riemann's R function,
+ * R(x) = 1 + sum over k >= 1 of (ln x)^k / (k k! zeta(k + 1)) (Gram's series),
+ * which is usually within a few hundred of pi(x) at 10^12. Its error is not
+ * proven, so the answer also carries an interval that is. Below
+ * EXACT_COUNT_LIMIT, pi(x) is read from the prime table. Above it,
+ * Dusart's bounds apply:
+ *   x / ln x (1 + 1 / ln x) <= pi(x)                        (x >= 599)
+ *   pi(x) <= x / ln x (1 + 1 / ln x + 2.51 / ln^2 x)        (x >= 355991)
+ * These are combined with primeCountUpperBound for short ranges. The range
+ * is then sieved from its low end until the deadline. Every finished prefix
+ * replaces its part of the interval with an exact count, and the live
+ * interval is redrawn as segments arrive. Dusart's bounds are relative, so
+ * a short range far from 0 only gets primeCountUpperBound until it is
+ * sieved. If the planner expects the Lucy count to finish inside the
+ * deadline, that runs instead and the answer is exact. If the base primes
+ * up to sqrt(n2) could not be listed in time, the estimate is returned
+ * unrefined.
+ *******************************************************************************/
+const unsigned long long EXACT_COUNT_LIMIT = 1ULL << 20;  // pi(x) from the table below this
+const unsigned int APPROXIMATE_REFRESH_MS = 200;
+
+struct PrimeCountEstimate {
+    unsigned long long lower;  // Proven bounds on the count
+    unsigned long long upper;
+    unsigned long long estimate;  // Best guess, within the bounds
+    unsigned long long sievedTo;  // The count of [start, sievedTo] is exact (start - 1 if none)
+    bool exact;
+};
+
+/*******************************************************************************
+ * Function: riemannR
+ * 
+ * Input:
+ *   - x: argument (x >= 1)
+ * 
+ * Output:
+ *   - Returns R(x) by Gram's series
+ * 
+ * Purpose:
+ *   zeta(k + 1) comes from its Euler-Maclaurin sum to 16 terms, accurate
+ *   well past long double precision for every k >= 1
+ *******************************************************************************/
+long double riemannR(const long double x) {
+    long double lnx = logl(x);
+    long double sum = 1, term = 1;
+    for (unsigned int k = 1; k < 1000; k++) {
+        long double s = k + 1;
+        long double zeta = 0;
+        const long double N = 16;
+        for (unsigned int n = 1; n < 16; n++) zeta += powl((long double) n, -s);
+        zeta += powl(N, 1 - s) / (s - 1) + powl(N, -s) / 2 + s * powl(N, -s - 1) / 12
+                - s * (s + 1) * (s + 2) * powl(N, -s - 3) / 720;
+
+        term *= lnx / k;  // (ln x)^k / k!
+        long double add = term / (k * zeta);
+        sum += add;
+        if (k > lnx && add < sum * 1e-22L) break;
+    }
+    return sum;
+}
+
+/*******************************************************************************
+ * Function: primeCountBounds
+ * 
+ * Input:
+ *   - x: any 64-bit number
+ *   - lower, upper: receive proven bounds with lower <= pi(x) <= upper
+ *******************************************************************************/
+void primeCountBounds(const unsigned long long x, unsigned long long *lower, unsigned long long *upper) {
+    if (x < EXACT_COUNT_LIMIT) {
+        PrimeTableReader table(x);  // Odd primes only
+        unsigned long long odd = std::upper_bound(table.primes.begin(), table.primes.end(), (unsigned int) x)
+                                 - table.primes.begin();
+        *lower = *upper = odd + ((x >= 2) ? 1 : 0);
+        return;
+    }
+
+    // One unit of slack on each side covers long double rounding
+    long double lx = logl((long double) x);
+    long double base = (long double) x / lx;
+    *lower = (unsigned long long) floorl(base * (1 + 1 / lx)) - 1;
+    *upper = (unsigned long long) ceill(base * (1 + 1 / lx + 2.51L / (lx * lx))) + 1;
+}
+
+/*******************************************************************************
+ * Function: boundRangeCount
+ * 
+ * Input:
+ *   - lo, hi: inclusive range (lo <= hi + 1; an empty range gives 0)
+ *   - lower, upper: receive proven bounds on the primes in [lo, hi]
+ *******************************************************************************/
+void boundRangeCount(const unsigned long long lo, const unsigned long long hi, unsigned long long *lower,
+                     unsigned long long *upper) {
+    *lower = *upper = 0;
+    if (lo > hi) return;
+
+    unsigned long long hiLower, hiUpper, loLower = 0, loUpper = 0;
+    primeCountBounds(hi, &hiLower, &hiUpper);
+    if (lo > 1) primeCountBounds(lo - 1, &loLower, &loUpper);
+    *lower = (hiLower > loUpper) ? hiLower - loUpper : 0;
+    *upper = hiUpper - loLower;
+
+    unsigned long long shortBound = primeCountUpperBound(lo, hi);
+    if (shortBound < *upper) *upper = shortBound;
+}
+
+/*******************************************************************************
+ * Function: estimateRemainder
+ * 
+ * Input:
+ *   - exact: primes counted in [start, sievedTo]
+ *   - sievedTo, end: the rest of the range is [sievedTo + 1, end]
+ *   - result: receives the bounds and estimate for the whole range
+ *******************************************************************************/
+void estimateRemainder(const unsigned long long exact, const unsigned long long sievedTo, const unsigned long long end,
+                       PrimeCountEstimate &result) {
+    unsigned long long lower, upper;
+    boundRangeCount(sievedTo + 1, end, &lower, &upper);
+    result.sievedTo = sievedTo;
+    result.lower = exact + lower;
+    result.upper = exact + upper;
+    result.exact = (lower == upper);
+
+    long double rest = 0;
+    if (sievedTo < end) rest = riemannR((long double) end) - ((sievedTo > 0) ? riemannR((long double) sievedTo) : 0);
+    long double guess = (long double) exact + ((rest > 0) ? rest : 0);
+    result.estimate = (unsigned long long) llroundl(guess);
+    if (result.estimate < result.lower) result.estimate = result.lower;
+    if (result.estimate > result.upper) result.estimate = result.upper;
+}
+
+/*******************************************************************************
+ * Function: refinePrimeCount
+ * 
+ * Input:
+ *   - n1, n2: range to count, in either order
+ *   - seconds: deadline for refining the answer (0 = estimate only)
+ *   - result: receives the estimate and its proven bounds
+ * 
+ * Output:
+ *   - Redraws the current interval on one line while the sieve refines it
+ * 
+ * Purpose:
+ *   Ctrl-C stops the refinement early, like reaching the deadline
+ *******************************************************************************/
+void refinePrimeCount(const unsigned long long n1, const unsigned long long n2, const double seconds,
+                      PrimeCountEstimate &result) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+    if (start == 0) start = 1;  // Keeps start - 1 meaningful
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+
+    RunScope run;
+    estimateRemainder(0, start - 1, end, result);
+    if (result.exact || seconds <= 0) return;
+
+    // The exact count, if it fits the deadline
+    if (!plannerCalibrated) calibratePlanner();
+    double lucySeconds = plannerCosts.lucyStep
+                         * (pow((double) end, 0.75) + ((start > 2) ? pow((double) (start - 1), 0.75) : 0));
+    if (lucySeconds < seconds && lucyTableBytes(end, sizeof(unsigned long long)) <= memoryLimit()) {
+        // The estimate can be wrong, so the deadline stops the table build and leaves the bounds
+        std::mutex lock;
+        std::condition_variable finished;
+        bool done = false;
+        unsigned long long total = 0;
+        std::thread lucy([&]() {
+            unsigned long long count = countPrimesLucy(start, end);
+            std::lock_guard<std::mutex> guard(lock);
+            total = count;
+            done = true;
+            finished.notify_one();
+        });
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (!finished.wait_until(guard, deadline, [&]() { return done; })) stopRun(RUN_STOPPED);
+        }
+        lucy.join();
+        if (!isCancelRequested()) {
+            result.lower = result.upper = result.estimate = total;
+            result.sievedTo = end;
+            result.exact = true;
+        }
+        return;
+    }
+
+    // Filling the base prime table cannot be interrupted, so it must fit too.
+    // Listing the primes costs about as much again as sieving them
+    unsigned long long root = integerSqrt(end);
+    if (cachedPrimeLimit() < root && 2 * plannerCosts.sievedNumber * (double) root > seconds) return;
+
+    unsigned long long segmentSize;
+    unsigned int threadCount = rangeThreadCount('n');
+    if (!fitSieveJob(start, end, segmentSize, threadCount)) return;
+
+    // Segments are claimed in order, so few finish above the exact prefix.
+    // Those wait here, keyed by their first number
+    std::mutex lock;
+    std::map<unsigned long long, std::pair<unsigned long long, unsigned long long> > finished;
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &basePrimes = table.primes;
+    const SieveEngine *engine = sieveEngineFor(end);
+    // A segment that would overrun the deadline (going by the slowest so far) is not started
+    std::atomic<long long> slowestSegment(0);
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (begin + std::chrono::steady_clock::duration(slowestSegment.load()) >= deadline) {
+            stopRun(RUN_STOPPED);
+            return 0ULL;
+        }
+
+        SieveSegment segment;
+        sieveJobSegment(engine, NULL, basePrimes, lo, hi, segment);
+        unsigned long long count = countSegmentPrimes(segment);
+        long long took = (std::chrono::steady_clock::now() - begin).count();
+        long long slowest = slowestSegment.load();
+        while (took > slowest && !slowestSegment.compare_exchange_weak(slowest, took)) {}
+
+        std::lock_guard<std::mutex> guard(lock);
+        finished[lo] = std::make_pair(hi, count);
+        return count;
+    };
+
+    std::atomic<bool> done(false);
+    std::thread sieve([&]() {
+        runRangeJob(start, end, segmentSize, threadCount, kernel, false, NULL);
+        done.store(true);
+    });
+
+    // Every interval is proven, so the answer keeps their intersection
+    unsigned long long exact = 0, sievedTo = start - 1;
+    unsigned long long lower = result.lower, upper = result.upper;
+    while (1) {
+        bool last = done.load();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while (!finished.empty() && finished.begin()->first == sievedTo + 1) {
+                sievedTo = finished.begin()->second.first;
+                exact += finished.begin()->second.second;
+                finished.erase(finished.begin());
+            }
+        }
+        estimateRemainder(exact, sievedTo, end, result);
+        if (result.lower < lower) result.lower = lower;
+        if (result.upper > upper) result.upper = upper;
+        if (result.estimate < result.lower) result.estimate = result.lower;
+        if (result.estimate > result.upper) result.estimate = result.upper;
+        result.exact = (result.lower == result.upper);
+        lower = result.lower;
+        upper = result.upper;
+        printf("\r  ~%llu primes, proven in [%llu, %llu], %.1f%% sieved   ", result.estimate, result.lower,
+               result.upper, 100.0 * ((double) (sievedTo - (start - 1)) / ((double) (end - start) + 1)));
+        fflush(stdout);
+        if (last) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(APPROXIMATE_REFRESH_MS));
+    }
+    sieve.join();
+    printf("\r%79s\r", "");
+}
+
+/*******************************************************************************
+ * Function: countPrimesApproximate
+ * 
+ * Input:
+ *   - n1, n2: range to count, in either order
+ *   - seconds: time allowed for refining the answer (0 = estimate only)
+ *   - lower, upper: receive proven bounds on the count
+ * 
+ * Output:
+ *   - Returns the best estimate, exact if *lower == *upper
+ * 
+ * Purpose:
+ *   Task 2's count under --approximate; see the section comment
+ *******************************************************************************/
+unsigned long long countPrimesApproximate(const unsigned long long n1, const unsigned long long n2,
+                                          const double seconds, unsigned long long *lower, unsigned long long *upper) {
+    PrimeCountEstimate result;
+    refinePrimeCount(n1, n2, seconds, result);
+    *lower = result.lower;
+    *upper = result.upper;
+    return result.estimate;
+}
+
+/*******************************************************************************
+ * Bulk Classification
+ * 
+ * --classify maps a text file of integers below 2^128 into memory and
+ * writes "n 1" for each prime and "n 0" for each other value, one line per
+ * value in input order. The mapping is cut into CLASSIFY_CHUNK pieces at
+ * newline boundaries. Each round hands a batch of pieces to the range job
+ * executor, and every worker parses, tests and formats its piece into its
+ * own text buffer. The main thread then writes the buffers in order through
+ * the batch OutputBuffer. The parser finds digit runs 16 bytes at a time
+ * with SSE2 compares and converts 8 digits at a time with SWAR arithmetic.
+ * Values are echoed from the input bytes, so nothing is reformatted. The
+ * test is the batch path: Miller-Rabin below 2^64, Baillie-PSW above.
+ * Values are separated by whitespace or commas; any other token, such as a
+ * signed number, stops the run with an error like an oversized value.
+ *******************************************************************************/
+const size_t CLASSIFY_CHUNK = 1 << 20;         // Input bytes per piece (rounded up to a newline)
+const unsigned int CLASSIFY_ROUND_CHUNKS = 4;  // Pieces per thread per round
+
+struct ClassifyChunk {
+    size_t begin;            // Byte range of the mapping
+    size_t end;
+    std::vector<char> text;  // Output lines for this piece
+    unsigned long long values;
+    unsigned long long primes;
+    size_t badOffset;        // Offset of a value too large for 128 bits (SIZE_MAX = none)
+    bool malformed;          // ...or of a token that is not an unsigned integer
+};
+
+/*******************************************************************************
+ * Function: digitMask16
+ * 
+ * Input:
+ *   - p: 16 readable bytes
+ * 
+ * Output:
+ *   - Returns a bit mask with bit i set if p[i] is an ASCII digit
+ *******************************************************************************/
+#ifdef HAVE_SSE2
+inline unsigned int digitMask16(const unsigned char *p) {
+    // c - '0' is below 10 exactly for digits; flipping the sign bit turns the
+    // unsigned compare SSE2 lacks into a signed one
+    __m128i offset = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) p), _mm_set1_epi8('0'));
+    __m128i flipped = _mm_xor_si128(offset, _mm_set1_epi8((char) 0x80));
+    __m128i digits = _mm_cmplt_epi8(flipped, _mm_set1_epi8((char) (10 ^ 0x80)));
+    return (unsigned int) _mm_movemask_epi8(digits);
+}
+
+/*******************************************************************************
+ * Function: separatorMask16
+ * 
+ * Input:
+ *   - p: 16 readable bytes
+ * 
+ * Output:
+ *   - Returns a bit mask with bit i set if p[i] is a space, tab, CR, LF or comma
+ *******************************************************************************/
+inline unsigned int separatorMask16(const unsigned char *p) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *) p);
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')));
+    __m128i lines = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+                                 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+    __m128i separators = _mm_or_si128(_mm_or_si128(blank, lines), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')));
+    return (unsigned int) _mm_movemask_epi8(separators);
+}
+#endif
+
+/*******************************************************************************
+ * Function: isSeparator
+ * 
+ * Input:
+ *   - c: input byte
+ * 
+ * Output:
+ *   - Returns true for the bytes that may separate values: space, tab, CR,
+ *     LF and comma
+ *******************************************************************************/
+inline bool isSeparator(const unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+}
+
+/*******************************************************************************
+ * Function: skipSeparators / digitRunLength
+ * 
+ * Input:
+ *   - p, end: text to scan
+ * 
+ * Output:
+ *   - skipSeparators returns the first byte at or after p that is not a
+ *     separator (end if none)
+ *   - digitRunLength returns how many digits start at p
+ * 
+ * Purpose:
+ *   Token scanning for the classify parser, 16 bytes per step where SSE2
+ *   is available
+ *******************************************************************************/
+inline const unsigned char *skipSeparators(const unsigned char *p, const unsigned char *end) {
+#ifdef HAVE_SSE2
+    while (end - p >= 16) {
+        unsigned int mask = separatorMask16(p);
+        if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+        p += 16;
+    }
+#endif
+    while (p < end && isSeparator(*p)) p++;
+    return p;
+}
+
+inline size_t digitRunLength(const unsigned char *p, const unsigned char *end) {
+    const unsigned char *start = p;
+#ifdef HAVE_SSE2
+    while (end - p >= 16) {
+        unsigned int mask = digitMask16(p);
+        if (mask != 0xFFFF) return (size_t) (p - start) + __builtin_ctz(~mask);
+        p += 16;
+    }
+#endif
+    while (p < end && (unsigned char) (*p - '0') < 10) p++;
+    return (size_t) (p - start);
+}
+
+/*******************************************************************************
+ * Function: parseEightDigits
+ * 
+ * Input:
+ *   - p: eight ASCII digits
+ * 
+ * Output:
+ *   - Returns their value
+ * 
+ * Purpose:
+ *   SWAR conversion: combines neighbouring digits, then pairs, then
+ *   quads, with one multiply each (little-endian load)
+ *******************************************************************************/
+inline unsigned long long parseEightDigits(const unsigned char *p) {
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    v -= 0x3030303030303030ULL;
+    v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (v * 10000 + (v >> 32)) & 0xFFFFFFFFULL;
+}
+
+/*******************************************************************************
+ * Function: parseDigitRun
+ * 
+ * Input:
+ *   - p, length: a run of ASCII digits
+ *   - value: receives its value
+ * 
+ * Output:
+ *   - Returns 1, or 0 if the value does not fit in 128 bits
+ *******************************************************************************/
+int parseDigitRun(const unsigned char *p, size_t length, uint128 *value) {
+    while (length > 1 && *p == '0') {
+        p++;
+        length--;
+    }
+    if (length > 39) return 0;
+
+    // Up to 19 digits fit in 64 bits
+    unsigned long long low = 0;
+    size_t head = (length > 19) ? length - 19 : 0;
+    uint128 n = 0;
+    for (size_t i = 0; i < head; i++) n = n * 10 + (unsigned int) (p[i] - '0');
+
+    const unsigned char *q = p + head;
+    size_t rest = length - head;
+    for (; rest >= 8; rest -= 8, q += 8) low = low * 100000000ULL + parseEightDigits(q);
+    for (; rest > 0; rest--, q++) low = low * 10 + (unsigned int) (*q - '0');
+
+    if (head == 0) {
+        *value = low;
+        return 1;
+    }
+    // n has at most 20 digits here; n * 10^19 + low overflows only past 2^128
+    const uint128 TEN19 = 10000000000000000000ULL;
+    if (n > (UINT128_MAX_VALUE - low) / TEN19) return 0;
+    *value = n * TEN19 + low;
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: classifyChunk
+ * 
+ * Input:
+ *   - data: the mapped file
+ *   - chunk: the piece to classify
+ * 
+ * Output:
+ *   - Fills chunk.text with "n 1" / "n 0" lines and counts values and primes
+ *   - Stops at a value too large for 128 bits, or at a token that is not an
+ *     unsigned integer (such as "-7" or "12a"), and records its offset,
+ *     keeping the lines before it
+ *******************************************************************************/
+void classifyChunk(const unsigned char *data, ClassifyChunk &chunk) {
+    TraceScope trace("classify chunk", chunk.begin);
+    const unsigned char *p = data + chunk.begin;
+    const unsigned char *end = data + chunk.end;
+    // Each value takes at least one input byte per digit plus a separator,
+    // except the last; its line adds " 1\n", so twice the input always fits
+    chunk.text.resize(2 * (chunk.end - chunk.begin) + 3);
+    char *text = chunk.text.data();
+    chunk.values = 0;
+    chunk.primes = 0;
+    chunk.badOffset = SIZE_MAX;
+    chunk.malformed = false;
+
+    while (true) {
+        p = skipSeparators(p, end);
+        if (p == end) break;
+        size_t length = digitRunLength(p, end);
+
+        // Pieces end after a newline, so a token never continues into the next
+        if (length == 0 || (p + length < end && !isSeparator(p[length]))) {
+            chunk.badOffset = (size_t) (p - data);
+            chunk.malformed = true;
+            break;
+        }
+        uint128 n;
+        if (!parseDigitRun(p, length, &n)) {
+            chunk.badOffset = (size_t) (p - data);
+            break;
+        }
+        int prime;
+        if ((n & 1) == 0) {
+            prime = (n == 2);  // Half of all inputs, without a division
+        } else {
+            prime = (n <= ULLONG_MAX) ? isPrime64((unsigned long long) n) : kernels.isPrimeWide(n);
+        }
+
+        // Echo the digits without leading zeros
+        const unsigned char *digits = p;
+        size_t count = length;
+        while (count > 1 && *digits == '0') {
+            digits++;
+            count--;
+        }
+        memcpy(text, digits, count);
+        text += count;
+        *text++ = ' ';
+        *text++ = prime ? '1' : '0';
+        *text++ = '\n';
+
+        chunk.values++;
+        chunk.primes += prime;
+        p += length;
+    }
+    chunk.text.resize((size_t) (text - chunk.text.data()));
+}
+
+/*******************************************************************************
+ * Function: runClassification
+ * 
+ * Output:
+ *   - Writes "n 1" (prime) or "n 0" (not prime) for every value in
+ *     --classify to --classify-output (standard output by default), in
+ *     input order
+ *   - Prints a summary with the throughput to stderr
+ *   - Returns 0 on success, 1 on unreadable input or an out-of-range value
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --classify=FILE" runs
+ *******************************************************************************/
+int runClassification(void) {
+    RunScope run;
+    MappedFile mapped;
+    if (!mapFile(options.classifyInputPath, mapped)) {
+        printf("Could not map %s.\n", options.classifyInputPath);
+        return 1;
+    }
+#ifndef _WIN32
+    madvise((void *) mapped.data, mapped.size, MADV_SEQUENTIAL);
+#endif
+
+    OutputBuffer out((options.classifyOutputPath != NULL) ? fopen(options.classifyOutputPath, "wb") : stdout);
+    if (out.file == NULL) {
+        printf("Could not create %s.\n", options.classifyOutputPath);
+        unmapFile(mapped);
+        return 1;
+    }
+
+    // Cut the mapping into pieces that end just after a newline
+    std::vector<size_t> bounds(1, 0);
+    while (bounds.back() < mapped.size) {
+        size_t cut = bounds.back() + CLASSIFY_CHUNK;
+        if (cut >= mapped.size) {
+            cut = mapped.size;
+        } else {
+            const void *newline = memchr(mapped.data + cut, '\n', mapped.size - cut);
+            cut = (newline == NULL) ? mapped.size : (size_t) ((const unsigned char *) newline - mapped.data) + 1;
+        }
+        bounds.push_back(cut);
+    }
+    size_t pieceCount = bounds.size() - 1;
+
+    // Each piece in flight holds an output buffer of twice its input span
+    size_t largest = 0;
+    for (size_t i = 1; i < bounds.size(); i++) {
+        if (bounds[i] - bounds[i - 1] > largest) largest = bounds[i] - bounds[i - 1];
+    }
+    unsigned long long pieceBytes = 2 * (unsigned long long) largest + 3;
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+    size_t roundSize = (size_t) threadCount * CLASSIFY_ROUND_CHUNKS;
+    while (roundSize > 1 && roundSize * pieceBytes > memoryLimit()) roundSize--;
+    while (threadCount > roundSize) threadCount--;
+    if (!fitsMemory(roundSize * pieceBytes, "Classification")) {
+        unmapFile(mapped);
+        if (out.file != stdout) fclose(out.file);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    std::vector<ClassifyChunk> round(roundSize);
+    unsigned long long valueCount = 0, primeCount = 0;
+    size_t bytesDone = 0;
+    int status = 0;
+
+    for (size_t first = 0; first < pieceCount && status == 0; first += roundSize) {
+        size_t count = (pieceCount - first < roundSize) ? pieceCount - first : roundSize;
+        for (size_t i = 0; i < count; i++) {
+            round[i].begin = bounds[first + i];
+            round[i].end = bounds[first + i + 1];
+        }
+
+        SegmentKernel kernel = [&mapped, &round](unsigned long long lo, unsigned long long hi) {
+            for (unsigned long long i = lo; i <= hi; i++) classifyChunk(mapped.data, round[i]);
+            return hi - lo + 1;
+        };
+        runRangeJob(0, count - 1, 1, threadCount, kernel, false, NULL);
+        if (isCancelRequested()) break;  // Some pieces of this round were never classified
+
+        for (size_t i = 0; i < count && status == 0; i++) {
+            writeBytes(out, round[i].text.data(), round[i].text.size());
+            valueCount += round[i].values;
+            primeCount += round[i].primes;
+            bytesDone = round[i].end;
+            if (round[i].badOffset != SIZE_MAX) {
+                fprintf(stderr, "Value at byte %llu of %s %s.\n", (unsigned long long) round[i].badOffset,
+                        options.classifyInputPath,
+                        round[i].malformed ? "is not an unsigned integer" : "does not fit in 128 bits");
+                status = 1;
+            }
+        }
+    }
+    flushOutput(out);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    double seconds = (elapsed.count() > 0) ? elapsed.count() : 1e-9;
+    fprintf(stderr, "%s%llu numbers classified, %llu prime, in %.2f s (%.1f MB/s).\n",
+            runStatusPrefix(), valueCount, primeCount, elapsed.count(),
+            bytesDone / seconds / 1e6);
+
+    unmapFile(mapped);
+    if (out.file != stdout) fclose(out.file);
+    return status;
+}
+
+/*******************************************************************************
+ * Multiplicative Functions
+ * 
+ * --arith=N1,N2 evaluates multiplicative functions for every n in [N1, N2]
+ * in one segmented sieve pass, instead of factoring each number. A segment
+ * keeps, per number, the part not yet factored and one running product per
+ * function. Each prime p up to sqrt(N2) visits its multiples, divides out
+ * the whole power p^e and multiplies every product by f(p^e). A cofactor
+ * left above 1 is a single prime q and contributes f(q). A function is only
+ * its rule for prime powers, so adding one means adding a row to
+ * MULTIPLICATIVE_FUNCTIONS. Products are 128-bit because sigma(n) can pass
+ * 2^64, and signed functions wrap in two's complement.
+ * 
+ * --functions=LIST picks the columns (default: all). With --arith-output=FILE
+ * every function is one array in a binary file, little-endian:
+ * 
+ *   Header (32 bytes)
+ *     0  "L05ARITH"          magic
+ *     8  u32 version         ARITH_VERSION
+ *     12 u32 columnCount
+ *     16 u64 rangeLo         N1
+ *     24 u64 rangeHi         N2
+ *   Column descriptors, columnCount entries of 32 bytes
+ *     0  char name[16]       "phi", "mu", "sigma" or "d", NUL-padded
+ *     16 u32 width           bytes per value: 1, 4, 8 or 16
+ *     20 u32 isSigned        1 if values are two's complement
+ *     24 u64 offset          file offset of the column, a multiple of 64
+ *   Columns: N2 - N1 + 1 values each, for N1, N1 + 1, ..., N2
+ * 
+ * Segments write straight into the file's mapping, so the pass runs on
+ * every thread. Without a file the columns are printed as a text table in
+ * order, one row per number.
+ *******************************************************************************/
+const char ARITH_MAGIC[8] = {'L', '0', '5', 'A', 'R', 'I', 'T', 'H'};
+const unsigned int ARITH_VERSION = 1;
+const unsigned int ARITH_HEADER_SIZE = 32;
+const unsigned int ARITH_COLUMN_SIZE = 32;
+const unsigned long long ARITH_SEGMENT = 1 << 16;       // Numbers per segment, at least
+const unsigned long long MAX_ARITH_SEGMENT = 1 << 20;   // ... and at most
+
+struct MultiplicativeFunction {
+    const char *name;
+    unsigned int width;  // Bytes per value in the binary output
+    bool isSigned;
+    uint128 (*primePower)(const unsigned long long p, const unsigned int e, const unsigned long long pe);  // f(p^e)
+};
+
+uint128 phiPrimePower(const unsigned long long p, const unsigned int e, const unsigned long long pe) {
+    return (e == 1) ? p - 1 : pe - pe / p;
+}
+
+uint128 muPrimePower(const unsigned long long p, const unsigned int e, const unsigned long long pe) {
+    (void) p;
+    (void) pe;
+    return (e == 1) ? UINT128_MAX_VALUE : 0;  // -1 or 0
+}
+
+uint128 sigmaPrimePower(const unsigned long long p, const unsigned int e, const unsigned long long pe) {
+    (void) pe;
+    uint128 sum = 1;
+    for (unsigned int i = 0; i < e; i++) sum = sum * p + 1;  // 1 + p + ... + p^e
+    return sum;
+}
+
+uint128 divisorCountPrimePower(const unsigned long long p, const unsigned int e, const unsigned long long pe) {
+    (void) p;
+    (void) pe;
+    return e + 1;
+}
+
+const MultiplicativeFunction MULTIPLICATIVE_FUNCTIONS[] = {
+    {"phi", 8, false, phiPrimePower},
+    {"mu", 1, true, muPrimePower},
+    {"sigma", 16, false, sigmaPrimePower},
+    {"d", 4, false, divisorCountPrimePower},
+};
+const unsigned int MULTIPLICATIVE_FUNCTION_COUNT =
+    sizeof(MULTIPLICATIVE_FUNCTIONS) / sizeof(MULTIPLICATIVE_FUNCTIONS[0]);
+
+// Working arrays of forEachPrimePower, indexed by n - lo
+struct PrimePowerScratch {
+    std::vector<unsigned long long> found;  // Product of the prime powers divided out so far
+    std::vector<unsigned char> exponents;   // Exponent of the current prime, if above 1
+};
+
+struct MultiplicativeSegment {
+    PrimePowerScratch scratch;
+    std::vector<uint128> factors;               // f(p^e) of the last prime seen, per function and e
+    std::vector<std::vector<uint128> > values;  // One column per selected function, indexed by n - lo
+};
+
+/*******************************************************************************
+ * Function: parseFunctionList
+ * 
+ * Input:
+ *   - list: comma-separated function names, or NULL for all of them
+ *   - selected: receives indexes into MULTIPLICATIVE_FUNCTIONS, in list order
+ * 
+ * Output:
+ *   - Returns 1 on success, 0 (after a message) on an unknown or repeated name
+ *******************************************************************************/
+int parseFunctionList(const char *list, std::vector<unsigned int> &selected) {
+    selected.clear();
+    if (list == NULL) {
+        for (unsigned int f = 0; f < MULTIPLICATIVE_FUNCTION_COUNT; f++) selected.push_back(f);
+        return 1;
+    }
+
+    const char *name = list;
+    while (1) {
+        size_t length = strcspn(name, ",");
+        unsigned int f = 0;
+        while (f < MULTIPLICATIVE_FUNCTION_COUNT
+               && (strlen(MULTIPLICATIVE_FUNCTIONS[f].name) != length
+                   || strncmp(MULTIPLICATIVE_FUNCTIONS[f].name, name, length) != 0)) {
+            f++;
+        }
+        if (f == MULTIPLICATIVE_FUNCTION_COUNT || std::find(selected.begin(), selected.end(), f) != selected.end()) {
+            printf("Expected distinct functions from phi, mu, sigma, d: %s\n", list);
+            return 0;
+        }
+        selected.push_back(f);
+        if (name[length] == '\0') return 1;
+        name += length + 1;
+    }
+}
+
+/*******************************************************************************
+ * Function: forEachPrimePower
+ * 
+ * Input:
+ *   - primes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive segment (1 <= lo <= hi)
+ *   - scratch: working arrays, reused between segments
+ *   - visit: called as visit(i, p, e, p^e) for every prime power p^e that
+ *     exactly divides lo + i
+ * 
+ * Purpose:
+ *   The sieve pass described in the section comment. For each p, the
+ *   multiples of p^2, p^3, ... are visited first to record exponents, so
+ *   no number is divided until the end: the product of the prime powers
+ *   found is then all of n, or n over one larger prime. Each number sees
+ *   its primes in increasing order. Indexes rather than numbers drive the
+ *   loops, so a segment ending at 2^64 - 1 cannot wrap.
+ *******************************************************************************/
+template <typename Visitor>
+void forEachPrimePower(const std::vector<unsigned int> &primes, const unsigned long long lo,
+                       const unsigned long long hi, PrimePowerScratch &scratch, Visitor visit) {
+    unsigned long long count = hi - lo + 1;
+    std::vector<unsigned long long> &found = scratch.found;
+    std::vector<unsigned char> &exponents = scratch.exponents;
+    found.assign(count, 1);
+    exponents.assign(count, 0);
+
+    unsigned long long root = integerSqrt(hi);
+    unsigned long long powers[64];
+    for (size_t j = 0; j <= primes.size(); j++) {
+        unsigned long long p = (j == 0) ? 2 : primes[j - 1];  // The table holds odd primes only
+        if (p > root) break;
+
+        // Highest power first, so each number keeps the largest one dividing it
+        unsigned int top = 1;
+        powers[1] = p;
+        while (powers[top] <= hi / p) {
+            powers[top + 1] = powers[top] * p;
+            top++;
+        }
+        for (unsigned int e = top; e >= 2; e--) {
+            unsigned long long pe = powers[e];
+            for (unsigned long long i = (pe - lo % pe) % pe; i < count; i += pe) {
+                if (exponents[i] == 0) exponents[i] = (unsigned char) e;
+                if (count - i <= pe) break;  // p^e can be close to 2^64
+            }
+        }
+
+        for (unsigned long long i = (p - lo % p) % p; i < count; i += p) {
+            unsigned int e = (exponents[i] == 0) ? 1 : exponents[i];
+            exponents[i] = 0;
+            found[i] *= powers[e];
+            visit(i, p, e, powers[e]);
+        }
+    }
+
+    // What is left has no factor up to sqrt(hi), so it is 1 or prime
+    for (unsigned long long i = 0; i < count; i++) {
+        if (found[i] == lo + i) continue;
+        unsigned long long q = (lo + i) / found[i];
+        visit(i, q, 1, q);
+    }
+}
+
+/*******************************************************************************
+ * Function: evaluateSegment
+ * 
+ * Input:
+ *   - primes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive segment (1 <= lo <= hi)
+ *   - selected: functions to evaluate
+ *   - segment: working arrays; receives one column per selected function,
+ *     segment.values[k][n - lo]
+ * 
+ * Purpose:
+ *   Multiplies each number's products by f(p^e) for its prime powers.
+ *   f(p^e) is worked out once per prime and exponent, not per multiple.
+ *******************************************************************************/
+void evaluateSegment(const std::vector<unsigned int> &primes, const unsigned long long lo, const unsigned long long hi,
+                     const std::vector<unsigned int> &selected, MultiplicativeSegment &segment) {
+    TraceScope trace("multiplicative segment", lo);
+    unsigned long long count = hi - lo + 1;
+    unsigned int columns = (unsigned int) selected.size();
+    std::vector<std::vector<uint128> > &values = segment.values;
+    std::vector<uint128> &factors = segment.factors;
+    values.resize(columns);
+    for (unsigned int k = 0; k < columns; k++) values[k].assign(count, 1);
+    factors.resize(columns * 64);
+
+    unsigned long long cachedPrime = 0;
+    unsigned long long cachedExponents = 0;  // Bit e set when factors holds f(cachedPrime^e)
+    forEachPrimePower(primes, lo, hi, segment.scratch,
+                      [&](unsigned long long i, unsigned long long p, unsigned int e, unsigned long long pe) {
+        if (p != cachedPrime) {
+            cachedPrime = p;
+            cachedExponents = 0;
+        }
+        if ((cachedExponents >> e & 1) == 0) {
+            for (unsigned int k = 0; k < columns; k++) {
+                factors[k * 64 + e] = MULTIPLICATIVE_FUNCTIONS[selected[k]].primePower(p, e, pe);
+            }
+            cachedExponents |= 1ULL << e;
+        }
+        for (unsigned int k = 0; k < columns; k++) values[k][i] *= factors[k * 64 + e];
+    });
+}
+
+/*******************************************************************************
+ * Function: writeColumnValue
+ * 
+ * Input:
+ *   - out: where the value goes
+ *   - value: a 128-bit product
+ *   - isSigned: print it as two's complement
+ *******************************************************************************/
+void writeColumnValue(OutputBuffer &out, const uint128 value, const bool isSigned) {
+    if (isSigned && (value >> 127) != 0) {
+        writeText(out, "-");
+        writeNumber(out, ~value + 1);
+    } else {
+        writeNumber(out, value);
+    }
+}
+
+/*******************************************************************************
+ * Function: arithSegmentSize
+ * 
+ * Input:
+ *   - end: largest number the job will factor
+ * 
+ * Output:
+ *   - Returns the executor segment size for a --arith or --csr job
+ * 
+ * Purpose:
+ *   As for sieveSegmentSize: every base prime costs a division per segment,
+ *   so segments grow with sqrt(end). Each number here takes tens of bytes
+ *   of scratch instead of a bit, so they grow later and stop sooner; about
+ *   one division per 2-3 numbers measured best near 10^12 to 10^16
+ *******************************************************************************/
+unsigned long long arithSegmentSize(const unsigned long long end) {
+    unsigned long long root = integerSqrt(end);
+    unsigned long long size = ARITH_SEGMENT;
+    while (size < MAX_ARITH_SEGMENT && size * 64 < root) size <<= 1;
+    return size;
+}
+
+/*******************************************************************************
+ * Function: runMultiplicativeFunctions
+ * 
+ * Output:
+ *   - Writes the --functions columns for every n in the --arith range to
+ *     --arith-output, or prints them as a text table
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 on a bad function list or an unwritable file
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --arith=N1,N2" runs. A cancelled binary run
+ *   removes its file, which would have holes.
+ *******************************************************************************/
+int runMultiplicativeFunctions(void) {
+    RunScope run;
+    std::vector<unsigned int> selected;
+    if (!parseFunctionList(options.arithFunctions, selected)) return 1;
+    unsigned int columns = (unsigned int) selected.size();
+
+    unsigned long long start = (options.arithFrom < options.arithTo) ? options.arithFrom : options.arithTo;
+    unsigned long long end = (options.arithFrom < options.arithTo) ? options.arithTo : options.arithFrom;
+    if (start == 0) {
+        printf("Multiplicative functions start at n = 1.\n");
+        return 1;
+    }
+    unsigned long long count = end - start + 1;
+    bool toFile = (options.arithOutputPath != NULL);
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize = arithSegmentSize(end);
+    unsigned int threadCount = toFile ? rangeThreadCount('n') : 1;  // Text rows must stay in order
+    double bytesPerNumber = sizeof(unsigned long long) + 1 + columns * sizeof(uint128);  // Scratch and columns
+    if (!fitRangeJob(basePrimeBytes(root), bytesPerNumber, 1 << 10, segmentSize, threadCount)) return 1;
+
+    // Lay out the columns after the header, each on a 64-byte boundary
+    MappedOutput mapped;
+    std::vector<unsigned long long> offsets(columns);
+    unsigned long long fileSize = ARITH_HEADER_SIZE + columns * ARITH_COLUMN_SIZE;
+    for (unsigned int k = 0; k < columns; k++) {
+        offsets[k] = (fileSize + 63) / 64 * 64;
+        fileSize = offsets[k] + count * MULTIPLICATIVE_FUNCTIONS[selected[k]].width;
+    }
+    if (toFile && !createMappedOutput(options.arithOutputPath, fileSize, mapped)) {
+        printf("Could not create %s.\n", options.arithOutputPath);
+        return 1;
+    }
+
+    OutputBuffer out(stdout);
+    if (!toFile) {
+        writeText(out, "n");
+        for (unsigned int k = 0; k < columns; k++) {
+            writeText(out, " ");
+            writeText(out, MULTIPLICATIVE_FUNCTIONS[selected[k]].name);
+        }
+        writeText(out, "\n");
+    }
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &primes = table.primes;
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        MultiplicativeSegment segment;
+        evaluateSegment(primes, lo, hi, selected, segment);
+        const std::vector<std::vector<uint128> > &values = segment.values;
+        if (!toFile) {
+            for (unsigned long long i = 0; i <= hi - lo; i++) {
+                writeNumber(out, lo + i);
+                for (unsigned int k = 0; k < columns; k++) {
+                    writeText(out, " ");
+                    writeColumnValue(out, values[k][i], MULTIPLICATIVE_FUNCTIONS[selected[k]].isSigned);
+                }
+                writeText(out, "\n");
+            }
+            return hi - lo + 1;
+        }
+
+        for (unsigned int k = 0; k < columns; k++) {
+            unsigned int width = MULTIPLICATIVE_FUNCTIONS[selected[k]].width;
+            unsigned char *column = mapped.data + offsets[k] + (lo - start) * width;
+            for (unsigned long long i = 0; i <= hi - lo; i++) {
+                uint128 value = values[k][i];
+                switch (width) {
+                    case 1: column[i] = (unsigned char) value; break;
+                    case 4: storeLE32(column + 4 * i, (unsigned int) value); break;
+                    case 8: storeLE64(column + 8 * i, (unsigned long long) value); break;
+                    default:
+                        storeLE64(column + 16 * i, (unsigned long long) value);
+                        storeLE64(column + 16 * i + 8, (unsigned long long) (value >> 64));
+                }
+            }
+        }
+        return hi - lo + 1;
+    };
+    unsigned long long evaluated = runRangeJob(start, end, segmentSize, threadCount, kernel, toFile, NULL);
+    flushOutput(out);
+
+    int status = 0;
+    if (toFile) {
+        unsigned char *header = mapped.data;
+        memcpy(header, ARITH_MAGIC, sizeof(ARITH_MAGIC));
+        storeLE32(header + 8, ARITH_VERSION);
+        storeLE32(header + 12, columns);
+        storeLE64(header + 16, start);
+        storeLE64(header + 24, end);
+        for (unsigned int k = 0; k < columns; k++) {
+            const MultiplicativeFunction &function = MULTIPLICATIVE_FUNCTIONS[selected[k]];
+            unsigned char *entry = header + ARITH_HEADER_SIZE + k * ARITH_COLUMN_SIZE;
+            memset(entry, 0, ARITH_COLUMN_SIZE);
+            memcpy(entry, function.name, strlen(function.name));
+            storeLE32(entry + 16, function.width);
+            storeLE32(entry + 20, function.isSigned ? 1 : 0);
+            storeLE64(entry + 24, offsets[k]);
+        }
+        if (!closeMappedOutput(mapped, fileSize)) {
+            printf("Could not finish %s.\n", options.arithOutputPath);
+            status = 1;
+        }
+        if (isCancelRequested()) remove(options.arithOutputPath);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    fprintf(stderr, "%s%llu numbers evaluated (%u functions) in %.2f s.\n", runStatusPrefix(),
+            evaluated, columns, elapsed.count());
+    return status;
+}
+
+/*******************************************************************************
+ * Factorization Tables
+ * 
+ * --csr=N1,N2 --csr-output=FILE saves the factorization of every n in
+ * [N1, N2] in compressed sparse row (CSR) form. The factorizations come from
+ * the same segmented pass as the multiplicative functions. The file can be
+ * mapped and used in place. All integers are little-endian, and every array
+ * starts on a 64-byte boundary:
+ * 
+ *   Header (64 bytes)
+ *     0  "L05FACTR"          magic
+ *     8  u32 version         FACTOR_TABLE_VERSION
+ *     12 u32 primeWidth      bytes per prime: 4 if N2 < 2^32, else 8
+ *     16 u64 rangeLo         N1
+ *     24 u64 rangeHi         N2
+ *     32 u64 entryCount      prime powers in the whole table
+ *     40 u64 offsetsOffset   file offsets of the three arrays
+ *     48 u64 primesOffset
+ *     56 u64 exponentsOffset
+ *   offsets:   N2 - N1 + 2 u64 values; the factors of N1 + i are entries
+ *              offsets[i] to offsets[i + 1] - 1 (1 has none)
+ *   primes:    entryCount values of primeWidth bytes, increasing within a row
+ *   exponents: entryCount u8 values
+ * 
+ * On a little-endian host the arrays are plain uint64_t / uint32_t / uint8_t
+ * arrays at their offsets. Workers build each segment's rows in memory and
+ * claim entries in segment order through an OffsetChain, as Task 2's text
+ * output does. The offsets and primes go straight into the output mapping,
+ * reserved from an upper bound on the entry count. Where the exponents
+ * start depends on the final count, so they go to a temporary file next to
+ * the output and are moved in at the end. The file is then cut to size.
+ * --read-csr=FILE prints a table in --factor-file's format, from the
+ * mapping.
+ *******************************************************************************/
+const char FACTOR_TABLE_MAGIC[8] = {'L', '0', '5', 'F', 'A', 'C', 'T', 'R'};
+const unsigned int FACTOR_TABLE_VERSION = 1;
+const unsigned int FACTOR_TABLE_HEADER_SIZE = 64;
+const double FACTOR_TABLE_BYTES_PER_NUMBER = 128;  // Scratch, plus about 4 prime powers a number held twice
+
+// One segment's rows, indexed by n - lo
+struct FactorTableSegment {
+    PrimePowerScratch scratch;
+    std::vector<unsigned int> hitIndex;  // Prime powers as the pass finds them, prime by prime
+    std::vector<unsigned long long> hitPrime;
+    std::vector<unsigned char> hitExponent;
+    std::vector<unsigned int> rowStart;  // CSR of the segment: row i is entries rowStart[i] to rowStart[i + 1] - 1
+    std::vector<unsigned long long> primes;
+    std::vector<unsigned char> exponents;
+};
+
+// A table mapped by openFactorTable; the offsets are those of the header
+struct FactorTableReader {
+    MappedFile mapped;
+    unsigned int primeWidth;
+    unsigned long long rangeLo;
+    unsigned long long rangeHi;
+    unsigned long long entryCount;
+    unsigned long long offsetsOffset;
+    unsigned long long primesOffset;
+    unsigned long long exponentsOffset;
+};
+
+/*******************************************************************************
+ * Function: alignTo64
+ * 
+ * Input:
+ *   - offset: any file offset
+ * 
+ * Output:
+ *   - Returns the first multiple of 64 at or after offset
+ *******************************************************************************/
+unsigned long long alignTo64(const unsigned long long offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+/*******************************************************************************
+ * Function: buildFactorRows
+ * 
+ * Input:
+ *   - primes: odd primes up to at least sqrt(hi)
+ *   - lo, hi: inclusive segment (1 <= lo <= hi)
+ *   - segment: receives the segment's CSR rows
+ * 
+ * Purpose:
+ *   The pass reports prime powers prime by prime; a counting sort on the
+ *   row index turns them into rows, keeping each row's primes in order
+ *******************************************************************************/
+void buildFactorRows(const std::vector<unsigned int> &primes, const unsigned long long lo,
+                     const unsigned long long hi, FactorTableSegment &segment) {
+    TraceScope trace("factor table segment", lo);
+    unsigned long long count = hi - lo + 1;
+    segment.hitIndex.clear();
+    segment.hitPrime.clear();
+    segment.hitExponent.clear();
+    segment.rowStart.assign(count + 1, 0);
+    forEachPrimePower(primes, lo, hi, segment.scratch,
+                      [&segment](unsigned long long i, unsigned long long p, unsigned int e, unsigned long long) {
+        segment.hitIndex.push_back((unsigned int) i);
+        segment.hitPrime.push_back(p);
+        segment.hitExponent.push_back((unsigned char) e);
+        segment.rowStart[i + 1]++;
+    });
+
+    for (unsigned long long i = 0; i < count; i++) segment.rowStart[i + 1] += segment.rowStart[i];
+    size_t entries = segment.hitIndex.size();
+    segment.primes.resize(entries);
+    segment.exponents.resize(entries);
+    for (size_t h = 0; h < entries; h++) {
+        unsigned int slot = segment.rowStart[segment.hitIndex[h]]++;
+        segment.primes[slot] = segment.hitPrime[h];
+        segment.exponents[slot] = segment.hitExponent[h];
+    }
+    for (unsigned long long i = count; i > 0; i--) segment.rowStart[i] = segment.rowStart[i - 1];  // Undo the advance
+    segment.rowStart[0] = 0;
+}
+
+/*******************************************************************************
+ * Function: factorTableBound
+ * 
+ * Input:
+ *   - primes: odd primes up to at least sqrt(end)
+ *   - start, end: inclusive range
+ * 
+ * Output:
+ *   - Returns an upper bound on the prime powers of all n in the range:
+ *     the exact number of multiples of each prime up to sqrt(end), plus one
+ *     larger prime for every number
+ *******************************************************************************/
+unsigned long long factorTableBound(const std::vector<unsigned int> &primes, const unsigned long long start,
+                                    const unsigned long long end) {
+    unsigned long long root = integerSqrt(end);
+    unsigned long long bound = end - start + 1;
+    for (size_t j = 0; j <= primes.size(); j++) {
+        unsigned long long p = (j == 0) ? 2 : primes[j - 1];
+        if (p > root) break;
+        bound += end / p - (start - 1) / p;
+    }
+    return bound;
+}
+
+/*******************************************************************************
+ * Function: runFactorTableExport
+ * 
+ * Output:
+ *   - Writes the factorization table of the --csr range to --csr-output
+ *   - Prints a summary to stderr
+ *   - Returns 0 on success, 1 if the file cannot be written or the run was
+ *     cancelled (the unfinished file is removed)
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --csr=N1,N2 --csr-output=FILE" runs
+ *******************************************************************************/
+int runFactorTableExport(void) {
+    RunScope run;
+    unsigned long long start = (options.csrFrom < options.csrTo) ? options.csrFrom : options.csrTo;
+    unsigned long long end = (options.csrFrom < options.csrTo) ? options.csrTo : options.csrFrom;
+    const char *path = options.csrOutputPath;
+    if (start == 0) {
+        printf("Factorization tables start at n = 1.\n");
+        return 1;
+    }
+    // Before any size below is computed: count + 1 wraps for the full 64-bit range
+    unsigned long long count = end - start + 1;
+    if (count >= (unsigned long long) SIZE_MAX / 32) {
+        printf("The range is too wide for one table.\n");
+        return 1;
+    }
+    unsigned int primeWidth = (end <= UINT_MAX) ? 4 : 8;
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize = arithSegmentSize(end);
+    unsigned int threadCount = rangeThreadCount('n');
+    if (!fitRangeJob(basePrimeBytes(root), FACTOR_TABLE_BYTES_PER_NUMBER, 1 << 10, segmentSize, threadCount)) return 1;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &primes = table.primes;
+
+    // Both reservations only cost address space until written
+    unsigned long long bound = factorTableBound(primes, start, end);
+    unsigned long long offsetsOffset = FACTOR_TABLE_HEADER_SIZE;
+    unsigned long long primesOffset = alignTo64(offsetsOffset + (count + 1) * sizeof(unsigned long long));
+    unsigned long long reserve = alignTo64(primesOffset + bound * primeWidth) + bound;
+    if (reserve > (unsigned long long) SIZE_MAX) {
+        printf("The range is too wide for one table.\n");
+        return 1;
+    }
+    std::string exponentsPath = std::string(path) + ".exponents";
+    MappedOutput output, exponents;
+    if (!createMappedOutput(path, reserve, output)) {
+        printf("Could not create %s.\n", path);
+        return 1;
+    }
+    if (!createMappedOutput(exponentsPath.c_str(), bound + 1, exponents)) {
+        printf("Could not create %s.\n", exponentsPath.c_str());
+        closeMappedOutput(output, 0);
+        remove(path);
+        return 1;
+    }
+
+    OffsetChain chain;
+    chain.nextSegment = 0;
+    chain.nextOffset = 0;
+    std::atomic<bool> overflowed(false);
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        FactorTableSegment segment;
+        buildFactorRows(primes, lo, hi, segment);
+        unsigned long long entries = segment.primes.size();
+
+        // Claim entries in segment order, like exportPrimesText claims bytes
+        unsigned long long index = (lo - start) / segmentSize;
+        unsigned long long base;
+        {
+            std::unique_lock<std::mutex> guard(chain.lock);
+            while (chain.nextSegment != index) {
+                if (isCancelRequested()) return 0ULL;
+                chain.advanced.wait_for(guard, std::chrono::milliseconds(100));
+            }
+            base = chain.nextOffset;
+            if (base + entries > bound) {
+                overflowed = true;  // Cannot happen while the bound holds
+                stopRun(RUN_STOPPED);
+                chain.advanced.notify_all();
+                return 0ULL;
+            }
+            chain.nextOffset += entries;
+            chain.nextSegment++;
+        }
+        chain.advanced.notify_all();
+
+        unsigned char *rows = output.data + offsetsOffset + (lo - start) * sizeof(unsigned long long);
+        for (unsigned long long i = 0; i <= hi - lo; i++) storeLE64(rows + 8 * i, base + segment.rowStart[i]);
+        unsigned char *out = output.data + primesOffset + base * primeWidth;
+        for (unsigned long long j = 0; j < entries; j++) {
+            if (primeWidth == 4) {
+                storeLE32(out + 4 * j, (unsigned int) segment.primes[j]);
+            } else {
+                storeLE64(out + 8 * j, segment.primes[j]);
+            }
+        }
+        memcpy(exponents.data + base, segment.exponents.data(), entries);
+        return hi - lo + 1;
+    };
+    unsigned long long done = runRangeJob(start, end, segmentSize, threadCount, kernel, true, NULL);
+
+    // Close the last row, move the exponents in behind the primes and fill in the header
+    unsigned long long entryCount = chain.nextOffset;
+    unsigned long long exponentsOffset = alignTo64(primesOffset + entryCount * primeWidth);
+    bool complete = !isCancelRequested() && !overflowed;
+    if (complete) {
+        storeLE64(output.data + offsetsOffset + count * sizeof(unsigned long long), entryCount);
+        memcpy(output.data + exponentsOffset, exponents.data, entryCount);
+
+        unsigned char *header = output.data;
+        memcpy(header, FACTOR_TABLE_MAGIC, sizeof(FACTOR_TABLE_MAGIC));
+        storeLE32(header + 8, FACTOR_TABLE_VERSION);
+        storeLE32(header + 12, primeWidth);
+        storeLE64(header + 16, start);
+        storeLE64(header + 24, end);
+        storeLE64(header + 32, entryCount);
+        storeLE64(header + 40, offsetsOffset);
+        storeLE64(header + 48, primesOffset);
+        storeLE64(header + 56, exponentsOffset);
+    }
+    int ok = closeMappedOutput(output, complete ? exponentsOffset + entryCount : 0);
+    closeMappedOutput(exponents, 0);
+    remove(exponentsPath.c_str());
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    if (!complete || !ok) {
+        remove(path);
+        if (overflowed || !ok) {
+            printf("Error while writing %s.\n", path);
+        } else {
+            fprintf(stderr, "%s%llu numbers factored; %s was removed.\n", runStatusPrefix(), done, path);
+        }
+        return 1;
+    }
+    fprintf(stderr, "%llu numbers factored into %llu prime powers in %.2f s (%llu bytes).\n", done, entryCount,
+            elapsed.count(), exponentsOffset + entryCount);
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: openFactorTable
+ * 
+ * Input:
+ *   - path: factorization table saved by --csr
+ *   - table: receives the mapped table
+ * 
+ * Output:
+ *   - Returns 1 if the header and array bounds are consistent with the file
+ * 
+ * Purpose:
+ *   Maps the file and checks every array lies inside it. Each bound is
+ *   checked against what is left of the file, so no sum or product can wrap
+ *******************************************************************************/
+int openFactorTable(const char *path, FactorTableReader &table) {
+    if (!mapFile(path, table.mapped)) return 0;
+
+    const unsigned char *data = table.mapped.data;
+    unsigned long long size = table.mapped.size;
+    int ok = size >= FACTOR_TABLE_HEADER_SIZE && memcmp(data, FACTOR_TABLE_MAGIC, sizeof(FACTOR_TABLE_MAGIC)) == 0
+             && loadLE32(data + 8) == FACTOR_TABLE_VERSION;
+    if (ok) {
+        table.primeWidth = loadLE32(data + 12);
+        table.rangeLo = loadLE64(data + 16);
+        table.rangeHi = loadLE64(data + 24);
+        table.entryCount = loadLE64(data + 32);
+        table.offsetsOffset = loadLE64(data + 40);
+        table.primesOffset = loadLE64(data + 48);
+        table.exponentsOffset = loadLE64(data + 56);
+        unsigned long long rows = table.rangeHi - table.rangeLo + 1;
+        unsigned long long entryCount = table.entryCount;
+        ok = (table.primeWidth == 4 || table.primeWidth == 8) && table.rangeLo >= 1 && table.rangeLo <= table.rangeHi
+             && table.offsetsOffset <= size && rows < (size - table.offsetsOffset) / 8
+             && table.offsetsOffset + (rows + 1) * 8 <= table.primesOffset
+             && table.primesOffset <= size && entryCount <= (size - table.primesOffset) / table.primeWidth
+             && table.primesOffset + entryCount * table.primeWidth <= table.exponentsOffset
+             && table.exponentsOffset <= size && entryCount <= size - table.exponentsOffset
+             && loadLE64(data + table.offsetsOffset + rows * 8) == entryCount;
+    }
+    if (!ok) unmapFile(table.mapped);
+    return ok;
+}
+
+/*******************************************************************************
+ * Function: readFactorTableRow
+ * 
+ * Input:
+ *   - table: a table opened by openFactorTable
+ *   - n: number in [rangeLo, rangeHi]
+ *   - factors: receives the factorization of n as stored
+ * 
+ * Output:
+ *   - Returns 1 on success, 0 if the row lies outside the table
+ *******************************************************************************/
+int readFactorTableRow(const FactorTableReader &table, const unsigned long long n, Factorization &factors) {
+    const unsigned char *data = table.mapped.data;
+    const unsigned char *row = data + table.offsetsOffset + (n - table.rangeLo) * 8;
+    unsigned long long first = loadLE64(row), last = loadLE64(row + 8);
+    if (first > last || last > table.entryCount || last - first > OMEGA_BINS) return 0;
+
+    factors.count = 0;
+    factors.total = 0;
+    for (unsigned long long j = first; j < last; j++) {
+        const unsigned char *prime = data + table.primesOffset + j * table.primeWidth;
+        factors.prime[factors.count] = (table.primeWidth == 4) ? loadLE32(prime) : loadLE64(prime);
+        factors.exponent[factors.count++] = data[table.exponentsOffset + j];
+        factors.total += data[table.exponentsOffset + j];
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: runFactorTableReader
+ * 
+ * Output:
+ *   - Prints the header of the --read-csr file and, in --factor-file's
+ *     format, the factorizations in the --read-range interval (the whole
+ *     table if no interval was given)
+ *   - Returns 0 on success, 1 if the file is not a valid table
+ * 
+ * Purpose:
+ *   Reads the arrays in place from the mapping, as a consumer would
+ *******************************************************************************/
+int runFactorTableReader(void) {
+    FactorTableReader table;
+    if (!openFactorTable(options.csrInputPath, table)) {
+        printf("%s is not a valid factorization table.\n", options.csrInputPath);
+        return 1;
+    }
+
+    unsigned long long rangeLo = table.rangeLo, rangeHi = table.rangeHi;
+    printf("# %llu factorizations of %llu to %llu, %llu prime powers (%llu bytes)\n", rangeHi - rangeLo + 1, rangeLo,
+           rangeHi, table.entryCount, (unsigned long long) table.mapped.size);
+
+    unsigned long long from = (options.readRange && options.readFrom > rangeLo) ? options.readFrom : rangeLo;
+    unsigned long long to = (options.readRange && options.readTo < rangeHi) ? options.readTo : rangeHi;
+    OutputBuffer out(stdout);
+    for (unsigned long long n = from; n <= to && from <= to; n++) {
+        Factorization factors;
+        if (!readFactorTableRow(table, n, factors)) {
+            flushOutput(out);
+            printf("%s is damaged: the factorization of %llu lies outside the table.\n", options.csrInputPath, n);
+            unmapFile(table.mapped);
+            return 1;
+        }
+        writeNumber(out, n);
+        writeText(out, " |");
+        for (unsigned int i = 0; i < factors.count; i++) {
+            for (unsigned int e = 0; e < factors.exponent[i]; e++) {
+                writeText(out, " ");
+                writeNumber(out, factors.prime[i]);
+                writeText(out, " |");
+            }
+        }
+        writeText(out, "\n");
+        if (n == ULLONG_MAX) break;
+    }
+    flushOutput(out);
+    unmapFile(table.mapped);
+    return 0;
+}
+
+/*******************************************************************************
+ * Combinatorial Prime Sums
+ *******************************************************************************/
+const unsigned long long SUM_CROSS_CHECK_LIMIT = 1000000000ULL;  // Sieve cross-check up to this n2
+
+/*******************************************************************************
+ * Function: sumPrimesUpTo
+ * 
+ * Input:
+ *   - n: upper bound
+ * 
+ * Output:
+ *   - Returns the sum of all primes <= n
+ * 
+ * Purpose:
+ *   One Lucy table lookup for callers that need a single sum
+ *******************************************************************************/
+uint128 sumPrimesUpTo(const unsigned long long n) {
+    if (n < 2) return 0;
+    LucyTable<uint128> table;
+    buildLucyTable(n, true, table);
+    return isCancelRequested() ? 0 : table.at(n);
+}
+
+/*******************************************************************************
+ * Function: sumPrimes
+ * 
+ * Input:
+ *   - n1, n2: range to sum over, in either order
+ * 
+ * Output:
+ *   - Returns the sum of the primes in [n1, n2]
+ * 
+ * Purpose:
+ *   Core function for Task 4: S(n2) - S(n1 - 1) in O(n2^(3/4)) time and
+ *   O(sqrt(n2)) memory, without enumerating any primes
+ *******************************************************************************/
+uint128 sumPrimes(const unsigned long long n1, const unsigned long long n2) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+
+    if (!fitsMemory(lucyTableBytes(end, sizeof(uint128)), "The prime-sum table")) return 0;
+    return sumPrimesUpTo(end) - sumPrimesUpTo(start - 1);
+}
+
+/*******************************************************************************
+ * Function: sumPrimesSieve
+ * 
+ * Input:
+ *   - n1, n2: range to sum over, in either order
+ * 
+ * Output:
+ *   - Returns the sum of the primes in [n1, n2]
+ * 
+ * Purpose:
+ *   Reference result for small ranges, enumerating the primes with the
+ *   segmented sieve used by Task 2
+ *******************************************************************************/
+uint128 sumPrimesSieve(const unsigned long long n1, const unsigned long long n2) {
+    unsigned long long start = (n1 < n2) ? n1 : n2;
+    unsigned long long end = (n1 < n2) ? n2 : n1;
+
+    unsigned long long root = integerSqrt(end);
+    unsigned long long segmentSize = sieveSegmentSize(end);
+    unsigned int threadCount = rangeThreadCount('n');
+    if (!fitRangeJob(basePrimeBytes(root), 1.0 / 16, SEGMENT_SIZE, segmentSize, threadCount)) return 0;
+
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &basePrimes = table.primes;
+    std::mutex sumLock;
+    uint128 sum = 0;
+
+    SegmentKernel kernel = [&](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        SieveSegment segment;
+        sieveSegment(basePrimes, lo, hi, segment);
+        uint128 segmentSum = 0;
+        forEachSegmentPrime(segment, [&segmentSum](unsigned long long prime) { segmentSum += prime; });
+
+        std::lock_guard<std::mutex> guard(sumLock);
+        sum += segmentSum;
+        return countSegmentPrimes(segment);
+    };
+
+    runRangeJob(start, end, segmentSize, threadCount, kernel, true, NULL);
+    return sum;
+}
+
+/*******************************************************************************
+ * Function: sumPrimesTest
+ * 
+ * Input:
+ *   - Two integers (n1,n2) defining the range, comma-separated
+ *   - Enter 0 for either number to exit
+ * 
+ * Output:
+ *   - Sum of the prime numbers in the range, cross-checked against the
+ *     segmented sieve when n2 is small enough to enumerate
+ * 
+ * Purpose:
+ *   Interactive function that sums the primes in a user-specified range
+ *******************************************************************************/
+void sumPrimesTest(void) {
+    unsigned long long n1, n2;
+    char buffer[40];
+
+    while (1) {
+        printf("Please enter n1, n2: ");
+        scanf_s("%llu,%llu", &n1, &n2);
+
+        if (n1 == 0 || n2 == 0) {
+            printf("Press ENTER to exit...");
+            getchar();  // Consume newline
+            getchar();  // Wait for ENTER
             break;
         }
 
-        printf("Please enter the number of prime factors to find: ");
-        scanf_s("%u", &nFactors);
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        uint128 total;
+        {
+            RunScope run;
+            total = sumPrimes(n1, n2);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+        if (runStatus() == RUN_INTERRUPTED) printf("Cancelled.\n");
+        if (isCancelRequested()) continue;
+        printf("Sum of primes between %llu and %llu: %s (%.3fs)\n", n1, n2, formatUint128(total, buffer), elapsed.count());
+
+        if (((n1 > n2) ? n1 : n2) <= SUM_CROSS_CHECK_LIMIT) {
+            uint128 check = sumPrimesSieve(n1, n2);
+            if (isCancelRequested()) {
+                printf("Sieve cross-check cancelled.\n");
+            } else if (check == total) {
+                printf("Segmented sieve cross-check: OK\n");
+            } else {
+                printf("Segmented sieve cross-check: MISMATCH, sieve gives %s\n", formatUint128(check, buffer));
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+ * Distributed Mode
+ * 
+ * A coordinator splits a count or Omega-histogram job into chunks and sends
+ * them to "Lab05 --worker" processes over TCP. Each worker connection has its
+ * own coordinator thread that takes chunks from a shared queue. When a worker
+ * stops answering, its chunk goes back on the queue for the others and the
+ * connection is dropped. Partial results are summed as chunks come back.
+ * 
+ * Protocol (one text line each way per chunk):
+ *   COUNT lo hi [next]   ->  RESULT count
+ *   OMEGA lo hi [next]   ->  RESULT bins h0 h1 ... (h[k] = numbers with k prime factors)
+ *   anything else        ->  ERROR message
+ * The optional next is the end of the chunk the coordinator will hand out
+ * after this one, to any worker. Chunks go out in ascending order, so every
+ * later chunk needs at least the base primes up to sqrt(next), and the
+ * worker prepares them while it replies.
+ *******************************************************************************/
+const unsigned long long DISTRIBUTED_CHUNK_SIZE = 16 * SEGMENT_SIZE;
+const unsigned int WORKER_TIMEOUT_SECONDS = 600;  // A chunk taking longer than this counts as a lost worker
+const unsigned int MAX_LINE = 2048;
+
+/*******************************************************************************
+ * Function: socketStartup
+ * 
+ * Output:
+ *   - Returns 1 if sockets are ready to use
+ * 
+ * Purpose:
+ *   Windows needs Winsock initialised before any socket call
+ *******************************************************************************/
+int socketStartup(void) {
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return 1;
+#endif
+}
+
+/*******************************************************************************
+ * Function: closeSocket
+ * 
+ * Input:
+ *   - s: socket to close
+ * 
+ * Purpose:
+ *   Portable wrapper over closesocket/close
+ *******************************************************************************/
+void closeSocket(socket_t s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+/*******************************************************************************
+ * Function: sendLine
+ * 
+ * Input:
+ *   - s: connected socket
+ *   - line: text to send, including its trailing newline
+ * 
+ * Output:
+ *   - Returns 1 if every byte was sent
+ * 
+ * Purpose:
+ *   Sends a whole protocol line, looping over partial sends
+ *******************************************************************************/
+int sendLine(socket_t s, const char *line) {
+    size_t length = strlen(line);
+    while (length > 0) {
+        int sent = (int) send(s, line, (int) length, SEND_FLAGS);
+        if (sent <= 0) return 0;
+        line += sent;
+        length -= (size_t) sent;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: receiveLine
+ * 
+ * Input:
+ *   - s: connected socket
+ *   - line: buffer of MAX_LINE characters
+ * 
+ * Output:
+ *   - Fills line without the newline; returns 1 on success
+ *   - Returns 0 if the peer closed, timed out or sent an overlong line
+ * 
+ * Purpose:
+ *   Reads one protocol line; requests and replies strictly alternate, so
+ *   reading byte by byte never consumes part of the next message
+ *******************************************************************************/
+int receiveLine(socket_t s, char *line) {
+    unsigned int length = 0;
+    while (length < MAX_LINE - 1) {
+        char c;
+        if (recv(s, &c, 1, 0) != 1) return 0;
+        if (c == '\n') {
+            line[length] = '\0';
+            return 1;
+        }
+        if (c != '\r') line[length++] = c;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Function: omegaHistogram
+ * 
+ * Input:
+ *   - n1, n2: inclusive range to classify (1 <= n1 <= n2)
+ *   - histogram: receives OMEGA_BINS counts; histogram[k] is how many numbers
+ *     in the range have exactly k prime factors
+ * 
+ * Output:
+ *   - Returns 0 if the range does not fit --mem-limit, 1 otherwise
+ * 
+ * Purpose:
+ *   Range engine behind the OMEGA request, run on the local executor without
+ *   a checkpoint. The prime-power pass of --arith finds every factor of a
+ *   segment by sieving, so no number is trial divided.
+ *******************************************************************************/
+int omegaHistogram(const unsigned long long n1, const unsigned long long n2, unsigned long long histogram[OMEGA_BINS]) {
+    std::atomic<unsigned long long> shared[OMEGA_BINS];
+    for (unsigned int k = 0; k < OMEGA_BINS; k++) shared[k] = 0;
+    for (unsigned int k = 0; k < OMEGA_BINS; k++) histogram[k] = 0;
+
+    unsigned long long root = integerSqrt(n2);
+    unsigned long long segmentSize = arithSegmentSize(n2);
+    unsigned int threadCount = rangeThreadCount('n');
+    double bytesPerNumber = sizeof(unsigned long long) + 2;  // Scratch and the Omega of each number
+    if (!fitRangeJob(basePrimeBytes(root), bytesPerNumber, 1 << 10, segmentSize, threadCount)) return 0;
+
+    PrimeTableReader table(root);
+    const std::vector<unsigned int> &primes = table.primes;
+    SegmentKernel kernel = [&shared, &primes](unsigned long long lo, unsigned long long hi) {
+        if (isCancelRequested()) return 0ULL;
+
+        TraceScope trace("factor segment", lo);
+        PrimePowerScratch scratch;
+        std::vector<unsigned char> omega(hi - lo + 1, 0);
+        forEachPrimePower(primes, lo, hi, scratch,
+                          [&omega](unsigned long long i, unsigned long long, unsigned int e, unsigned long long) {
+            omega[i] += (unsigned char) e;
+        });
+
+        unsigned long long local[OMEGA_BINS] = {0};
+        for (unsigned char k : omega) local[k]++;
+        for (unsigned int k = 0; k < OMEGA_BINS; k++) {
+            if (local[k] != 0) shared[k].fetch_add(local[k]);
+        }
+        return hi - lo + 1;
+    };
+
+    // The coordinator reassigns a chunk that fails, so a worker never checkpoints one
+    runRangeJob(n1, n2, segmentSize, threadCount, kernel, true, NULL);
+
+    for (unsigned int k = 0; k < OMEGA_BINS; k++) histogram[k] = shared[k].load();
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: serveRequest
+ * 
+ * Input:
+ *   - request: one protocol line from a coordinator
+ *   - reply: buffer of MAX_LINE characters for the answer
+ * 
+ * Output:
+ *   - Fills reply with a RESULT or ERROR line (newline included)
+ * 
+ * Purpose:
+ *   Runs one chunk on this worker's executor, then extends the prime table
+ *   in the background for the next one
+ *******************************************************************************/
+void serveRequest(const char *request, char *reply) {
+    char command[16];
+    unsigned long long lo, hi, next = 0;
+
+    int fields = sscanf(request, "%15s %llu %llu %llu", command, &lo, &hi, &next);
+    if (fields < 3 || lo > hi) {
+        snprintf(reply, MAX_LINE, "ERROR bad request\n");
+        return;
+    }
+
+    RunScope run;
+    if (strcmp(command, "COUNT") == 0) {
+        unsigned long long total = countPrimes(lo, hi, 'n', false);
+        snprintf(reply, MAX_LINE, "RESULT %llu\n", total);
+    } else if (strcmp(command, "OMEGA") == 0) {
+        if (lo == 0) {
+            snprintf(reply, MAX_LINE, "ERROR 0 has no factorization\n");
+            return;
+        }
+        unsigned long long histogram[OMEGA_BINS];
+        if (!omegaHistogram(lo, hi, histogram)) {
+            snprintf(reply, MAX_LINE, "ERROR over the memory limit\n");
+            return;
+        }
+
+        unsigned int bins = OMEGA_BINS;
+        while (bins > 1 && histogram[bins - 1] == 0) bins--;
+        int length = snprintf(reply, MAX_LINE, "RESULT %u", bins);
+        for (unsigned int k = 0; k < bins; k++) {
+            length += snprintf(reply + length, MAX_LINE - length, " %llu", histogram[k]);
+        }
+        snprintf(reply + length, MAX_LINE - length, "\n");
+    } else {
+        snprintf(reply, MAX_LINE, "ERROR unknown command\n");
+        return;
+    }
+
+    // Have the base primes for the coordinator's next chunk ready before it arrives
+    if (fields == 4 && next > hi) prefetchPrimeTable(integerSqrt(next));
+}
+
+/*******************************************************************************
+ * Function: openListener
+ * 
+ * Input:
+ *   - port: TCP port to listen on, or 0 for any free port
+ * 
+ * Output:
+ *   - Returns a listening socket, or INVALID_SOCKET after a message
+ *******************************************************************************/
+socket_t openListener(const unsigned int port) {
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET) {
+        printf("Could not create a socket.\n");
+        return INVALID_SOCKET;
+    }
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short) port);
+
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        printf("Could not listen on port %u.\n", port);
+        closeSocket(listener);
+        return INVALID_SOCKET;
+    }
+    return listener;
+}
+
+/*******************************************************************************
+ * Function: serveCoordinator
+ * 
+ * Input:
+ *   - connection: accepted connection from a coordinator (closed on return)
+ *   - chunkLimit: chunks to answer before hanging up (0 = no limit)
+ * 
+ * Output:
+ *   - Returns 0 if Ctrl-C stopped the worker, 1 once the coordinator is gone
+ * 
+ * Purpose:
+ *   Answers one coordinator's requests. Chunks run one at a time per
+ *   process, since each already uses every core through the executor. The
+ *   limit lets the self-test play a worker that is lost partway
+ *******************************************************************************/
+int serveCoordinator(socket_t connection, const unsigned long long chunkLimit) {
+    static std::mutex chunkLock;
+    char request[MAX_LINE];
+    char reply[MAX_LINE];
+    unsigned long long answered = 0;
+
+    while ((chunkLimit == 0 || answered < chunkLimit) && receiveLine(connection, request)) {
+        std::lock_guard<std::mutex> guard(chunkLock);
+        serveRequest(request, reply);
+        if (isCancelRequested()) {
+            // Ctrl-C on a worker: never report a partial chunk as complete
+            closeSocket(connection);
+            return 0;
+        }
+        if (!sendLine(connection, reply)) break;
+        answered++;
+    }
+    closeSocket(connection);
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: runWorker
+ * 
+ * Input:
+ *   - port: TCP port to listen on
+ * 
+ * Output:
+ *   - Serves range requests from coordinators until the process is stopped
+ *   - Returns nonzero if the port cannot be opened
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --worker" processes
+ *******************************************************************************/
+int runWorker(unsigned int port) {
+    if (!socketStartup()) {
+        printf("Could not initialise sockets.\n");
+        return 1;
+    }
+
+    socket_t listener = openListener(port);
+    if (listener == INVALID_SOCKET) return 1;
+    printf("Worker listening on port %u.\n", port);
+
+    // Coordinators are served one connection at a time
+    while (1) {
+        socket_t connection = accept(listener, NULL, NULL);
+        if (connection == INVALID_SOCKET) continue;
+
+        if (!serveCoordinator(connection, 0)) {
+            closeSocket(listener);
+            printf("Worker stopped.\n");
+            return 0;
+        }
+    }
+}
+
+struct DistributedJob {
+    unsigned int task;               // TASK2 (count) or TASK3 (Omega histogram)
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long chunkCount;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<unsigned long long> pending;  // Chunks not yet handed out or handed back
+    unsigned long long chunksDone;
+    unsigned int workersAlive;
+    unsigned long long total;
+    unsigned long long histogram[OMEGA_BINS];
+};
+
+/*******************************************************************************
+ * Function: connectToWorker
+ * 
+ * Input:
+ *   - host, port: worker address
+ * 
+ * Output:
+ *   - Returns a connected socket with a receive timeout, or INVALID_SOCKET
+ * 
+ * Purpose:
+ *   Resolves and connects to one worker process
+ *******************************************************************************/
+socket_t connectToWorker(const char *host, const char *port) {
+    struct addrinfo hints;
+    struct addrinfo *addresses = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return INVALID_SOCKET;
+
+    socket_t s = INVALID_SOCKET;
+    for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next) {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s == INVALID_SOCKET) continue;
+        if (connect(s, a->ai_addr, (int) a->ai_addrlen) == 0) break;
+        closeSocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(addresses);
+
+    if (s != INVALID_SOCKET) {
+#ifdef _WIN32
+        DWORD timeout = WORKER_TIMEOUT_SECONDS * 1000;
+#else
+        struct timeval timeout = {WORKER_TIMEOUT_SECONDS, 0};
+#endif
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+    }
+    return s;
+}
+
+/*******************************************************************************
+ * Function: coordinatorConnection
+ * 
+ * Input:
+ *   - job: the shared distributed job
+ *   - address: "host:port" of one worker
+ * 
+ * Output:
+ *   - Adds each chunk result from this worker to the job
+ * 
+ * Purpose:
+ *   Coordinator thread for one worker: hands out chunks until the job is
+ *   done, and returns its chunk to the queue if the worker is lost
+ *******************************************************************************/
+void coordinatorConnection(DistributedJob *job, std::string address) {
+    size_t colon = address.rfind(':');
+    std::string host = (colon == std::string::npos) ? address : address.substr(0, colon);
+    std::string port = (colon == std::string::npos) ? std::to_string(DEFAULT_WORKER_PORT) : address.substr(colon + 1);
+
+    socket_t s = connectToWorker(host.c_str(), port.c_str());
+    if (s == INVALID_SOCKET) {
+        printf("Could not reach worker %s.\n", address.c_str());
+        std::lock_guard<std::mutex> guard(job->lock);
+        job->workersAlive--;
+        job->changed.notify_all();
+        return;
+    }
+
+    while (1) {
+        unsigned long long chunk, next;
+        {
+            std::unique_lock<std::mutex> guard(job->lock);
+            job->changed.wait(guard, [job] { return !job->pending.empty() || job->chunksDone == job->chunkCount; });
+            if (job->chunksDone == job->chunkCount) break;
+            chunk = job->pending.front();
+            job->pending.pop_front();
+            next = job->pending.empty() ? chunk : job->pending.front();
+        }
+
+        unsigned long long lo = job->start + chunk * DISTRIBUTED_CHUNK_SIZE;
+        unsigned long long hi = (job->end - lo < DISTRIBUTED_CHUNK_SIZE) ? job->end : lo + DISTRIBUTED_CHUNK_SIZE - 1;
+        unsigned long long nextLo = job->start + next * DISTRIBUTED_CHUNK_SIZE;
+        unsigned long long nextHi = (job->end - nextLo < DISTRIBUTED_CHUNK_SIZE) ? job->end
+                                                                                 : nextLo + DISTRIBUTED_CHUNK_SIZE - 1;
 
-        printf("Display the results? (y/n) ");
-        getchar();  // Consume the newline from previous scanf
-        scanf_s("%c", &display, 1);
+        char request[MAX_LINE];
+        char reply[MAX_LINE];
+        snprintf(request, MAX_LINE, "%s %llu %llu %llu\n", (job->task == TASK2) ? "COUNT" : "OMEGA", lo, hi, nextHi);
+
+        unsigned long long total = 0;
+        unsigned long long histogram[OMEGA_BINS] = {0};
+        bool ok = sendLine(s, request) && receiveLine(s, reply);
+        if (ok && job->task == TASK2) {
+            ok = sscanf(reply, "RESULT %llu", &total) == 1;
+        } else if (ok) {
+            unsigned int bins = 0;
+            int offset = 0;
+            ok = sscanf(reply, "RESULT %u%n", &bins, &offset) == 1 && bins <= OMEGA_BINS;
+            for (unsigned int k = 0; ok && k < bins; k++) {
+                int consumed = 0;
+                ok = sscanf(reply + offset, " %llu%n", &histogram[k], &consumed) == 1;
+                offset += consumed;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(job->lock);
+        if (!ok) {
+            // Lost or misbehaving worker: hand the chunk to someone else
+            printf("Lost worker %s; reassigning [%llu, %llu].\n", address.c_str(), lo, hi);
+            job->pending.push_front(chunk);
+            job->workersAlive--;
+            job->changed.notify_all();
+            closeSocket(s);
+            return;
+        }
+        job->total += total;
+        for (unsigned int k = 0; k < OMEGA_BINS; k++) job->histogram[k] += histogram[k];
+        job->chunksDone++;
+        job->changed.notify_all();
+    }
+
+    closeSocket(s);
+    std::lock_guard<std::mutex> guard(job->lock);
+    job->workersAlive--;
+    job->changed.notify_all();
+}
+
+/*******************************************************************************
+ * Function: runDistributedJob
+ * 
+ * Input:
+ *   - job: task, start and end filled in (start <= end)
+ *   - addresses: "host:port" of every worker
+ * 
+ * Output:
+ *   - Fills in the job's chunk count, total and histogram
+ *   - Returns 1 if every chunk finished, 0 after printing how many did
+ * 
+ * Purpose:
+ *   Queues the chunks and runs one coordinatorConnection thread per worker
+ *   until the job is done or every worker is lost
+ *******************************************************************************/
+int runDistributedJob(DistributedJob &job, const std::vector<std::string> &addresses) {
+    job.chunkCount = (job.end - job.start) / DISTRIBUTED_CHUNK_SIZE + 1;
+    job.chunksDone = 0;
+    job.workersAlive = (unsigned int) addresses.size();
+    job.total = 0;
+    for (unsigned int k = 0; k < OMEGA_BINS; k++) job.histogram[k] = 0;
+    job.pending.clear();
+    for (unsigned long long chunk = 0; chunk < job.chunkCount; chunk++) job.pending.push_back(chunk);
+
+    std::vector<std::thread> connections;
+    for (const std::string &address : addresses) {
+        connections.emplace_back(coordinatorConnection, &job, address);
+    }
+    for (std::thread &connection : connections) {
+        connection.join();
+    }
+
+    if (job.chunksDone < job.chunkCount) {
+        printf("All workers lost: only %llu of %llu chunks finished.\n", job.chunksDone, job.chunkCount);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: runCoordinator
+ * 
+ * Output:
+ *   - Prints the reduced result of the distributed job
+ *   - Returns 0 on success, nonzero if workers were lost before it finished
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --coordinator=..." runs: splits the --count or
+ *   --omega range into chunks and hands them to the listed workers
+ *******************************************************************************/
+int runCoordinator(void) {
+    if (options.distributedTask == EXIT) {
+        printf("The coordinator needs a job: --count=N1,N2 or --omega=N1,N2\n");
+        return 1;
+    }
+    if (!socketStartup()) {
+        printf("Could not initialise sockets.\n");
+        return 1;
+    }
+
+    std::vector<std::string> addresses;
+    std::string list = options.coordinatorWorkers;
+    size_t position = 0;
+    while (position <= list.size()) {
+        size_t comma = list.find(',', position);
+        if (comma == std::string::npos) comma = list.size();
+        if (comma > position) addresses.push_back(list.substr(position, comma - position));
+        position = comma + 1;
+    }
+
+    DistributedJob job;
+    job.task = options.distributedTask;
+    job.start = (options.jobStart < options.jobEnd) ? options.jobStart : options.jobEnd;
+    job.end = (options.jobStart < options.jobEnd) ? options.jobEnd : options.jobStart;
+    if (job.task == TASK3 && job.start < 2) job.start = 2;  // 1 has no prime factors, as in Task 3
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    if (!runDistributedJob(job, addresses)) return 1;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    if (job.task == TASK2) {
+        printf("%llu total primes found between %llu and %llu.\n", job.total, job.start, job.end);
+    } else {
+        printf("Prime factor counts between %llu and %llu:\n", job.start, job.end);
+        for (unsigned int k = 0; k < OMEGA_BINS; k++) {
+            if (job.histogram[k] != 0) printf("%2u prime factors: %llu\n", k, job.histogram[k]);
+        }
+    }
+    printf("Finished %llu chunks on %u workers in %.2fs.\n", job.chunkCount, (unsigned int) addresses.size(),
+           elapsed.count());
+    return 0;
+}
+
+/*******************************************************************************
+ * Self-Test
+ * 
+ * --self-test (run by CTest as "self-test") checks the engines against
+ * published values and against slower references, one function per engine.
+ * Files are written to the working directory and removed afterwards.
+ *******************************************************************************/
+const char *const SELF_TEST_PRIMES_PATH = "Lab05-self-test.primes";
+const char *const SELF_TEST_CSR_PATH = "Lab05-self-test.csr";
+
+// pi(10^k) for k = 0..12
+const unsigned long long PRIME_COUNT_POWERS_OF_TEN[] = {
+    0, 4, 25, 168, 1229, 9592, 78498, 664579, 5761455, 50847534, 455052511, 4118054813ULL, 37607912018ULL,
+};
+
+static unsigned int selfTestChecks = 0;
+static unsigned int selfTestFailures = 0;
+
+/*******************************************************************************
+ * Function: selfCheck
+ * 
+ * Input:
+ *   - passed: outcome of one check
+ *   - format, ...: what was checked, as for printf
+ * 
+ * Output:
+ *   - Counts the check, and prints it if it failed
+ *******************************************************************************/
+void selfCheck(const bool passed, const char *format, ...) {
+    selfTestChecks++;
+    if (passed) return;
+
+    selfTestFailures++;
+    va_list arguments;
+    va_start(arguments, format);
+    printf("FAILED: ");
+    vprintf(format, arguments);
+    printf("\n");
+    va_end(arguments);
+}
+
+/*******************************************************************************
+ * Function: isPrimeByDivision
+ * 
+ * Input:
+ *   - n: number to test
+ * 
+ * Output:
+ *   - Returns 1 if n is prime, 0 otherwise
+ * 
+ * Purpose:
+ *   Reference for isPrime64 that shares no code with it
+ *******************************************************************************/
+int isPrimeByDivision(const unsigned long long n) {
+    if (n < 2) return 0;
+    for (unsigned long long d = 2; d <= n / d; d++) {
+        if (n % d == 0) return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ * Function: selfTestPrimality
+ * 
+ * Purpose:
+ *   isPrime64 on its own witness bases, below 10^5, where the bases
+ *   {2, 7, 61} take over from the twelve prime bases, on strong
+ *   pseudoprimes to leading bases, and at the top of the 64-bit range
+ *******************************************************************************/
+void selfTestPrimality(void) {
+    // A witness base that is n itself is 0 mod n; 61 once tested composite this way
+    const unsigned long long witnesses[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 61};
+    for (unsigned long long base : witnesses) {
+        selfCheck(isPrime64(base) == 1, "isPrime64(%llu) is prime", base);
+        selfCheck(isPrime64(base * base) == 0, "isPrime64(%llu) is composite", base * base);
+    }
+
+    unsigned long long wrong = 0;
+    for (unsigned long long n = 0; n < 100000; n++) {
+        if (isPrime64(n) != isPrimeByDivision(n)) {
+            if (wrong++ == 0) printf("isPrime64(%llu) = %d\n", n, isPrime64(n));
+        }
+    }
+    selfCheck(wrong == 0, "isPrime64 below 10^5: %llu wrong", wrong);
+
+    const unsigned long long SMALL_BASE_LIMIT = 4759123141ULL;  // Strong pseudoprime to 2, 7 and 61
+    for (unsigned long long n = SMALL_BASE_LIMIT - 200; n <= SMALL_BASE_LIMIT + 200; n++) {
+        selfCheck(isPrime64(n) == isPrimeByDivision(n), "isPrime64(%llu)", n);
+    }
+
+    const unsigned long long pseudoprimes[] = {
+        2047, 1373653, 25326001, 3215031751ULL, 2152302898747ULL, 3474749660383ULL, 341550071728321ULL,
+        3825123056546413051ULL,
+    };
+    for (unsigned long long n : pseudoprimes) selfCheck(isPrime64(n) == 0, "isPrime64(%llu) is composite", n);
+
+    const unsigned long long primes[] = {4294967291ULL, 4294967311ULL, 2305843009213693951ULL,
+                                         18446744073709551557ULL};
+    for (unsigned long long n : primes) selfCheck(isPrime64(n) == 1, "isPrime64(%llu) is prime", n);
+    selfCheck(isPrime64(ULLONG_MAX) == 0, "isPrime64(2^64 - 1) is composite");
+}
+
+/*******************************************************************************
+ * Function: selfTestWidePrimality
+ * 
+ * Purpose:
+ *   isPrimeWide's Baillie-PSW test above 2^64 on Mersenne primes, strong
+ *   pseudoprimes to every base up to 37 and 41, and the ends of the 128-bit
+ *   range, and both 128-bit parsers at 2^128 - 1 and 2^128
+ *******************************************************************************/
+void selfTestWidePrimality(void) {
+    const uint128 one = 1;
+    const uint128 primes[] = {(one << 64) + 13, (one << 89) - 1, (one << 127) - 1, UINT128_MAX_VALUE - 158};
+    const uint128 composites[] = {
+        ((uint128) 0x437a << 64) | 0xe92817f9fc85b7e5ULL,   // 318665857834031151167461 = 399165290221 * 798330580441
+        ((uint128) 0x2be69 << 64) | 0x51adc5b22410a5fdULL,  // 3317044064679887385961981 = 1287836182261 * 2575672364521
+        (uint128) 18446744073709551557ULL * 18446744073709551557ULL,
+        UINT128_MAX_VALUE,
+    };
+    char digits[40];
+    for (uint128 n : primes) selfCheck(isPrimeWide(n) == 1, "isPrimeWide(%s) is prime", formatUint128(n, digits));
+    for (uint128 n : composites) {
+        selfCheck(isPrimeWide(n) == 0, "isPrimeWide(%s) is composite", formatUint128(n, digits));
+    }
+
+    const char *const largest = "340282366920938463463374607431768211455";  // 2^128 - 1
+    const char *const tooLarge = "340282366920938463463374607431768211456";
+    uint128 value = 0;
+    selfCheck(parseUint128(largest, &value) == 1 && value == UINT128_MAX_VALUE, "parseUint128(2^128 - 1)");
+    selfCheck(parseUint128(tooLarge, &value) == 0, "parseUint128(2^128) is rejected");
+    value = 0;
+    int parsed = parseDigitRun((const unsigned char *) largest, strlen(largest), &value);
+    selfCheck(parsed == 1 && value == UINT128_MAX_VALUE, "parseDigitRun(2^128 - 1)");
+    selfCheck(parseDigitRun((const unsigned char *) tooLarge, strlen(tooLarge), &value) == 0,
+              "parseDigitRun(2^128) is rejected");
+}
+
+/*******************************************************************************
+ * Function: selfTestLargeFactorization
+ * 
+ * Purpose:
+ *   factorizeLarge on balanced 100- and 127-bit semiprimes, the square of a
+ *   prime near 2^64 and 2^128 - 1: the factors must be prime and multiply
+ *   back to n. ecmFactor must split both semiprimes on its own.
+ *******************************************************************************/
+void selfTestLargeFactorization(void) {
+    const uint128 semiprimes[] = {
+        (uint128) 1125899906842597ULL * 1125899906842589ULL,        // (2^50 - 27)(2^50 - 35)
+        (uint128) 18446744073709551557ULL * 9223372036854775783ULL,  // (2^64 - 59)(2^63 - 25)
+    };
+    const uint128 numbers[] = {
+        semiprimes[0], semiprimes[1], (uint128) 18446744073709551557ULL * 18446744073709551557ULL, UINT128_MAX_VALUE,
+    };
+    char digits[40];
+
+    for (uint128 n : numbers) {
+        WideFactorization f = factorizeLarge(n);
+        uint128 product = 1;
+        bool allPrime = true;
+        for (unsigned int i = 0; i < f.count; i++) {
+            for (unsigned int e = 0; e < f.exponent[i]; e++) product *= f.prime[i];
+            if (!isPrimeWide(f.prime[i])) allPrime = false;
+        }
+        selfCheck(product == n && allPrime, "factorizeLarge(%s)", formatUint128(n, digits));
+    }
+
+    for (uint128 n : semiprimes) {
+        uint128 d = ecmFactor(n);
+        selfCheck(d > 1 && d < n && n % d == 0, "ecmFactor(%s) splits it", formatUint128(n, digits));
+    }
+}
+
+/*******************************************************************************
+ * Function: selfTestSieveEngines
+ * 
+ * Purpose:
+ *   Every --engine against pi(10^k) up to 10^9, and the Atkin fallback
+ *   against Eratosthenes on a window past ATKIN_LIMIT
+ *******************************************************************************/
+void selfTestSieveEngines(void) {
+    const SieveEngine *selected = sieveEngine;
+    for (unsigned int e = 0; e < SIEVE_ENGINE_COUNT; e++) {
+        sieveEngine = &SIEVE_ENGINES[e];
+        unsigned long long x = 1;
+        for (unsigned int k = 1; k <= 9; k++) {
+            x *= 10;
+            unsigned long long count = countPrimes(1, x, 'n', false);
+            selfCheck(count == PRIME_COUNT_POWERS_OF_TEN[k], "%s: pi(10^%u) = %llu", sieveEngine->name, k, count);
+        }
+    }
+
+    // Atkin just below its limit, and past it, where the job sieves with Eratosthenes instead
+    const unsigned long long windows[][2] = {{ATKIN_LIMIT - 2000000, ATKIN_LIMIT}, {ATKIN_LIMIT, ATKIN_LIMIT + 2000000}};
+    for (const unsigned long long *window : windows) {
+        sieveEngine = &SIEVE_ENGINES[0];
+        unsigned long long expected = countPrimes(window[0], window[1], 'n', false);
+        sieveEngine = &SIEVE_ENGINES[1];
+        unsigned long long count = countPrimes(window[0], window[1], 'n', false);
+        selfCheck(count == expected, "atkin: primes in [%llu, %llu] = %llu, expected %llu", window[0], window[1],
+                  count, expected);
+    }
+    sieveEngine = selected;
+}
+
+/*******************************************************************************
+ * Function: selfTestLucyCount
+ * 
+ * Purpose:
+ *   The Lucy count against pi(10^k) up to 10^12, and against the sieve on
+ *   a window that does not start at 1
+ *******************************************************************************/
+void selfTestLucyCount(void) {
+    unsigned long long x = 1;
+    for (unsigned int k = 1; k <= 12; k++) {
+        x *= 10;
+        unsigned long long count = countPrimesLucy(1, x);
+        selfCheck(count == PRIME_COUNT_POWERS_OF_TEN[k], "Lucy: pi(10^%u) = %llu", k, count);
+    }
+
+    unsigned long long lo = 1000000000000ULL, hi = lo + 10000000;
+    unsigned long long sieved = countPrimes(lo, hi, 'n', false), counted = countPrimesLucy(lo, hi);
+    selfCheck(sieved == counted, "primes in [%llu, %llu]: sieve %llu, Lucy %llu", lo, hi, sieved, counted);
+}
+
+/*******************************************************************************
+ * Function: selfTestPrimeSums
+ * 
+ * Purpose:
+ *   Task 4's Lucy sum against published sums below 2 * 10^6 and 10^9, and
+ *   against the sieve on small ranges and a window near 10^12
+ *******************************************************************************/
+void selfTestPrimeSums(void) {
+    char digits[40];
+    uint128 sum = sumPrimes(1, 2000000);
+    selfCheck(sum == 142913828922ULL, "sum of primes below 2 * 10^6: %s", formatUint128(sum, digits));
+    sum = sumPrimes(1, 1000000000);
+    selfCheck(sum == 24739512092254535ULL, "sum of primes below 10^9: %s", formatUint128(sum, digits));
+
+    const unsigned long long ranges[][2] = {{1, 1}, {2, 2}, {1, 100}, {90, 97}, {1000000000000ULL, 1000010000000ULL}};
+    for (const unsigned long long *range : ranges) {
+        uint128 counted = sumPrimes(range[0], range[1]), sieved = sumPrimesSieve(range[0], range[1]);
+        selfCheck(counted == sieved, "sum of primes in [%llu, %llu]: Lucy %s", range[0], range[1],
+                  formatUint128(counted, digits));
+    }
+}
+
+/*******************************************************************************
+ * Function: selfTestAlmostPrimes
+ * 
+ * Purpose:
+ *   Task 3's combinatorial k-almost-prime count against factorize() on
+ *   [1, 10^6] and on a window near 10^10, for every k up to one past the
+ *   largest that occurs
+ *******************************************************************************/
+void selfTestAlmostPrimes(void) {
+    const unsigned long long ranges[][2] = {{1, 1000000}, {10000000000ULL, 10000100000ULL}};
+    for (const unsigned long long *range : ranges) {
+        unsigned long long lo = range[0], hi = range[1];
+        unsigned long long expected[OMEGA_BINS] = {0};
+        PrimeTableReader primeTable(integerSqrt(hi));
+        for (unsigned long long n = lo; n <= hi; n++) expected[factorize(n, primeTable.primes).total]++;
+
+        for (unsigned int k = 1; k < OMEGA_BINS && (k == 1 || expected[k - 1] != 0); k++) {
+            unsigned long long count = countAlmostPrimes(lo, hi, k);
+            selfCheck(count == expected[k], "%u-almost-primes in [%llu, %llu]: %llu, expected %llu", k, lo, hi, count,
+                      expected[k]);
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: selfTestPrimeCountBounds
+ * 
+ * Purpose:
+ *   The --approximate bounds must contain pi(10^k) for every power of ten
+ *   below 2^64, and the sieve count of a window near 10^12
+ *******************************************************************************/
+void selfTestPrimeCountBounds(void) {
+    // pi(10^k) for k = 13..19, past what the sieve tests reach
+    const unsigned long long larger[] = {
+        346065536839ULL, 3204941750802ULL, 29844570422669ULL, 279238341033925ULL, 2623557157654233ULL,
+        24739954287740860ULL, 234057667276344607ULL,
+    };
+    unsigned long long x = 1;
+    for (unsigned int k = 0; k <= 19; k++, x *= 10) {
+        unsigned long long lower, upper;
+        unsigned long long count = (k <= 12) ? PRIME_COUNT_POWERS_OF_TEN[k] : larger[k - 13];
+        primeCountBounds(x, &lower, &upper);
+        selfCheck(lower <= count && count <= upper, "bounds on pi(10^%u): [%llu, %llu]", k, lower, upper);
+    }
+
+    unsigned long long lo = 1000000000000ULL, hi = lo + 10000000, lower, upper;
+    unsigned long long count = countPrimes(lo, hi, 'n', false);
+    boundRangeCount(lo, hi, &lower, &upper);
+    selfCheck(lower <= count && count <= upper, "bounds on primes in [%llu, %llu]: [%llu, %llu], sieve %llu", lo, hi,
+              lower, upper, count);
+}
+
+/*******************************************************************************
+ * Function: selfTestResidueClasses
+ * 
+ * Purpose:
+ *   --residue counts against the published pi(10^6; 4, a) and against a
+ *   primality test of every member of the class on a window near 10^12,
+ *   including a class that holds a single prime
+ *******************************************************************************/
+void selfTestResidueClasses(void) {
+    ProgramOptions saved = options;
+
+    options.residueModulus = 4;
+    options.residueClass = 1;
+    selfCheck(countPrimes(1, 1000000, 'n', false) == 39175, "pi(10^6; 4, 1) = 39175");
+    options.residueClass = 3;
+    selfCheck(countPrimes(1, 1000000, 'n', false) == 39322, "pi(10^6; 4, 3) = 39322");
+
+    const unsigned long long classes[][2] = {{1, 3}, {2, 7}, {10, 30}, {17, 30030}, {3, 1000003}};
+    unsigned long long lo = 1000000000000ULL, hi = lo + 3000000;
+    for (const unsigned long long *cls : classes) {
+        options.residueClass = cls[0];
+        options.residueModulus = cls[1];
+        unsigned long long expected = 0;
+        for (unsigned long long n = lo + (cls[0] + cls[1] - lo % cls[1]) % cls[1]; n <= hi; n += cls[1]) {
+            expected += isPrime64(n);
+        }
+        unsigned long long count = countPrimes(lo, hi, 'n', false);
+        selfCheck(count == expected, "primes = %llu (mod %llu) in [%llu, %llu]: %llu, expected %llu", cls[0],
+                  cls[1], lo, hi, count, expected);
+    }
+    options.residueClass = 10;
+    options.residueModulus = 30;
+    selfCheck(countPrimes(1, 100, 'n', false) == 0, "primes = 10 (mod 30) below 100");
+    options.residueClass = 2;
+    options.residueModulus = 4;
+    selfCheck(countPrimes(1, 100, 'n', false) == 1, "primes = 2 (mod 4) below 100");
+
+    options = saved;
+}
+
+/*******************************************************************************
+ * Function: selfTestTuples
+ * 
+ * Purpose:
+ *   --tuple counts against published constellation counts, and against a
+ *   primality test of every member below 2 * 10^6 and near 10^12
+ *******************************************************************************/
+void selfTestTuples(void) {
+    struct TupleCase {
+        unsigned int size;
+        unsigned int offsets[5];
+        unsigned long long end;
+        unsigned long long count;  // Constellations starting below end
+    };
+    const TupleCase cases[] = {
+        {2, {0, 2}, 1000000000, 3424506},
+        {3, {0, 2, 6}, 100000000, 55600},
+        {3, {0, 4, 6}, 100000000, 55556},
+        {4, {0, 2, 6, 8}, 100000000, 4768},
+        {4, {0, 4, 6, 10}, 100000000, 9267},
+        {5, {0, 2, 6, 8, 12}, 100000000, 697},
+        {5, {0, 4, 6, 10, 12}, 100000000, 686},
+    };
+    ProgramOptions saved = options;
+
+    for (const TupleCase &c : cases) {
+        options.tupleSize = c.size;
+        for (unsigned int i = 0; i < c.size; i++) options.tupleOffsets[i] = c.offsets[i];
+        char pattern[64];
+        int length = snprintf(pattern, sizeof(pattern), "(0");
+        for (unsigned int i = 1; i < c.size; i++) {
+            length += snprintf(pattern + length, sizeof(pattern) - length, ", %u", c.offsets[i]);
+        }
+        snprintf(pattern + length, sizeof(pattern) - length, ")");
+
+        unsigned long long count = countPrimeTuples(1, c.end, 'n');
+        selfCheck(count == c.count, "%s below %llu: %llu, expected %llu", pattern, c.end, count, c.count);
+
+        const unsigned long long windows[][2] = {{1, 2000000}, {1000000000000ULL, 1000001000000ULL}};
+        for (const unsigned long long *window : windows) {
+            unsigned long long expected = 0;
+            for (unsigned long long n = window[0]; n <= window[1]; n++) {
+                unsigned int i = 0;
+                while (i < c.size && isPrime64(n + c.offsets[i])) i++;
+                expected += (i == c.size);
+            }
+            count = countPrimeTuples(window[0], window[1], 'n');
+            selfCheck(count == expected, "%s in [%llu, %llu]: %llu, expected %llu", pattern, window[0], window[1],
+                      count, expected);
+        }
+    }
+
+    options = saved;
+}
+
+/*******************************************************************************
+ * Function: selfTestPrimeList
+ * 
+ * Purpose:
+ *   Writes binary prime lists over several blocks and reads them back:
+ *   every prime in order, the header, and seeks to values inside, between
+ *   and past the primes
+ *******************************************************************************/
+void selfTestPrimeList(void) {
+    const unsigned long long ranges[][2] = {{1, 3000000}, {1000000000000ULL, 1000002000000ULL}};
+    for (const unsigned long long *range : ranges) {
+        unsigned long long lo = range[0], hi = range[1];
+        unsigned long long written = exportPrimesBinary(lo, hi, SELF_TEST_PRIMES_PATH);
+
+        PrimeListReader reader;
+        if (!openPrimeList(SELF_TEST_PRIMES_PATH, reader)) {
+            selfCheck(false, "prime list of [%llu, %llu] opens", lo, hi);
+            remove(SELF_TEST_PRIMES_PATH);
+            continue;
+        }
+        selfCheck(reader.rangeLo == lo && reader.rangeHi == hi && reader.primeCount == written,
+                  "prime list header of [%llu, %llu]", lo, hi);
+
+        PrimeListCursor cursor;
+        unsigned long long prime, expected = lo, read = 0;
+        bool matched = seekPrimeList(reader, 0, cursor) != 0;
+        while (matched && nextListedPrime(cursor, &prime)) {
+            while (expected <= hi && !isPrime64(expected)) expected++;
+            matched = (prime == expected);
+            expected++;
+            read++;
+        }
+        while (expected <= hi && !isPrime64(expected)) expected++;
+        selfCheck(matched && !cursor.damaged && read == written && expected > hi,
+                  "prime list of [%llu, %llu] reads back", lo, hi);
+
+        const unsigned long long seeks[] = {lo, lo + 1, (lo + hi) / 2, hi - 1000, hi};
+        for (unsigned long long value : seeks) {
+            unsigned long long next = value;
+            while (next <= hi && !isPrime64(next)) next++;
+            bool found = seekPrimeList(reader, value, cursor) && nextListedPrime(cursor, &prime);
+            selfCheck((next > hi) ? !found : (found && prime == next), "prime list seek to %llu", value);
+        }
+        selfCheck(!seekPrimeList(reader, hi + 1, cursor), "prime list seek past %llu", hi);
+
+        closePrimeList(reader);
+        remove(SELF_TEST_PRIMES_PATH);
+    }
+}
+
+/*******************************************************************************
+ * Function: selfTestMultiplicativeFunctions
+ * 
+ * Purpose:
+ *   Every --arith column (phi, mu, sigma, d) of a segment against the
+ *   textbook formulas applied to factorize(), on [1, 10^5] and on a
+ *   window near 10^12
+ *******************************************************************************/
+void selfTestMultiplicativeFunctions(void) {
+    const unsigned long long ranges[][2] = {{1, 100000}, {1000000000000ULL, 1000000010000ULL}};
+    std::vector<unsigned int> selected;
+    for (unsigned int k = 0; k < MULTIPLICATIVE_FUNCTION_COUNT; k++) selected.push_back(k);
+
+    for (const unsigned long long *range : ranges) {
+        unsigned long long lo = range[0], hi = range[1];
+        PrimeTableReader primeTable(integerSqrt(hi));
+        MultiplicativeSegment segment;
+        evaluateSegment(primeTable.primes, lo, hi, selected, segment);
+
+        bool matched = true;
+        for (unsigned long long n = lo; matched && n <= hi; n++) {
+            Factorization f = factorize(n, primeTable.primes);
+            uint128 phi = 1, mu = 1, sigma = 1, d = 1;
+            for (unsigned int i = 0; i < f.count; i++) {
+                uint128 p = f.prime[i], pe = 1;
+                for (unsigned int e = 0; e < f.exponent[i]; e++) pe *= p;
+                phi *= pe / p * (p - 1);
+                mu = (f.exponent[i] > 1) ? 0 : ~mu + 1;  // Negated in two's complement, like the column
+                sigma *= (pe * p - 1) / (p - 1);
+                d *= f.exponent[i] + 1;
+            }
+            const uint128 expected[] = {phi, mu, sigma, d};
+            for (unsigned int k = 0; matched && k < MULTIPLICATIVE_FUNCTION_COUNT; k++) {
+                matched = segment.values[k][n - lo] == expected[k];
+                if (!matched) printf("%s(%llu) differs from factorize().\n", MULTIPLICATIVE_FUNCTIONS[k].name, n);
+            }
+        }
+        selfCheck(matched, "multiplicative functions on [%llu, %llu]", lo, hi);
+    }
+}
+
+/*******************************************************************************
+ * Function: selfTestFactorTable
+ * 
+ * Purpose:
+ *   Writes CSR tables with 4- and 8-byte primes and compares every row read
+ *   back with factorize()
+ *******************************************************************************/
+void selfTestFactorTable(void) {
+    const unsigned long long ranges[][2] = {{1, 100000}, {999999950000ULL, 1000000050000ULL}};
+    ProgramOptions saved = options;
+
+    for (const unsigned long long *range : ranges) {
+        unsigned long long lo = range[0], hi = range[1];
+        options.csrFrom = lo;
+        options.csrTo = hi;
+        options.csrOutputPath = SELF_TEST_CSR_PATH;
+        FactorTableReader table;
+        if (runFactorTableExport() != 0 || !openFactorTable(SELF_TEST_CSR_PATH, table)) {
+            selfCheck(false, "factor table of [%llu, %llu] is written and opens", lo, hi);
+            remove(SELF_TEST_CSR_PATH);
+            continue;
+        }
+
+        PrimeTableReader primeTable(integerSqrt(hi));
+        bool matched = table.rangeLo == lo && table.rangeHi == hi;
+        for (unsigned long long n = lo; matched && n <= hi; n++) {
+            Factorization stored, expected = factorize(n, primeTable.primes);
+            matched = readFactorTableRow(table, n, stored) && stored.count == expected.count;
+            for (unsigned int i = 0; matched && i < stored.count; i++) {
+                matched = stored.prime[i] == expected.prime[i] && stored.exponent[i] == expected.exponent[i];
+            }
+            if (!matched) printf("Row %llu of the factor table differs from factorize().\n", n);
+        }
+        selfCheck(matched, "factor table of [%llu, %llu] reads back", lo, hi);
+
+        unmapFile(table.mapped);
+        remove(SELF_TEST_CSR_PATH);
+    }
+
+    options = saved;
+}
+
+/*******************************************************************************
+ * Function: selfTestWorker
+ * 
+ * Input:
+ *   - listener: listening socket
+ *   - chunkLimit: chunks to answer before hanging up (0 = no limit)
+ * 
+ * Purpose:
+ *   Thread body for an in-process worker serving a single coordinator
+ *******************************************************************************/
+void selfTestWorker(socket_t listener, const unsigned long long chunkLimit) {
+    socket_t connection = accept(listener, NULL, NULL);
+    if (connection != INVALID_SOCKET) serveCoordinator(connection, chunkLimit);
+}
+
+/*******************************************************************************
+ * Function: selfTestDistributed
+ * 
+ * Purpose:
+ *   Runs a count and an Omega job on two local workers, the first of which
+ *   is lost after one chunk, and compares the reduced results with local
+ *   runs
+ *******************************************************************************/
+void selfTestDistributed(void) {
+    if (!socketStartup()) {
+        selfCheck(false, "sockets start");
+        return;
+    }
+
+    const unsigned int tasks[] = {TASK2, TASK3};
+    for (unsigned int task : tasks) {
+        std::vector<std::string> addresses;
+        std::vector<std::thread> workers;
+        std::vector<socket_t> listeners;
+        for (unsigned long long chunkLimit = 1; chunkLimit <= 2; chunkLimit++) {
+            socket_t listener = openListener(0);
+            struct sockaddr_in address;
+            socklen_t length = sizeof(address);
+            if (listener == INVALID_SOCKET
+                || getsockname(listener, (struct sockaddr *) &address, &length) != 0) {
+                break;
+            }
+            listeners.push_back(listener);
+            addresses.push_back("127.0.0.1:" + std::to_string(ntohs(address.sin_port)));
+            workers.emplace_back(selfTestWorker, listener, (chunkLimit == 1) ? 1 : 0);
+        }
 
-        unsigned int total = primeFactorization(n1, n2, nFactors, display);
-        printf("%u total numbers with %u prime factors found between %u and %u.\n",
-               total, nFactors, n1, n2);
+        DistributedJob job;
+        job.task = task;
+        job.start = 2;
+        job.end = 4 * DISTRIBUTED_CHUNK_SIZE;
+        bool finished = addresses.size() == 2 && runDistributedJob(job, addresses);
+        for (socket_t listener : listeners) shutdown(listener, 2);  // Wakes a worker that was never reached
+        for (std::thread &worker : workers) worker.join();
+        for (socket_t listener : listeners) closeSocket(listener);
+
+        if (task == TASK2) {
+            unsigned long long expected = countPrimes(job.start, job.end, 'n', false);
+            selfCheck(finished && job.total == expected, "distributed count: %llu, expected %llu", job.total,
+                      expected);
+        } else {
+            unsigned long long expected[OMEGA_BINS] = {0};
+            PrimeTableReader primeTable(integerSqrt(job.end));
+            for (unsigned long long n = job.start; n <= job.end; n++) expected[factorize(n, primeTable.primes).total]++;
+            selfCheck(finished && memcmp(job.histogram, expected, sizeof(expected)) == 0, "distributed Omega histogram");
+        }
+    }
+}
+
+/*******************************************************************************
+ * Function: runSelfTest
+ * 
+ * Output:
+ *   - Prints every failed check and a summary
+ *   - Returns 0 if every check passed, 1 otherwise
+ * 
+ * Purpose:
+ *   Entry point for "Lab05 --self-test" runs (the CTest "self-test" test)
+ *******************************************************************************/
+int runSelfTest(void) {
+    // Runs are short, and the checkpoint file is the user's
+    options.checkpointInterval = 0;
+    options.resume = false;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    selfTestPrimality();
+    selfTestWidePrimality();
+    selfTestLargeFactorization();
+    selfTestSieveEngines();
+    selfTestLucyCount();
+    selfTestPrimeSums();
+    selfTestAlmostPrimes();
+    selfTestPrimeCountBounds();
+    selfTestResidueClasses();
+    selfTestTuples();
+    selfTestPrimeList();
+    selfTestMultiplicativeFunctions();
+    selfTestFactorTable();
+    selfTestDistributed();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    if (selfTestFailures != 0) {
+        printf("Self-test failed: %u of %u checks in %.2fs.\n", selfTestFailures, selfTestChecks, elapsed.count());
+        return 1;
     }
-}
\ No newline at end of file
+    printf("Self-test passed: %u checks in %.2fs.\n", selfTestChecks, elapsed.count());
+    return 0;
+}